@@ -0,0 +1,209 @@
+#!/usr/bin/env ruby
+#
+# Measures the throughput of NDArray in construction, item access,
+# comparison, conversion, and matrix product over dtypes, dimensions,
+# memory orders, and sizes.
+#
+#   $ rake benchmark
+#   $ rake benchmark SIZES=10,1000,100000,100000000 FILTER=compare OUTPUT=results.jsonl
+#
+# The cases are selected and tuned by the environment variables:
+#
+#   SIZES    the comma-separated numbers of items (default: 10,1000,100000)
+#   DTYPES   the comma-separated dtypes (default: all the numeric dtypes)
+#   FILTER   the regexp to select the scenarios by name
+#   TIME     the seconds to repeat each case for (default: 0.2)
+#   THREADS  NDArray.num_threads
+#   OUTPUT   the file to append the results to in JSON Lines
+#
+# Each line of OUTPUT is an object of the scenario name, its parameters,
+# the number of iterations, the seconds per iteration, and the items per
+# second, together with the versions and the number of threads, so that
+# the results of the releases can be compared.
+
+require "json"
+require "time"
+require "memory-view-test-helper"
+
+NDArray = MemoryViewTestHelper::NDArray
+
+DTYPES = ENV.fetch("DTYPES", "int8,uint8,int16,uint16,int32,uint32,int64,uint64," \
+                             "float16,bfloat16,float32,float64,complex64,complex128,bool")
+              .split(",").map(&:to_sym)
+SIZES = ENV.fetch("SIZES", "10,1000,100000").split(",").map {|s| Integer(s.delete("_")) }
+FILTER = Regexp.new(ENV.fetch("FILTER", ""))
+TIME = Float(ENV.fetch("TIME", "0.2"))
+NDArray.num_threads = Integer(ENV["THREADS"]) if ENV["THREADS"]
+
+# Ruby arrays beyond this are too large to be an input or an output
+RUBY_ARRAY_LIMIT = 1_000_000
+
+# 1 to MAX_INLINE_DIM + 1, where the index buffers go to the heap
+NDIMS = [1, 2, 3, 4, 8, 16, 32, 33]
+
+METADATA = {
+  version: MemoryViewTestHelper::VERSION,
+  ruby: RUBY_DESCRIPTION,
+  num_threads: NDArray.num_threads,
+  time: Time.now.utc.iso8601,
+}.freeze
+
+$output = ENV["OUTPUT"] && File.open(ENV["OUTPUT"], "a")
+
+def now
+  Process.clock_gettime(Process::CLOCK_MONOTONIC)
+end
+
+# Run the job returned by the block, that prepares the fixtures, for TIME
+# seconds, and report the throughput of the items processed by a call.
+def bench(name, items:, **params)
+  return unless FILTER.match?(name)
+
+  job = yield
+  job.call # warm up
+
+  iterations = 0
+  start = now
+  elapsed = 0.0
+  while elapsed < TIME
+    job.call
+    iterations += 1
+    elapsed = now - start
+  end
+
+  seconds = elapsed / iterations
+  result = {
+    name: name,
+    **params,
+    items: items,
+    iterations: iterations,
+    seconds: seconds,
+    items_per_second: items / seconds,
+  }
+  label = params.map {|k, v| "#{k}=#{v}" }.join(" ")
+  printf("%-22s %-48s %12.3e s %12.3e items/s\n", name, label, seconds, items / seconds)
+  $output&.puts(JSON.generate(result.merge(METADATA)))
+
+  # not to charge the garbage of this case to the next one
+  job = nil
+  GC.start
+end
+
+def shape_of(size)
+  size > 100 && size % 100 == 0 ? [size / 100, 100] : [size]
+end
+
+def fixture(size, dtype, order: :row_major)
+  NDArray.random(shape_of(size), dtype, seed: size, order: order)
+end
+
+# Construction
+
+DTYPES.each do |dtype|
+  SIZES.each do |size|
+    shape = shape_of(size)
+    bench("construct/new", dtype: dtype, size: size, items: size) do
+      -> { NDArray.new(shape, dtype) }
+    end
+    bench("construct/zeros", dtype: dtype, size: size, items: size) do
+      -> { NDArray.zeros(shape, dtype) }
+    end
+    bench("construct/random", dtype: dtype, size: size, items: size) do
+      -> { NDArray.random(shape, dtype, seed: 1) }
+    end
+    bench("construct/from_binary", dtype: dtype, size: size, items: size) do
+      binary = fixture(size, dtype).to_binary
+      -> { NDArray.from_binary(binary, shape, dtype) }
+    end
+    next if size > RUBY_ARRAY_LIMIT
+    bench("construct/try_convert", dtype: dtype, size: size, items: size) do
+      ary = fixture(size, dtype).to_a
+      -> { NDArray.try_convert(ary, dtype: dtype) }
+    end
+  end
+end
+
+# Item access
+
+DTYPES.each do |dtype|
+  NDIMS.each do |ndim|
+    # at most 4096 items in the first 12 dimensions
+    shape = Array.new(ndim) {|i| i < 12 ? 2 : 1 }
+    ary = NDArray.random(shape, dtype, seed: ndim)
+    rng = Random.new(ndim)
+    indices = Array.new(1000) { shape.map {|n| rng.rand(n) } }
+    bench("access/aref", dtype: dtype, ndim: ndim, items: indices.size) do
+      -> { indices.each {|idx| ary[*idx] } }
+    end
+    bench("access/aset", dtype: dtype, ndim: ndim, items: indices.size) do
+      # ary[*idx] = value allocates an array for the arguments
+      value = ary[*indices[0]]
+      args = indices.map {|idx| [*idx, value] }
+      -> { args.each {|a| ary.[]=(*a) } }
+    end
+  end
+end
+
+# Comparison
+
+DTYPES.each do |dtype|
+  SIZES.each do |size|
+    [:row_major, :column_major].each do |order|
+      bench("compare/==", dtype: dtype, size: size, order: order, items: size) do
+        a = fixture(size, dtype)
+        b = fixture(size, dtype, order: order)
+        -> { a == b }
+      end
+      bench("compare/allclose?", dtype: dtype, size: size, order: order, items: size) do
+        a = fixture(size, dtype)
+        b = fixture(size, dtype, order: order)
+        -> { a.allclose?(b) }
+      end
+    end
+  end
+end
+
+# Conversion
+
+DTYPES.each do |dtype|
+  SIZES.each do |size|
+    target = dtype == :float64 ? :float32 : :float64
+    [:row_major, :column_major].each do |order|
+      bench("convert/to_binary", dtype: dtype, size: size, order: order, items: size) do
+        a = fixture(size, dtype)
+        -> { a.to_binary(order: order) }
+      end
+      bench("convert/astype", dtype: dtype, size: size, order: order, items: size) do
+        a = fixture(size, dtype, order: order)
+        -> { a.astype(target, order: :row_major) }
+      end
+    end
+    next if size > RUBY_ARRAY_LIMIT
+    bench("convert/to_a", dtype: dtype, size: size, items: size) do
+      a = fixture(size, dtype)
+      -> { a.to_a }
+    end
+  end
+end
+
+# Matrix product
+#
+# The square matrices have about size items, and the items are the
+# multiply-adds.
+
+DOT_DTYPES = DTYPES - [:complex64, :complex128, :bool]
+
+DOT_DTYPES.each do |dtype|
+  SIZES.each do |size|
+    n = Math.sqrt(size).round
+    [:row_major, :column_major].each do |order|
+      bench("linalg/dot", dtype: dtype, size: n * n, order: order, items: n ** 3) do
+        a = NDArray.random([n, n], dtype, seed: 1, order: order)
+        b = NDArray.random([n, n], dtype, seed: 2, order: order)
+        -> { a.dot(b) }
+      end
+    end
+  end
+end
+
+$output&.close
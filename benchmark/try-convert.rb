@@ -0,0 +1,32 @@
+#!/usr/bin/env ruby
+#
+# Compares NDArray.try_convert with the conversion implemented in Ruby.
+#
+#   $ rake compile
+#   $ ruby -I ext/memory-view-test-helper -I lib benchmark/try-convert.rb
+
+require "benchmark"
+require "memory-view-test-helper"
+
+NDArray = MemoryViewTestHelper::NDArray
+
+def convert_in_ruby(ary, dtype)
+  dtype, shape, cache = NDArray.send(:detect_dtype_and_shape, ary, dtype)
+  nar = NDArray.__new__(shape, dtype, :row_major)
+  NDArray.send(:assign_cache, nar, cache)
+  nar
+end
+
+n = Integer(ENV.fetch("N", 1_000_000))
+inputs = {
+  "1-D"         => Array.new(n) {|i| i.to_f },
+  "2-D"         => Array.new(1000) {|i| Array.new(n / 1000) {|j| i + j } },
+  "deep-nested" => Array.new(n / 1000) { [[[[[Array.new(1000) { 1.5 }]]]]] },
+}
+
+Benchmark.bm(24) do |x|
+  inputs.each do |label, ary|
+    x.report("#{label} (ruby)")   { convert_in_ruby(ary, nil) }
+    x.report("#{label} (native)") { NDArray.try_convert(ary) }
+  end
+end
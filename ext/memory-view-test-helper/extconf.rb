@@ -1,2 +1,14 @@
 require "mkmf"
+
+have_header("ruby/memory_view.h")
+
+if have_header("sys/mman.h")
+  have_func("mmap", "sys/mman.h")
+  have_func("madvise", "sys/mman.h")
+end
+
+if have_header("pthread.h")
+  have_library("pthread", "pthread_create")
+end
+
 create_makefile("memory_view_test_helper")
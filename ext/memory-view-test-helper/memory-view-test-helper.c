@@ -1,7 +1,26 @@
 #include <ruby.h>
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+# include <ruby/memory_view.h>
+#endif
+
+#include <ruby/thread.h>
 
 #include <float.h>
 #include <limits.h>
+#include <math.h>
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# define NDARRAY_USE_MMAP 1
+#endif
 
 #define NUM2INT8(num) num2int8(num)
 #define NUM2UINT8(num) num2uint8(num)
@@ -87,60 +106,367 @@ static float
 num2flt(VALUE num)
 {
   double dbl = NUM2DBL(num);
-  if (dbl < FLT_MIN || FLT_MAX < dbl) {
+  if (dbl < -FLT_MAX || FLT_MAX < dbl) {
     rb_raise(rb_eRangeError, "float %lf too %s to convert to `float'",
              dbl, dbl < 0 ? "small" : "big");
   }
   return (float)dbl;
 }
 
+/* Half-precision floats
+ *
+ * float16 is IEEE 754 binary16, and bfloat16 is the upper half of binary32.
+ * They are converted from and to float by the bit operations without
+ * branches for normal numbers, rounding to the nearest even. */
+
+static inline uint32_t
+float_to_bits(const float f)
+{
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+static inline float
+bits_to_float(const uint32_t x)
+{
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+static inline float
+float16_to_float(const uint16_t h)
+{
+  const uint32_t shifted_exp = 0x7c00u << 13;
+  uint32_t x = (uint32_t)(h & 0x7fff) << 13;
+  const uint32_t exp = x & shifted_exp;
+
+  x += (127 - 15) << 23;
+  if (exp == shifted_exp) {
+    /* Inf and NaN */
+    x += (128 - 16) << 23;
+  }
+  else if (exp == 0) {
+    /* zero and subnormals are normalized by the float subtraction */
+    x = float_to_bits(bits_to_float(x + (1 << 23)) - bits_to_float(113u << 23));
+  }
+  return bits_to_float(x | ((uint32_t)(h & 0x8000) << 16));
+}
+
+static inline uint16_t
+float_to_float16(const float f)
+{
+  uint32_t x = float_to_bits(f);
+  const uint32_t sign = x & 0x80000000u;
+  uint16_t h;
+
+  x ^= sign;
+  if (x >= (127 + 16) << 23) {
+    /* NaN, or Inf for the overflow */
+    h = x > 0x7f800000u ? 0x7e00 : 0x7c00;
+  }
+  else if (x < 113u << 23) {
+    /* subnormals are rounded by the float addition */
+    const uint32_t magic = ((127 - 15) + (23 - 10) + 1) << 23;
+    h = (uint16_t)(float_to_bits(bits_to_float(x) + bits_to_float(magic)) - magic);
+  }
+  else {
+    const uint32_t mant_odd = (x >> 13) & 1;
+    x += ((uint32_t)(15 - 127) << 23) + 0xfff + mant_odd;
+    h = (uint16_t)(x >> 13);
+  }
+  return h | (uint16_t)(sign >> 16);
+}
+
+static inline float
+bfloat16_to_float(const uint16_t b)
+{
+  return bits_to_float((uint32_t)b << 16);
+}
+
+static inline uint16_t
+float_to_bfloat16(const float f)
+{
+  const uint32_t x = float_to_bits(f);
+  if ((x & 0x7fffffffu) > 0x7f800000u) {
+    /* keep NaN quiet, as the rounding can make it Inf */
+    return (uint16_t)((x >> 16) | 0x40);
+  }
+  return (uint16_t)((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+}
+
+/* Round a double to float to odd, that is toward zero setting the last bit
+ * when inexact.  Rounding the result again to float16 or bfloat16 gives the
+ * same as rounding the double directly, since float has more than 2 bits
+ * over them. */
+static inline float
+double_to_float_odd(const double d)
+{
+  const float f = (float)d;
+  if ((double)f == d || isnan(d)) {
+    return f;
+  }
+  uint32_t x = float_to_bits(f);
+  if (fabs((double)f) > fabs(d)) {
+    --x;
+  }
+  return bits_to_float(x | 1);
+}
+
+#define NUM2FLOAT16(num) num2float16(num)
+#define NUM2BFLOAT16(num) num2bfloat16(num)
+
+static uint16_t
+num2float16(VALUE num)
+{
+  const double dbl = NUM2DBL(num);
+  const uint16_t h = float_to_float16(double_to_float_odd(dbl));
+  if ((h & 0x7fff) == 0x7c00 && !isinf(dbl)) {
+    rb_raise(rb_eRangeError, "float %lf too %s to convert to `float16'",
+             dbl, dbl < 0 ? "small" : "big");
+  }
+  return h;
+}
+
+static uint16_t
+num2bfloat16(VALUE num)
+{
+  const double dbl = NUM2DBL(num);
+  const uint16_t b = float_to_bfloat16(double_to_float_odd(dbl));
+  if ((b & 0x7fff) == 0x7f80 && !isinf(dbl)) {
+    rb_raise(rb_eRangeError, "float %lf too %s to convert to `bfloat16'",
+             dbl, dbl < 0 ? "small" : "big");
+  }
+  return b;
+}
+
 VALUE mMemoryViewTestHelper;
 VALUE cNDArray;
 
 static VALUE sym_row_major;
 static VALUE sym_column_major;
 static VALUE sym_auto;
+static VALUE sym_r;
+static VALUE sym_rw;
+static VALUE sym_little;
+static VALUE sym_big;
+static VALUE sym_native;
+static VALUE sym_swap;
+static VALUE sym_uniform;
+static VALUE sym_normal;
 
 #define MAX_INLINE_DIM 32
 
+/* The dtypes of items other than record, in the order of ndarray_dtype_t.
+ *
+ * X(name, type, kind, load, num2type, type2num) is expanded for each dtype
+ * to generate the enumerators, the functions specialized for the dtype, and
+ * the tables indexed by dtype, so that the dtype is dispatched once for
+ * each operation instead of each item.  kind is the type that the items are
+ * computed in, i64, u64, f64, or c128, and load converts an item to it.
+ * num2type and type2num convert an item from and to a Ruby object.
+ *
+ * The name is pasted to the identifiers by ## directly, as bool is a macro
+ * of stdbool.h and expanded when passed to another macro. */
+#define NDARRAY_FOR_EACH_INTEGER_DTYPE(X) \
+  X(int8, int8_t, i64, NDARRAY_LOAD_ITEM, NUM2INT8, INT2NUM) \
+  X(uint8, uint8_t, u64, NDARRAY_LOAD_ITEM, NUM2UINT8, UINT2NUM) \
+  X(int16, int16_t, i64, NDARRAY_LOAD_ITEM, NUM2INT16, INT2NUM) \
+  X(uint16, uint16_t, u64, NDARRAY_LOAD_ITEM, NUM2UINT16, UINT2NUM) \
+  X(int32, int32_t, i64, NDARRAY_LOAD_ITEM, NUM2INT32, LONG2NUM) \
+  X(uint32, uint32_t, u64, NDARRAY_LOAD_ITEM, NUM2UINT32, ULONG2NUM) \
+  X(int64, int64_t, i64, NDARRAY_LOAD_ITEM, NUM2INT64, LL2NUM) \
+  X(uint64, uint64_t, u64, NDARRAY_LOAD_ITEM, NUM2UINT64, ULL2NUM)
+
+/* The dtypes computed by the arithmetic of C */
+#define NDARRAY_FOR_EACH_REAL_DTYPE(X) \
+  NDARRAY_FOR_EACH_INTEGER_DTYPE(X) \
+  X(float32, float, f64, NDARRAY_LOAD_ITEM, NUM2FLT, DBL2NUM) \
+  X(float64, double, f64, NDARRAY_LOAD_ITEM, NUM2DBL, DBL2NUM)
+
+/* The half-precision floats held in bits */
+#define NDARRAY_FOR_EACH_HALF_DTYPE(X) \
+  X(float16, ndarray_float16_t, f64, float16_to_float, NUM2FLOAT16, FLOAT162NUM) \
+  X(bfloat16, ndarray_bfloat16_t, f64, bfloat16_to_float, NUM2BFLOAT16, BFLOAT162NUM)
+
+#define NDARRAY_FOR_EACH_COMPLEX_DTYPE(X) \
+  X(complex64, ndarray_complex64_t, c128, ndarray_complex64_to_complex128, NUM2COMPLEX64, COMPLEX2NUM) \
+  X(complex128, ndarray_complex128_t, c128, NDARRAY_LOAD_ITEM, NUM2COMPLEX128, COMPLEX2NUM)
+
+#define NDARRAY_FOR_EACH_DTYPE(X) \
+  NDARRAY_FOR_EACH_REAL_DTYPE(X) \
+  NDARRAY_FOR_EACH_HALF_DTYPE(X) \
+  NDARRAY_FOR_EACH_COMPLEX_DTYPE(X) \
+  X(bool, uint8_t, u64, NDARRAY_LOAD_ITEM, NUM2BOOL, BOOL2NUM)
+
+#define NDARRAY_LOAD_ITEM(v) (v)
+
+#define DTYPE_ENUMERATOR(name, type, kind, load, num2type, type2num) ndarray_dtype_##name,
+
 typedef enum {
   ndarray_dtype_none = 0,
-  ndarray_dtype_int8,
-  ndarray_dtype_uint8,
-  ndarray_dtype_int16,
-  ndarray_dtype_uint16,
-  ndarray_dtype_int32,
-  ndarray_dtype_uint32,
-  ndarray_dtype_int64,
-  ndarray_dtype_uint64,
-  ndarray_dtype_float32,
-  ndarray_dtype_float64,
+  NDARRAY_FOR_EACH_DTYPE(DTYPE_ENUMERATOR)
+  ndarray_dtype_record,
 
   ___ndarray_dtype_sentinel___
 } ndarray_dtype_t;
 
+#undef DTYPE_ENUMERATOR
+
 #define NDARRAY_NUM_DTYPES ((int)___ndarray_dtype_sentinel___)
 
+/* The items of complex dtypes, and of float16 and bfloat16 in bits */
+typedef struct { float re, im; } ndarray_complex64_t;
+typedef struct { double re, im; } ndarray_complex128_t;
+typedef uint16_t ndarray_float16_t;
+typedef uint16_t ndarray_bfloat16_t;
+
+static inline ndarray_complex128_t
+ndarray_complex64_to_complex128(const ndarray_complex64_t v)
+{
+  return (ndarray_complex128_t){ v.re, v.im };
+}
+
+/* A buffer for an item of any dtype, aligned for accessing it by its type */
+#define DTYPE_ITEM_MEMBER(name, type, kind, load, num2type, type2num) type item_##name;
+
+typedef union {
+  NDARRAY_FOR_EACH_DTYPE(DTYPE_ITEM_MEMBER)
+  uint8_t bytes[16];
+} ndarray_item_buf_t;
+
+#undef DTYPE_ITEM_MEMBER
+
+/* The size of the record dtype depends on the format of each array */
+#define DTYPE_SIZE(name, type, kind, load, num2type, type2num) sizeof(type),
+
 static const int ndarray_dtype_sizes[] = {
   0,
-  sizeof(int8_t),
-  sizeof(uint8_t),
-  sizeof(int16_t),
-  sizeof(uint16_t),
-  sizeof(int32_t),
-  sizeof(uint32_t),
-  sizeof(int64_t),
-  sizeof(uint64_t),
-  sizeof(float),
-  sizeof(double),
+  NDARRAY_FOR_EACH_DTYPE(DTYPE_SIZE)
+  0,
 };
 
+#undef DTYPE_SIZE
+
 #define SIZEOF_DTYPE(type) (*(const int *)(&ndarray_dtype_sizes[type]))
 
 static ID ndarray_dtype_ids[NDARRAY_NUM_DTYPES];
 
 #define DTYPE_ID(type) (*(const ID *)(&ndarray_dtype_ids[type]))
 
+/* The item formats used for exporting MemoryView, in pack-template notation.
+ * The notation has no code for half-precision floats, complex numbers, and
+ * booleans, so they are exported as the integers or the pairs of floats of
+ * the same size.  The format of a record array is its own. */
+static const char *const ndarray_dtype_formats[] = {
+  [ndarray_dtype_none] = NULL,
+  [ndarray_dtype_int8] = "c",
+  [ndarray_dtype_uint8] = "C",
+  [ndarray_dtype_int16] = "s",
+  [ndarray_dtype_uint16] = "S",
+  [ndarray_dtype_int32] = "l",
+  [ndarray_dtype_uint32] = "L",
+  [ndarray_dtype_int64] = "q",
+  [ndarray_dtype_uint64] = "Q",
+  [ndarray_dtype_float32] = "f",
+  [ndarray_dtype_float64] = "d",
+  [ndarray_dtype_float16] = "S",
+  [ndarray_dtype_bfloat16] = "S",
+  [ndarray_dtype_complex64] = "f2",
+  [ndarray_dtype_complex128] = "d2",
+  [ndarray_dtype_bool] = "C",
+  [ndarray_dtype_record] = NULL,
+};
+
+_Static_assert(sizeof(ndarray_dtype_formats) / sizeof(ndarray_dtype_formats[0]) == NDARRAY_NUM_DTYPES,
+               "ndarray_dtype_formats must have the entries of all the dtypes");
+
+/* The item formats of the items in the byte order opposite to the native
+ * one.  Floats have their own codes of the byte orders. */
+#ifdef WORDS_BIGENDIAN
+# define SWAPPED(code) code "<"
+# define SWAPPED_FLOAT "e"
+# define SWAPPED_DOUBLE "E"
+#else
+# define SWAPPED(code) code ">"
+# define SWAPPED_FLOAT "g"
+# define SWAPPED_DOUBLE "G"
+#endif
+
+static const char *const ndarray_dtype_swapped_formats[] = {
+  [ndarray_dtype_none] = NULL,
+  [ndarray_dtype_int8] = "c",
+  [ndarray_dtype_uint8] = "C",
+  [ndarray_dtype_int16] = SWAPPED("s"),
+  [ndarray_dtype_uint16] = SWAPPED("S"),
+  [ndarray_dtype_int32] = SWAPPED("l"),
+  [ndarray_dtype_uint32] = SWAPPED("L"),
+  [ndarray_dtype_int64] = SWAPPED("q"),
+  [ndarray_dtype_uint64] = SWAPPED("Q"),
+  [ndarray_dtype_float32] = SWAPPED_FLOAT,
+  [ndarray_dtype_float64] = SWAPPED_DOUBLE,
+  [ndarray_dtype_float16] = SWAPPED("S"),
+  [ndarray_dtype_bfloat16] = SWAPPED("S"),
+  [ndarray_dtype_complex64] = SWAPPED_FLOAT "2",
+  [ndarray_dtype_complex128] = SWAPPED_DOUBLE "2",
+  [ndarray_dtype_bool] = "C",
+  [ndarray_dtype_record] = NULL,
+};
+
+_Static_assert(sizeof(ndarray_dtype_swapped_formats) / sizeof(ndarray_dtype_swapped_formats[0]) == NDARRAY_NUM_DTYPES,
+               "ndarray_dtype_swapped_formats must have the entries of all the dtypes");
+
+#undef SWAPPED
+#undef SWAPPED_FLOAT
+#undef SWAPPED_DOUBLE
+
+#define DTYPE_FORMAT(type) (ndarray_dtype_formats[type])
+#define DTYPE_SWAPPED_FORMAT(type) (ndarray_dtype_swapped_formats[type])
+
+#define NUM2COMPLEX64(num) num2complex64(num)
+#define NUM2COMPLEX128(num) num2complex128(num)
+#define NUM2BOOL(num) num2bool(num)
+
+static ndarray_complex128_t
+num2complex128(VALUE num)
+{
+  ndarray_complex128_t z;
+  if (RB_TYPE_P(num, T_COMPLEX)) {
+    z.re = NUM2DBL(rb_complex_real(num));
+    z.im = NUM2DBL(rb_complex_imag(num));
+  }
+  else {
+    z.re = NUM2DBL(num);
+    z.im = 0.0;
+  }
+  return z;
+}
+
+static ndarray_complex64_t
+num2complex64(VALUE num)
+{
+  const ndarray_complex128_t z = num2complex128(num);
+  if (z.re < -FLT_MAX || FLT_MAX < z.re || z.im < -FLT_MAX || FLT_MAX < z.im) {
+    rb_raise(rb_eRangeError, "complex %"PRIsVALUE" too big to convert to `complex64'", num);
+  }
+  ndarray_complex64_t w = { (float)z.re, (float)z.im };
+  return w;
+}
+
+static uint8_t
+num2bool(VALUE obj)
+{
+  if (obj == Qtrue) return 1;
+  if (obj == Qfalse) return 0;
+  rb_raise(rb_eTypeError, "no implicit conversion of %"PRIsVALUE" into bool", rb_obj_class(obj));
+}
+
+#define FLOAT162NUM(h) DBL2NUM(float16_to_float(h))
+#define BFLOAT162NUM(b) DBL2NUM(bfloat16_to_float(b))
+#define COMPLEX2NUM(z) rb_dbl_complex_new((z).re, (z).im)
+#define BOOL2NUM(b) ((b) ? Qtrue : Qfalse)
+
 static ndarray_dtype_t
 ndarray_id_to_dtype_t(ID id, VALUE orig)
 {
@@ -223,21 +549,69 @@ ndarray_obj_to_order_t(VALUE obj)
   return ndarray_sym_to_order_t(sym, obj);
 }
 
+typedef enum {
+  ndarray_storage_none,  /* data is borrowed from base */
+  ndarray_storage_heap,  /* data is in a block allocated by xmalloc */
+  ndarray_storage_mmap,  /* data is in an anonymous memory map */
+  ndarray_storage_file,  /* data is in a shared memory map of a file */
+} ndarray_storage_t;
+
+#define NDARRAY_DEFAULT_ALIGNMENT 64
+#define NDARRAY_MAX_ALIGNMENT (2 * 1024 * 1024)
+
+/* The buffers larger than this are backed by huge pages if possible */
+#define NDARRAY_HUGE_PAGE_THRESHOLD (4 * 1024 * 1024)
+#define NDARRAY_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* A field of the record dtype.  The value is the repeat items of dtype at
+ * offset in the record, which can be in the non-native byte order. */
+typedef struct {
+  ndarray_dtype_t dtype;
+  size_t offset;
+  size_t repeat;
+  bool swap_p;
+} ndarray_field_t;
+
 typedef struct {
   void *data;
   ssize_t byte_size;
 
+  /* the allocation that contains data */
+  ndarray_storage_t storage;
+  void *storage_ptr;
+  size_t storage_size;
+
   ndarray_dtype_t dtype;
+  ssize_t item_size;
+  /* the items are stored in the byte order opposite to the native one */
+  bool swapped_p;
   ssize_t ndim;
   ssize_t *shape;
   ssize_t *strides;
 
+  /* the item format and the fields of the record dtype */
+  VALUE format;
+  ndarray_field_t *fields;
+  ssize_t n_fields;
+
   VALUE base;
+
+  /* the number of MemoryViews exported from this array, or from its views */
+  ssize_t n_exports;
+
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  /* the MemoryView of base when data is borrowed from another exporter */
+  rb_memory_view_t *source_view;
+#endif
+
+  /* shape and strides are stored here when ndim <= MAX_INLINE_DIM */
+  ssize_t inline_dims[2 * MAX_INLINE_DIM];
 } ndarray_t;
 
 static void ndarray_mark(void *);
 static void ndarray_free(void *);
 static size_t ndarray_memsize(const void *);
+static VALUE ndarray_to_native(VALUE obj);
 
 static const rb_data_type_t ndarray_data_type = {
   "memory-view-test-helper/ndarray",
@@ -255,15 +629,50 @@ ndarray_mark(void *ptr)
   ndarray_t *nar = (ndarray_t *)ptr;
   if (nar->base)
     rb_gc_mark(nar->base);
+  if (nar->format)
+    rb_gc_mark(nar->format);
+}
+
+static void
+ndarray_free_storage(ndarray_t *nar)
+{
+  switch (nar->storage) {
+    case ndarray_storage_heap:
+      xfree(nar->storage_ptr);
+      break;
+
+#ifdef NDARRAY_USE_MMAP
+    case ndarray_storage_mmap:
+      munmap(nar->storage_ptr, nar->storage_size);
+      rb_gc_adjust_memory_usage(-(ssize_t)nar->storage_size);
+      break;
+
+    case ndarray_storage_file:
+      munmap(nar->storage_ptr, nar->storage_size);
+      break;
+#endif
+
+    default:
+      break;
+  }
+  nar->storage = ndarray_storage_none;
+  nar->storage_ptr = NULL;
+  nar->storage_size = 0;
 }
 
 static void
 ndarray_free(void *ptr)
 {
   ndarray_t *nar = (ndarray_t *)ptr;
-  if (!nar->base && nar->data) xfree(nar->data);
-  if (nar->shape) xfree(nar->shape);
-  if (nar->strides) xfree(nar->strides);
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  if (nar->source_view) {
+    rb_memory_view_release(nar->source_view);
+    xfree(nar->source_view);
+  }
+#endif
+  ndarray_free_storage(nar);
+  if (nar->shape && nar->shape != nar->inline_dims) xfree(nar->shape);
+  xfree(nar->fields);
   xfree(nar);
 }
 
@@ -272,9 +681,13 @@ ndarray_memsize(const void *ptr)
 {
   ndarray_t *nar = (ndarray_t *)ptr;
   size_t size = sizeof(ndarray_t);
-  if (nar->data) size += nar->byte_size;
-  if (nar->shape) size += sizeof(ssize_t) * nar->ndim;
-  if (nar->strides) size += sizeof(ssize_t) * nar->ndim;
+  /* The pages of a file map belong to the page cache and can be shared
+   * by other processes, so they are not counted as the memory of nar. */
+  if (nar->storage == ndarray_storage_heap || nar->storage == ndarray_storage_mmap) {
+    size += nar->storage_size;
+  }
+  if (nar->shape && nar->shape != nar->inline_dims) size += 2 * sizeof(ssize_t) * nar->ndim;
+  size += sizeof(ndarray_field_t) * nar->n_fields;
   return size;
 }
 
@@ -285,575 +698,6750 @@ ndarray_s_allocate(VALUE klass)
   VALUE obj = TypedData_Make_Struct(klass, ndarray_t, &ndarray_data_type, nar);
   nar->data = NULL;
   nar->byte_size = 0;
+  nar->storage = ndarray_storage_none;
+  nar->storage_ptr = NULL;
+  nar->storage_size = 0;
   nar->dtype = ndarray_dtype_none;
+  nar->item_size = 0;
+  nar->swapped_p = false;
   nar->ndim = 0;
   nar->shape = NULL;
   nar->strides = NULL;
+  nar->format = Qfalse;
+  nar->fields = NULL;
+  nar->n_fields = 0;
   nar->base = Qfalse;
+  nar->n_exports = 0;
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  nar->source_view = NULL;
+#endif
   return obj;
 }
 
+/* Allocate the buffers for shape and strides.  They are in the inline
+ * buffer of ndarray_t for ndim <= MAX_INLINE_DIM, or in a single heap
+ * block otherwise. */
 static void
-ndarray_init_row_major_strides(const ndarray_dtype_t dtype, const ssize_t ndim,
-                               const ssize_t *shape, ssize_t *out_strides)
+ndarray_alloc_dims(ndarray_t *nar, const ssize_t ndim)
 {
-  const ssize_t item_size = SIZEOF_DTYPE(dtype);
-  out_strides[ndim - 1] = item_size;
+  assert(nar->shape == NULL);
 
-  int i;
-  for (i = ndim - 1; i > 0; --i) {
-    out_strides[i - 1] = out_strides[i] * shape[i];
+  if (ndim <= MAX_INLINE_DIM) {
+    nar->shape = nar->inline_dims;
+    nar->strides = nar->inline_dims + MAX_INLINE_DIM;
+  }
+  else {
+    nar->shape = ALLOC_N(ssize_t, 2 * ndim);
+    nar->strides = nar->shape + ndim;
   }
+  nar->ndim = ndim;
 }
 
-static void
-ndarray_init_column_major_strides(const ndarray_dtype_t dtype, const ssize_t ndim,
-                                  const ssize_t *shape, ssize_t *out_strides)
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+/* The dtype of the item of the given pack-template character and size */
+static ndarray_dtype_t
+ndarray_dtype_of_format_char(const char format, const size_t size)
 {
-  const ssize_t item_size = SIZEOF_DTYPE(dtype);
-  out_strides[0] = item_size;
-
   int i;
-  for (i = 0; i < ndim - 1; ++i) {
-    out_strides[i + 1] = out_strides[i] * shape[i];
+  switch (format) {
+    case 'c': case 's': case 'i': case 'l': case 'q': case 'j':
+      for (i = ndarray_dtype_int8; i <= ndarray_dtype_int64; i += 2) {
+        if ((size_t)SIZEOF_DTYPE(i) == size) return (ndarray_dtype_t)i;
+      }
+      break;
+
+    case 'C': case 'S': case 'I': case 'L': case 'Q': case 'J':
+    case 'n': case 'N': case 'v': case 'V':
+      for (i = ndarray_dtype_uint8; i <= ndarray_dtype_uint64; i += 2) {
+        if ((size_t)SIZEOF_DTYPE(i) == size) return (ndarray_dtype_t)i;
+      }
+      break;
+
+    case 'f': case 'e': case 'g':
+    case 'd': case 'E': case 'G':
+      if (size == sizeof(float)) return ndarray_dtype_float32;
+      if (size == sizeof(double)) return ndarray_dtype_float64;
+      break;
+
+    default:
+      break;
   }
+  return ndarray_dtype_none;
 }
 
-static VALUE
-ndarray_initialize(VALUE obj, VALUE shape_ary, VALUE dtype_name, VALUE order_name)
+static inline bool
+ndarray_component_swap_p(const rb_memory_view_item_component_t *member)
 {
-  int i;
-
-  Check_Type(shape_ary, T_ARRAY);
+#ifdef WORDS_BIGENDIAN
+  return member->little_endian_p;
+#else
+  return !member->little_endian_p;
+#endif
+}
+#endif
 
-  const ssize_t ndim = (ssize_t)RARRAY_LEN(shape_ary);
-  for (i = 0; i < ndim; ++i) {
-    VALUE si = RARRAY_AREF(shape_ary, i);
-    Check_Type(si, T_FIXNUM);
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+/* Returns the frozen copy of the item format without white spaces, that
+ * rb_memory_view_parse_item_format miscounts the members by. */
+static VALUE
+ndarray_normalize_format(const char *format)
+{
+  VALUE str = rb_str_buf_new(strlen(format));
+  const char *p;
+  for (p = format; *p; ++p) {
+    if (!ISSPACE(*p)) {
+      rb_str_buf_cat(str, p, 1);
+    }
   }
+  return rb_str_new_frozen(str);
+}
+#endif
 
-  ssize_t *shape = ALLOC_N(ssize_t, ndim);
-  for (i = 0; i < ndim; ++i) {
-    VALUE si = RARRAY_AREF(shape_ary, i);
-    shape[i] = NUM2SSIZET(si);
+/* Set the dtype and the item size to nar.  The record dtype needs the item
+ * format in pack-template notation, which is parsed into the fields. */
+static void
+ndarray_set_dtype(ndarray_t *nar, const ndarray_dtype_t dtype, VALUE format)
+{
+  if (dtype != ndarray_dtype_record) {
+    if (!NIL_P(format)) {
+      rb_raise(rb_eArgError, "format is given for the non-record dtype");
+    }
+    nar->dtype = dtype;
+    nar->item_size = SIZEOF_DTYPE(dtype);
+    nar->swapped_p = false;
+    return;
   }
 
-  ndarray_dtype_t dtype = ndarray_obj_to_dtype_t(dtype_name);
-  ndarray_order_t order = ndarray_obj_to_order_t(order_name);
-
-  ssize_t *strides = ALLOC_N(ssize_t, ndim);
-  ssize_t byte_size;
-  switch (order) {
-    case ndarray_order_auto:
-    case ndarray_order_row_major:
-      ndarray_init_row_major_strides(dtype, ndim, shape, strides);
-      byte_size = strides[0] * shape[0];
-      break;
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  if (NIL_P(format)) {
+    rb_raise(rb_eArgError, "the record dtype needs the item format");
+  }
+  format = ndarray_normalize_format(StringValueCStr(format));
+
+  const char *err = NULL;
+  rb_memory_view_item_component_t *members = NULL;
+  size_t n_members = 0;
+  const ssize_t item_size = rb_memory_view_parse_item_format(StringValueCStr(format), &members, &n_members, &err);
+  if (item_size <= 0) {
+    xfree(members);
+    rb_raise(rb_eArgError, "unable to parse the item format (%"PRIsVALUE")", format);
+  }
 
-    default:
-      ndarray_init_column_major_strides(dtype, ndim, shape, strides);
-      byte_size = strides[ndim-1] * shape[ndim-1];
-      break;
+  size_t i;
+  for (i = 0; i < n_members; ++i) {
+    if (ndarray_dtype_of_format_char(members[i].format, members[i].size) == ndarray_dtype_none) {
+      xfree(members);
+      rb_raise(rb_eArgError, "unsupported item format (%"PRIsVALUE")", format);
+    }
   }
 
-  ndarray_t *nar;
-  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+  ndarray_field_t *fields = ALLOC_N(ndarray_field_t, n_members);
+  for (i = 0; i < n_members; ++i) {
+    fields[i].dtype = ndarray_dtype_of_format_char(members[i].format, members[i].size);
+    fields[i].offset = members[i].offset;
+    fields[i].repeat = members[i].repeat;
+    fields[i].swap_p = ndarray_component_swap_p(&members[i]);
+  }
+  xfree(members);
 
-  nar->data = ALLOC_N(uint8_t, byte_size);
-  nar->byte_size = byte_size;
   nar->dtype = dtype;
-  nar->ndim = ndim;
-  nar->shape = shape;
-  nar->strides = strides;
-
-  return Qnil;
+  nar->item_size = item_size;
+  nar->swapped_p = false;
+  nar->format = format;
+  nar->fields = fields;
+  nar->n_fields = (ssize_t)n_members;
+#else
+  rb_raise(rb_eNotImpError, "the record dtype needs MemoryView");
+#endif
 }
 
-static VALUE
-ndarray_get_byte_size(VALUE obj)
+static void
+ndarray_copy_dtype(ndarray_t *nar, const ndarray_t *src)
 {
-  ndarray_t *nar;
-  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
-
-  return SSIZET2NUM(nar->byte_size);
+  nar->dtype = src->dtype;
+  nar->item_size = src->item_size;
+  nar->swapped_p = src->swapped_p;
+  if (src->fields) {
+    nar->format = src->format;
+    nar->fields = ALLOC_N(ndarray_field_t, src->n_fields);
+    MEMCPY(nar->fields, src->fields, ndarray_field_t, src->n_fields);
+    nar->n_fields = src->n_fields;
+  }
 }
 
-static VALUE
-ndarray_get_dtype(VALUE obj)
+/* Raise TypeError for the operation that needs numeric items */
+static void
+ndarray_check_not_record(const ndarray_t *nar, const char *name)
 {
-  ndarray_t *nar;
-  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
-
-  if (ndarray_dtype_none < nar->dtype && nar->dtype < NDARRAY_NUM_DTYPES) {
-    return ID2SYM(DTYPE_ID(nar->dtype));
+  if (nar->dtype == ndarray_dtype_record) {
+    rb_raise(rb_eTypeError, "%s is not supported for record arrays", name);
   }
-  return Qnil;
 }
 
-static VALUE
-ndarray_get_ndim(VALUE obj)
+/* Set the byte order of the items to nar by :little, :big, :native, or
+ * nil for native.  :swap, that reverses the current byte order, is
+ * accepted if swap_p is true.  The items of one byte, and the records
+ * whose fields have their own byte orders, are always native. */
+static void
+ndarray_set_byte_order(ndarray_t *nar, VALUE byte_order, const bool swap_p)
 {
-  ndarray_t *nar;
-  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+  bool swapped_p = false;
+  if (!NIL_P(byte_order)) {
+    const VALUE sym = param_to_symbol(byte_order, "byte_order");
+#ifdef WORDS_BIGENDIAN
+    const VALUE sym_opposite = sym_little;
+#else
+    const VALUE sym_opposite = sym_big;
+#endif
+    if (sym == sym_opposite) {
+      swapped_p = true;
+    }
+    else if (sym == sym_swap && swap_p) {
+      swapped_p = !nar->swapped_p;
+    }
+    else if (sym != sym_little && sym != sym_big && sym != sym_native) {
+      rb_raise(rb_eArgError, "invalid byte order (%+"PRIsVALUE")", byte_order);
+    }
+  }
 
-  return SSIZET2NUM(nar->ndim);
+  if (nar->dtype == ndarray_dtype_record) {
+    if (swapped_p) {
+      rb_raise(rb_eArgError, "the byte order of a record is given by its item format");
+    }
+    return;
+  }
+  nar->swapped_p = swapped_p && nar->item_size > 1;
 }
 
-static VALUE
-ndarray_get_shape(VALUE obj)
+static size_t
+ndarray_check_alignment(VALUE alignment_v)
 {
-  ndarray_t *nar;
-  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
-
-  VALUE ary = rb_ary_new_capa(nar->ndim);
-  int i;
-  for (i = 0; i < nar->ndim; ++i) {
-    rb_ary_push(ary, SSIZET2NUM(nar->shape[i]));
+  if (NIL_P(alignment_v)) {
+    return NDARRAY_DEFAULT_ALIGNMENT;
   }
 
-  return ary;
+  const long alignment = NUM2LONG(alignment_v);
+  if (alignment <= 0 || NDARRAY_MAX_ALIGNMENT < alignment || (alignment & (alignment - 1)) != 0) {
+    rb_raise(rb_eArgError, "alignment must be a power of 2 up to %d (%ld given)",
+             NDARRAY_MAX_ALIGNMENT, alignment);
+  }
+  return (size_t)alignment;
 }
 
-static VALUE
-ndarray_get_strides(VALUE obj)
+/* Allocate the buffer of byte_size bytes aligned at the given alignment.
+ * Large buffers are mapped by mmap and advised to use huge pages. */
+static void
+ndarray_alloc_data(ndarray_t *nar, const ssize_t byte_size, const size_t alignment)
 {
-  ndarray_t *nar;
-  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
-
-  if (nar->strides == NULL) {
-    return rb_ary_new_capa(0);
+  assert(nar->storage == ndarray_storage_none);
+  assert((alignment & (alignment - 1)) == 0);
+
+#if defined(NDARRAY_USE_MMAP) && defined(MAP_ANONYMOUS) && defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+  if (byte_size >= NDARRAY_HUGE_PAGE_THRESHOLD) {
+    /* mapping extra space to align data at the huge page boundary */
+    const size_t map_size = byte_size + NDARRAY_HUGE_PAGE_SIZE;
+    void *ptr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr != MAP_FAILED) {
+      uint8_t *data = (uint8_t *)(((uintptr_t)ptr + NDARRAY_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(NDARRAY_HUGE_PAGE_SIZE - 1));
+      madvise(data, byte_size, MADV_HUGEPAGE);
+      rb_gc_adjust_memory_usage((ssize_t)map_size);
+
+      nar->storage = ndarray_storage_mmap;
+      nar->storage_ptr = ptr;
+      nar->storage_size = map_size;
+      nar->data = data;
+      nar->byte_size = byte_size;
+      return;
+    }
   }
+#endif
 
-  VALUE ary = rb_ary_new_capa(nar->ndim);
-  int i;
-  for (i = 0; i < nar->ndim; ++i) {
-    rb_ary_push(ary, SSIZET2NUM(nar->strides[i]));
-  }
+  const size_t size = byte_size + alignment - 1;
+  void *ptr = xmalloc(size > 0 ? size : 1);
 
-  return ary;
+  nar->storage = ndarray_storage_heap;
+  nar->storage_ptr = ptr;
+  nar->storage_size = size;
+  nar->data = (void *)(((uintptr_t)ptr + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  nar->byte_size = byte_size;
 }
 
-static VALUE
-ndarray_get_value(const uint8_t *value_ptr, const ndarray_dtype_t dtype)
+static void
+ndarray_init_row_major_strides(const ssize_t item_size, const ssize_t ndim,
+                               const ssize_t *shape, ssize_t *out_strides)
 {
-  assert(value_ptr != NULL);
-  switch (dtype) {
+  if (ndim == 0) return;
+  out_strides[ndim - 1] = item_size;
+
+  int i;
+  for (i = ndim - 1; i > 0; --i) {
+    out_strides[i - 1] = out_strides[i] * shape[i];
+  }
+}
+
+static void
+ndarray_init_column_major_strides(const ssize_t item_size, const ssize_t ndim,
+                                  const ssize_t *shape, ssize_t *out_strides)
+{
+  if (ndim == 0) return;
+  out_strides[0] = item_size;
+
+  int i;
+  for (i = 0; i < ndim - 1; ++i) {
+    out_strides[i + 1] = out_strides[i] * shape[i];
+  }
+}
+
+static int
+ndarray_is_row_major_contiguous(const ndarray_t *nar)
+{
+  ssize_t expected_stride = nar->item_size;
+  ssize_t i;
+  for (i = nar->ndim - 1; i >= 0; --i) {
+    if (nar->shape[i] != 1 && nar->strides[i] != expected_stride)
+      return 0;
+    expected_stride *= nar->shape[i];
+  }
+  return 1;
+}
+
+static int
+ndarray_is_column_major_contiguous(const ndarray_t *nar)
+{
+  ssize_t expected_stride = nar->item_size;
+  ssize_t i;
+  for (i = 0; i < nar->ndim; ++i) {
+    if (nar->shape[i] != 1 && nar->strides[i] != expected_stride)
+      return 0;
+    expected_stride *= nar->shape[i];
+  }
+  return 1;
+}
+
+static ssize_t
+ndarray_n_items(const ndarray_t *nar)
+{
+  ssize_t n_items = 1;
+  ssize_t i;
+  for (i = 0; i < nar->ndim; ++i) {
+    n_items *= nar->shape[i];
+  }
+  return n_items;
+}
+
+/* Strided iterator
+ *
+ * ndarray_iter_t iterates over the items of the arrays that have the same
+ * shape.  The dimensions that can be traversed with a single stride are
+ * coalesced, and the innermost dimension is handed to a kernel function as
+ * a 1-D loop of (pointer, stride, count) for each operand.  The kernel
+ * returns non-zero to stop the iteration. */
+
+#define NDARRAY_ITER_MAX_OPERANDS 4
+
+enum {
+  /* keep the logical row-major order of the items */
+  NDARRAY_ITER_KEEP_ORDER = (1<<0),
+};
+
+typedef int (*ndarray_iter_kernel_t)(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg);
+
+typedef struct {
+  int n_operands;
+  uint8_t *data[NDARRAY_ITER_MAX_OPERANDS];
+
+  /* the dimensions after coalescing */
+  ssize_t ndim;
+  ssize_t *shape;
+  ssize_t *strides[NDARRAY_ITER_MAX_OPERANDS];
+
+  /* the number of the innermost loops */
+  ssize_t n_rows;
+
+  /* the workspace for the outer indices */
+  ssize_t *indices;
+
+  ssize_t inline_buf[(NDARRAY_ITER_MAX_OPERANDS + 2) * MAX_INLINE_DIM];
+  VALUE heap_buf;
+} ndarray_iter_t;
+
+static void
+ndarray_iter_init(ndarray_iter_t *it, const int n_operands, uint8_t *const *data,
+                  const ssize_t *const *strides, const ssize_t ndim, const ssize_t *shape,
+                  const int flags)
+{
+  assert(0 < n_operands && n_operands <= NDARRAY_ITER_MAX_OPERANDS);
+
+  int k;
+  ssize_t i, j;
+
+  it->n_operands = n_operands;
+  it->heap_buf = 0;
+
+  ssize_t *buf = it->inline_buf;
+  if (ndim > MAX_INLINE_DIM) {
+    buf = RB_ALLOCV_N(ssize_t, it->heap_buf, (NDARRAY_ITER_MAX_OPERANDS + 2) * ndim);
+  }
+  const ssize_t buf_dim = ndim > MAX_INLINE_DIM ? ndim : MAX_INLINE_DIM;
+  it->shape = buf;
+  it->indices = buf + buf_dim;
+  for (k = 0; k < n_operands; ++k) {
+    it->data[k] = data[k];
+    it->strides[k] = buf + (k + 2) * buf_dim;
+  }
+
+  /* drop the dimensions of size 1 */
+  ssize_t n = 0;
+  for (i = 0; i < ndim; ++i) {
+    if (shape[i] == 0) {
+      it->ndim = 1;
+      it->shape[0] = 0;
+      for (k = 0; k < n_operands; ++k) it->strides[k][0] = 0;
+      it->n_rows = 0;
+      return;
+    }
+    if (shape[i] == 1)
+      continue;
+    it->shape[n] = shape[i];
+    for (k = 0; k < n_operands; ++k) it->strides[k][n] = strides[k][i];
+    ++n;
+  }
+
+  if (n == 0) {
+    it->ndim = 1;
+    it->shape[0] = 1;
+    for (k = 0; k < n_operands; ++k) it->strides[k][0] = 0;
+    it->n_rows = 1;
+    return;
+  }
+
+  if (!(flags & NDARRAY_ITER_KEEP_ORDER)) {
+    /* stable insertion sort to make the strides of the first operand
+     * descending in absolute value, that is the order of the memory */
+    for (i = 1; i < n; ++i) {
+      for (j = i; j > 0; --j) {
+        const ssize_t s0 = it->strides[0][j - 1], s1 = it->strides[0][j];
+        if ((s0 < 0 ? -s0 : s0) >= (s1 < 0 ? -s1 : s1))
+          break;
+        ssize_t t = it->shape[j]; it->shape[j] = it->shape[j - 1]; it->shape[j - 1] = t;
+        for (k = 0; k < n_operands; ++k) {
+          t = it->strides[k][j]; it->strides[k][j] = it->strides[k][j - 1]; it->strides[k][j - 1] = t;
+        }
+      }
+    }
+  }
+
+  /* coalesce the adjacent dimensions */
+  ssize_t m = 0;
+  for (i = 1; i < n; ++i) {
+    int coalescable = 1;
+    for (k = 0; k < n_operands; ++k) {
+      if (it->strides[k][m] != it->strides[k][i] * it->shape[i]) {
+        coalescable = 0;
+        break;
+      }
+    }
+    if (coalescable) {
+      it->shape[m] *= it->shape[i];
+      for (k = 0; k < n_operands; ++k) it->strides[k][m] = it->strides[k][i];
+    }
+    else {
+      ++m;
+      it->shape[m] = it->shape[i];
+      for (k = 0; k < n_operands; ++k) it->strides[k][m] = it->strides[k][i];
+    }
+  }
+  it->ndim = m + 1;
+
+  it->n_rows = 1;
+  for (i = 0; i < it->ndim - 1; ++i) {
+    it->n_rows *= it->shape[i];
+  }
+}
+
+static void
+ndarray_iter_release(ndarray_iter_t *it)
+{
+  RB_ALLOCV_END(it->heap_buf);
+}
+
+static inline ssize_t
+ndarray_iter_inner_size(const ndarray_iter_t *it)
+{
+  return it->shape[it->ndim - 1];
+}
+
+/* Run the kernel for the items in [item_begin, item_end) in the order of
+ * the iteration.  The first and the last rows can be partial.  This doesn't
+ * touch any Ruby object, so it can be called without GVL. */
+static int
+ndarray_iter_run_range(const ndarray_iter_t *it, const ssize_t item_begin, const ssize_t item_end,
+                       ssize_t *indices, ndarray_iter_kernel_t kernel, void *arg)
+{
+  const int n_operands = it->n_operands;
+  const ssize_t last = it->ndim - 1;
+  const ssize_t n = it->shape[last];
+
+  uint8_t *ptrs[NDARRAY_ITER_MAX_OPERANDS];
+  ssize_t inner_strides[NDARRAY_ITER_MAX_OPERANDS];
+  int k;
+  ssize_t i;
+
+  if (item_begin >= item_end)
+    return 0;
+
+  for (k = 0; k < n_operands; ++k) {
+    ptrs[k] = it->data[k];
+    inner_strides[k] = it->strides[k][last];
+  }
+
+  /* the initial position */
+  ssize_t r = item_begin / n;
+  ssize_t col = item_begin % n;
+  for (i = last - 1; i >= 0; --i) {
+    indices[i] = r % it->shape[i];
+    r /= it->shape[i];
+    for (k = 0; k < n_operands; ++k) {
+      ptrs[k] += indices[i] * it->strides[k][i];
+    }
+  }
+  for (k = 0; k < n_operands; ++k) {
+    ptrs[k] += col * inner_strides[k];
+  }
+
+  ssize_t remaining = item_end - item_begin;
+  while (1) {
+    const ssize_t len = n - col < remaining ? n - col : remaining;
+    int stop = kernel(ptrs, inner_strides, len, arg);
+    if (stop)
+      return stop;
+
+    remaining -= len;
+    if (remaining == 0)
+      break;
+
+    /* move to the head of the next row */
+    if (col > 0) {
+      for (k = 0; k < n_operands; ++k) ptrs[k] -= col * inner_strides[k];
+      col = 0;
+    }
+    for (i = last - 1; i >= 0; --i) {
+      if (++indices[i] < it->shape[i]) {
+        for (k = 0; k < n_operands; ++k) ptrs[k] += it->strides[k][i];
+        break;
+      }
+      indices[i] = 0;
+      for (k = 0; k < n_operands; ++k) ptrs[k] -= (it->shape[i] - 1) * it->strides[k][i];
+    }
+  }
+
+  return 0;
+}
+
+static int
+ndarray_iter_run(const ndarray_iter_t *it, ndarray_iter_kernel_t kernel, void *arg)
+{
+  return ndarray_iter_run_range(it, 0, it->n_rows * ndarray_iter_inner_size(it), it->indices, kernel, arg);
+}
+
+/* Parallel execution
+ *
+ * ndarray_iter_run_parallel runs the kernel without GVL when the iteration
+ * has at least ndarray_parallel_threshold items.  The items are split into
+ * ndarray_num_threads ranges of the iteration order, and each range is run
+ * by a worker thread.  The kernels given to this must not touch any Ruby
+ * object, and must not depend on the order of the calls. */
+
+#define NDARRAY_MAX_THREADS 64
+#define NDARRAY_DEFAULT_PARALLEL_THRESHOLD (1 << 16)
+
+static int ndarray_num_threads = 1;
+static ssize_t ndarray_parallel_threshold = NDARRAY_DEFAULT_PARALLEL_THRESHOLD;
+
+typedef struct {
+  const ndarray_iter_t *it;
+  ssize_t item_begin;
+  ssize_t item_end;
+  ssize_t *indices;
+  ndarray_iter_kernel_t kernel;
+  void *arg;
+  int stop;
+} ndarray_iter_task_t;
+
+typedef struct {
+  int n_tasks;
+  ndarray_iter_task_t *tasks;
+} ndarray_iter_job_t;
+
+static void *
+ndarray_iter_task_run(void *ptr)
+{
+  ndarray_iter_task_t *task = ptr;
+  task->stop = ndarray_iter_run_range(task->it, task->item_begin, task->item_end,
+                                      task->indices, task->kernel, task->arg);
+  return NULL;
+}
+
+static void *
+ndarray_iter_job_run_without_gvl(void *ptr)
+{
+  ndarray_iter_job_t *job = ptr;
+  int t;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_t threads[NDARRAY_MAX_THREADS];
+  int started[NDARRAY_MAX_THREADS];
+
+  for (t = 1; t < job->n_tasks; ++t) {
+    started[t] = pthread_create(&threads[t], NULL, ndarray_iter_task_run, &job->tasks[t]) == 0;
+  }
+  ndarray_iter_task_run(&job->tasks[0]);
+  for (t = 1; t < job->n_tasks; ++t) {
+    if (started[t])
+      pthread_join(threads[t], NULL);
+    else
+      ndarray_iter_task_run(&job->tasks[t]);  /* run here if no thread is available */
+  }
+#else
+  for (t = 0; t < job->n_tasks; ++t) {
+    ndarray_iter_task_run(&job->tasks[t]);
+  }
+#endif
+
+  return NULL;
+}
+
+/* The argument of the t-th worker is at args + t * arg_size.  When
+ * arg_size is not 0, the first argument is copied to the others, and the
+ * number of the workers used is stored to n_tasks_out. */
+static int
+ndarray_iter_run_parallel_impl(const ndarray_iter_t *it, ndarray_iter_kernel_t kernel,
+                               void *args, const size_t arg_size, int *n_tasks_out)
+{
+  const ssize_t n_items = it->n_rows * ndarray_iter_inner_size(it);
+  if (n_items == 0 || n_items < ndarray_parallel_threshold) {
+    if (n_tasks_out) *n_tasks_out = 1;
+    return ndarray_iter_run(it, kernel, args);
+  }
+
+  int n_tasks = ndarray_num_threads;
+  if (n_tasks > n_items) n_tasks = (int)n_items;
+
+  VALUE tasks_buf = 0, indices_buf = 0;
+  ndarray_iter_task_t *tasks = RB_ALLOCV_N(ndarray_iter_task_t, tasks_buf, n_tasks);
+  ssize_t *indices = RB_ALLOCV_N(ssize_t, indices_buf, n_tasks * it->ndim);
+
+  const ssize_t chunk = n_items / n_tasks, rem = n_items % n_tasks;
+  ssize_t begin = 0;
+  int t;
+  for (t = 0; t < n_tasks; ++t) {
+    tasks[t].it = it;
+    tasks[t].item_begin = begin;
+    begin += chunk + (t < rem ? 1 : 0);
+    tasks[t].item_end = begin;
+    tasks[t].indices = indices + t * it->ndim;
+    tasks[t].kernel = kernel;
+    tasks[t].arg = (uint8_t *)args + t * arg_size;
+    tasks[t].stop = 0;
+    if (t > 0 && arg_size > 0) {
+      memcpy(tasks[t].arg, args, arg_size);
+    }
+  }
+
+  ndarray_iter_job_t job = { n_tasks, tasks };
+  rb_thread_call_without_gvl(ndarray_iter_job_run_without_gvl, &job, NULL, NULL);
+
+  int stop = 0;
+  for (t = 0; t < n_tasks; ++t) {
+    if (tasks[t].stop) {
+      stop = tasks[t].stop;
+      break;
+    }
+  }
+
+  RB_ALLOCV_END(indices_buf);
+  RB_ALLOCV_END(tasks_buf);
+
+  if (n_tasks_out) *n_tasks_out = n_tasks;
+  return stop;
+}
+
+static int
+ndarray_iter_run_parallel(const ndarray_iter_t *it, ndarray_iter_kernel_t kernel, void *arg)
+{
+  return ndarray_iter_run_parallel_impl(it, kernel, arg, 0, NULL);
+}
+
+/* Run the kernel in parallel with the private argument of each worker.
+ * args must have the room for NDARRAY_MAX_THREADS arguments, and the first
+ * one must be initialized.  The workers take the ranges of the items in
+ * the order of their arguments.  Returns the number of the workers. */
+static int
+ndarray_iter_run_parallel_private(const ndarray_iter_t *it, ndarray_iter_kernel_t kernel,
+                                  void *args, const size_t arg_size)
+{
+  int n_tasks;
+  ndarray_iter_run_parallel_impl(it, kernel, args, arg_size, &n_tasks);
+  return n_tasks;
+}
+
+static VALUE
+ndarray_s_get_num_threads(VALUE klass)
+{
+  return INT2NUM(ndarray_num_threads);
+}
+
+static VALUE
+ndarray_s_set_num_threads(VALUE klass, VALUE num_threads_v)
+{
+  const int num_threads = NUM2INT(num_threads_v);
+  if (num_threads < 1 || NDARRAY_MAX_THREADS < num_threads) {
+    rb_raise(rb_eArgError, "num_threads must be in 1..%d (%d given)", NDARRAY_MAX_THREADS, num_threads);
+  }
+  ndarray_num_threads = num_threads;
+  return num_threads_v;
+}
+
+static VALUE
+ndarray_s_get_parallel_threshold(VALUE klass)
+{
+  return SSIZET2NUM(ndarray_parallel_threshold);
+}
+
+static VALUE
+ndarray_s_set_parallel_threshold(VALUE klass, VALUE threshold_v)
+{
+  const ssize_t threshold = NUM2SSIZET(threshold_v);
+  if (threshold < 0) {
+    rb_raise(rb_eArgError, "negative parallel_threshold (%"PRIdSIZE")", threshold);
+  }
+  ndarray_parallel_threshold = threshold;
+  return threshold_v;
+}
+
+/* Copying items */
+
+static int
+ndarray_copy_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ssize_t item_size = *(const ssize_t *)arg;
+  uint8_t *dst = ptrs[0];
+  const uint8_t *src = ptrs[1];
+  const ssize_t dst_stride = strides[0], src_stride = strides[1];
+  ssize_t i;
+
+  if (dst_stride == item_size && src_stride == item_size) {
+    memcpy(dst, src, n * item_size);
+    return 0;
+  }
+
+#define STRIDED_COPY(type) \
+  for (i = 0; i < n; ++i, dst += dst_stride, src += src_stride) *(type *)dst = *(const type *)src
+
+  switch (item_size) {
+    case 1: STRIDED_COPY(uint8_t); break;
+    case 2: STRIDED_COPY(uint16_t); break;
+    case 4: STRIDED_COPY(uint32_t); break;
+    case 8: STRIDED_COPY(uint64_t); break;
+    default:
+      for (i = 0; i < n; ++i, dst += dst_stride, src += src_stride) memcpy(dst, src, item_size);
+      break;
+  }
+
+#undef STRIDED_COPY
+
+  return 0;
+}
+
+/* Tiled copy
+ *
+ * When the innermost dimension of the destination is not the innermost
+ * one of the source, as in transposing, a row-by-row copy reads the source
+ * with a large stride and touches a cache line for each item.  Such a copy
+ * is done by square tiles over the last two dimensions instead, so that
+ * the cache lines of both sides are reused within a tile.  The iteration
+ * runs over the rows of tiles, where the kernel copies the tiles of the
+ * columns given, and the rows left over the tiles are copied row by row. */
+
+#define NDARRAY_COPY_TILE_BYTES 256
+#define NDARRAY_COPY_MIN_TILE 16
+#define NDARRAY_COPY_MAX_TILE 64
+
+typedef struct {
+  ssize_t item_size;
+  /* the number of the rows and the columns of a tile */
+  ssize_t tile;
+  /* the strides of the rows of the destination and the source */
+  ssize_t dst_row_stride;
+  ssize_t src_row_stride;
+} ndarray_tiled_copy_arg_t;
+
+/* ptrs[0] and ptrs[1] are at the head of a row of tiles in the
+ * destination and the source, and n is the number of the columns */
+static int
+ndarray_tiled_copy_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_tiled_copy_arg_t *tiled_arg = arg;
+  const ssize_t item_size = tiled_arg->item_size, tile = tiled_arg->tile;
+  const ssize_t dst_row_stride = tiled_arg->dst_row_stride, src_row_stride = tiled_arg->src_row_stride;
+  const ssize_t dst_stride = strides[0], src_stride = strides[1];
+  ssize_t i, j, j0;
+
+#define TILED_COPY(copy_item) \
+  for (j0 = 0; j0 < n; j0 += tile) { \
+    const ssize_t jn = n - j0 < tile ? n - j0 : tile; \
+    for (i = 0; i < tile; ++i) { \
+      uint8_t *d = ptrs[0] + i * dst_row_stride + j0 * dst_stride; \
+      const uint8_t *s = ptrs[1] + i * src_row_stride + j0 * src_stride; \
+      for (j = 0; j < jn; ++j, d += dst_stride, s += src_stride) copy_item; \
+    } \
+  }
+
+  switch (item_size) {
+    case 1: TILED_COPY(*(uint8_t *)d = *(const uint8_t *)s); break;
+    case 2: TILED_COPY(*(uint16_t *)d = *(const uint16_t *)s); break;
+    case 4: TILED_COPY(*(uint32_t *)d = *(const uint32_t *)s); break;
+    case 8: TILED_COPY(*(uint64_t *)d = *(const uint64_t *)s); break;
+    default: TILED_COPY(memcpy(d, s, item_size)); break;
+  }
+
+#undef TILED_COPY
+
+  return 0;
+}
+
+/* Copy the items of the coalesced iteration it by tiles if the source is
+ * traversed against its layout.  Returns false if it is not the case. */
+static bool
+ndarray_tiled_copy(const ndarray_iter_t *it, const ssize_t item_size)
+{
+  if (it->ndim < 2)
+    return false;
+
+  const ssize_t a = it->ndim - 2, b = it->ndim - 1;
+  const ssize_t src_row_stride = it->strides[1][a], src_stride = it->strides[1][b];
+  if ((src_stride < 0 ? -src_stride : src_stride) <= (src_row_stride < 0 ? -src_row_stride : src_row_stride))
+    return false;
+
+  ssize_t tile = NDARRAY_COPY_TILE_BYTES / item_size;
+  if (tile < NDARRAY_COPY_MIN_TILE) tile = NDARRAY_COPY_MIN_TILE;
+  if (tile > NDARRAY_COPY_MAX_TILE) tile = NDARRAY_COPY_MAX_TILE;
+  if (it->shape[a] < tile || it->shape[b] < tile)
+    return false;
+
+  const ssize_t ndim = it->ndim;
+  VALUE heap_buf = 0;
+  ssize_t *buf = RB_ALLOCV_N(ssize_t, heap_buf, 3 * ndim);
+  ssize_t *shape = buf, *dst_strides = buf + ndim, *src_strides = buf + 2 * ndim;
+  MEMCPY(shape, it->shape, ssize_t, ndim);
+  MEMCPY(dst_strides, it->strides[0], ssize_t, ndim);
+  MEMCPY(src_strides, it->strides[1], ssize_t, ndim);
+
+  /* the rows of tiles */
+  const ssize_t n_tile_rows = it->shape[a] / tile;
+  shape[a] = n_tile_rows;
+  dst_strides[a] *= tile;
+  src_strides[a] *= tile;
+
+  ndarray_tiled_copy_arg_t arg = { item_size, tile, it->strides[0][a], it->strides[1][a] };
+  uint8_t *data[2] = { it->data[0], it->data[1] };
+  const ssize_t *strides[2] = { dst_strides, src_strides };
+
+  ndarray_iter_t tiled_it;
+  ndarray_iter_init(&tiled_it, 2, data, strides, ndim, shape, NDARRAY_ITER_KEEP_ORDER);
+  ndarray_iter_run_parallel(&tiled_it, ndarray_tiled_copy_kernel, &arg);
+  ndarray_iter_release(&tiled_it);
+
+  /* the rows left over */
+  const ssize_t n_rest = it->shape[a] - n_tile_rows * tile;
+  if (n_rest > 0) {
+    shape[a] = n_rest;
+    dst_strides[a] = it->strides[0][a];
+    src_strides[a] = it->strides[1][a];
+    data[0] += n_tile_rows * tile * it->strides[0][a];
+    data[1] += n_tile_rows * tile * it->strides[1][a];
+
+    ssize_t item_size_arg = item_size;
+    ndarray_iter_t rest_it;
+    ndarray_iter_init(&rest_it, 2, data, strides, ndim, shape, NDARRAY_ITER_KEEP_ORDER);
+    ndarray_iter_run_parallel(&rest_it, ndarray_copy_kernel, &item_size_arg);
+    ndarray_iter_release(&rest_it);
+  }
+
+  RB_ALLOCV_END(heap_buf);
+  return true;
+}
+
+#undef NDARRAY_COPY_MAX_TILE
+#undef NDARRAY_COPY_MIN_TILE
+#undef NDARRAY_COPY_TILE_BYTES
+
+static void
+ndarray_strided_copy(uint8_t *dst, const ssize_t *dst_strides,
+                     const uint8_t *src, const ssize_t *src_strides,
+                     const ssize_t ndim, const ssize_t *shape, ssize_t item_size)
+{
+  uint8_t *data[2] = { dst, (uint8_t *)src };
+  const ssize_t *strides[2] = { dst_strides, src_strides };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 2, data, strides, ndim, shape, 0);
+  if (!ndarray_tiled_copy(&it, item_size)) {
+    ndarray_iter_run_parallel(&it, ndarray_copy_kernel, &item_size);
+  }
+  ndarray_iter_release(&it);
+}
+
+/* Byte order
+ *
+ * The items of an array are stored in the byte order opposite to the
+ * native one when swapped_p is set.  They are swapped by ndarray_get_item
+ * and ndarray_set_item one by one, and the kernels work on the native
+ * copies made by ndarray_to_native.  The real and the imaginary parts of a
+ * complex number are swapped separately. */
+
+#ifdef HAVE_BUILTIN___BUILTIN_BSWAP16
+# define NDARRAY_BSWAP16(x) __builtin_bswap16(x)
+#else
+# define NDARRAY_BSWAP16(x) ((uint16_t)(((uint16_t)(x) << 8) | ((uint16_t)(x) >> 8)))
+#endif
+#ifdef HAVE_BUILTIN___BUILTIN_BSWAP32
+# define NDARRAY_BSWAP32(x) __builtin_bswap32(x)
+#else
+# define NDARRAY_BSWAP32(x) (((uint32_t)NDARRAY_BSWAP16((uint16_t)(x)) << 16) | NDARRAY_BSWAP16((uint16_t)((x) >> 16)))
+#endif
+#ifdef HAVE_BUILTIN___BUILTIN_BSWAP64
+# define NDARRAY_BSWAP64(x) __builtin_bswap64(x)
+#else
+# define NDARRAY_BSWAP64(x) (((uint64_t)NDARRAY_BSWAP32((uint32_t)(x)) << 32) | NDARRAY_BSWAP32((uint32_t)((x) >> 32)))
+#endif
+
+/* The size of the units swapped in the items of dtype */
+static inline ssize_t
+ndarray_dtype_swap_unit(const ndarray_dtype_t dtype)
+{
+  if (dtype == ndarray_dtype_complex64 || dtype == ndarray_dtype_complex128) {
+    return SIZEOF_DTYPE(dtype) / 2;
+  }
+  return SIZEOF_DTYPE(dtype);
+}
+
+typedef struct {
+  ssize_t item_size;
+  ssize_t unit;
+} ndarray_byteswap_arg_t;
+
+/* The units of contiguous items are contiguous as well, and swapped in a
+ * single loop that is vectorized to byte shuffles. */
+#define BYTESWAP_LOOP(type, bswap) do { \
+    const ssize_t m = item_size / (ssize_t)sizeof(type); \
+    if (dst_stride == item_size && src_stride == item_size) { \
+      type *d = (type *)dst; \
+      const type *s = (const type *)src; \
+      for (i = 0; i < n * m; ++i) d[i] = bswap(s[i]); \
+    } \
+    else { \
+      for (i = 0; i < n; ++i, dst += dst_stride, src += src_stride) { \
+        for (j = 0; j < m; ++j) ((type *)dst)[j] = bswap(((const type *)src)[j]); \
+      } \
+    } \
+  } while (0)
+
+/* ptrs[0] is the destination, and ptrs[1] is the source that can be the
+ * same as the destination */
+static int
+ndarray_byteswap_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_byteswap_arg_t *swap_arg = arg;
+  const ssize_t item_size = swap_arg->item_size;
+  uint8_t *dst = ptrs[0];
+  const uint8_t *src = ptrs[1];
+  const ssize_t dst_stride = strides[0], src_stride = strides[1];
+  ssize_t i, j;
+
+  switch (swap_arg->unit) {
+    case 2: BYTESWAP_LOOP(uint16_t, NDARRAY_BSWAP16); break;
+    case 4: BYTESWAP_LOOP(uint32_t, NDARRAY_BSWAP32); break;
+    case 8: BYTESWAP_LOOP(uint64_t, NDARRAY_BSWAP64); break;
+    default: UNREACHABLE;
+  }
+  return 0;
+}
+
+#undef BYTESWAP_LOOP
+
+/* Copy the items of dtype from src to dst swapping their bytes.  dst can
+ * be the same as src to swap them in place. */
+static void
+ndarray_byteswap_copy(uint8_t *dst, const ssize_t *dst_strides,
+                      const uint8_t *src, const ssize_t *src_strides,
+                      const ssize_t ndim, const ssize_t *shape, const ndarray_dtype_t dtype)
+{
+  ndarray_byteswap_arg_t arg = { SIZEOF_DTYPE(dtype), ndarray_dtype_swap_unit(dtype) };
+  uint8_t *data[2] = { dst, (uint8_t *)src };
+  const ssize_t *strides[2] = { dst_strides, src_strides };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 2, data, strides, ndim, shape, 0);
+  ndarray_iter_run_parallel(&it, ndarray_byteswap_kernel, &arg);
+  ndarray_iter_release(&it);
+}
+
+static void
+ndarray_check_shape(VALUE shape_ary)
+{
+  int i;
+
+  Check_Type(shape_ary, T_ARRAY);
+
+  const ssize_t ndim = (ssize_t)RARRAY_LEN(shape_ary);
+  for (i = 0; i < ndim; ++i) {
+    VALUE si = RARRAY_AREF(shape_ary, i);
+    Check_Type(si, T_FIXNUM);
+  }
+}
+
+/* Set dtype, shape, and contiguous strides of the given order to nar,
+ * and return the byte size of the data buffer they need.  format is the
+ * item format of the record dtype, or nil. */
+static ssize_t
+ndarray_init_layout(ndarray_t *nar, VALUE shape_ary, const ndarray_dtype_t dtype, VALUE format,
+                    const ndarray_order_t order)
+{
+  int i;
+
+  /* the shape is checked before nar is modified */
+  const ssize_t ndim = (ssize_t)RARRAY_LEN(shape_ary);
+  ssize_t n_items = 1;
+  for (i = 0; i < ndim; ++i) {
+    const ssize_t dim_size = NUM2SSIZET(RARRAY_AREF(shape_ary, i));
+    if (dim_size < 0) {
+      rb_raise(rb_eArgError, "negative dimensions are not allowed");
+    }
+    if (dim_size > 0 && n_items > SSIZE_MAX / dim_size) {
+      rb_raise(rb_eArgError, "array is too big");
+    }
+    n_items *= dim_size;
+  }
+
+  ndarray_set_dtype(nar, dtype, format);
+  if (nar->item_size > 0 && n_items > SSIZE_MAX / nar->item_size) {
+    rb_raise(rb_eArgError, "array is too big");
+  }
+
+  ndarray_alloc_dims(nar, ndim);
+  ssize_t *shape = nar->shape;
+  ssize_t *strides = nar->strides;
+
+  for (i = 0; i < ndim; ++i) {
+    VALUE si = RARRAY_AREF(shape_ary, i);
+    shape[i] = NUM2SSIZET(si);
+  }
+
+  switch (order) {
+    case ndarray_order_auto:
+    case ndarray_order_row_major:
+      ndarray_init_row_major_strides(nar->item_size, ndim, shape, strides);
+      break;
+
+    default:
+      ndarray_init_column_major_strides(nar->item_size, ndim, shape, strides);
+      break;
+  }
+
+  /* an array of no dimensions has an item */
+  return n_items * nar->item_size;
+}
+
+static VALUE
+ndarray_initialize_impl(VALUE obj, VALUE shape_ary, VALUE dtype_name, VALUE order_name, VALUE alignment_v,
+                        VALUE format, VALUE byte_order)
+{
+  ndarray_check_shape(shape_ary);
+
+  ndarray_dtype_t dtype = ndarray_obj_to_dtype_t(dtype_name);
+  ndarray_order_t order = ndarray_obj_to_order_t(order_name);
+  const size_t alignment = ndarray_check_alignment(alignment_v);
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  const ssize_t byte_size = ndarray_init_layout(nar, shape_ary, dtype, format, order);
+  ndarray_set_byte_order(nar, byte_order, false);
+  ndarray_alloc_data(nar, byte_size, alignment);
+
+  return Qnil;
+}
+
+static VALUE
+ndarray_initialize(int argc, VALUE *argv, VALUE obj)
+{
+  VALUE shape_ary, dtype_name, order_name, alignment_v, format, byte_order;
+  rb_scan_args(argc, argv, "33", &shape_ary, &dtype_name, &order_name, &alignment_v, &format, &byte_order);
+
+  return ndarray_initialize_impl(obj, shape_ary, dtype_name, order_name, alignment_v, format, byte_order);
+}
+
+static VALUE
+ndarray_get_alignment(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  /* the largest power of 2 that divides the address of data */
+  const uintptr_t addr = (uintptr_t)nar->data;
+  if (addr == 0) {
+    return Qnil;
+  }
+  return SIZET2NUM((size_t)(addr & -addr));
+}
+
+#ifdef NDARRAY_USE_MMAP
+static VALUE
+ndarray_s_mmap_impl(VALUE klass, VALUE path, VALUE shape_ary, VALUE dtype_name, VALUE order_name, VALUE offset_v, VALUE mode,
+                    VALUE byte_order)
+{
+  FilePathValue(path);
+  ndarray_check_shape(shape_ary);
+
+  ndarray_dtype_t dtype = ndarray_obj_to_dtype_t(dtype_name);
+  ndarray_order_t order = ndarray_obj_to_order_t(order_name);
+
+  const off_t offset = NUM2OFFT(offset_v);
+  if (offset < 0) {
+    rb_raise(rb_eArgError, "negative offset (%"PRIsVALUE")", offset_v);
+  }
+
+  mode = param_to_symbol(mode, "mode");
+  if (mode != sym_r && mode != sym_rw) {
+    rb_raise(rb_eArgError, "invalid mode value (%+"PRIsVALUE")", mode);
+  }
+  const bool writable_p = (mode == sym_rw);
+
+  VALUE obj = ndarray_s_allocate(klass);
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  const ssize_t byte_size = ndarray_init_layout(nar, shape_ary, dtype, Qnil, order);
+  ndarray_set_byte_order(nar, byte_order, false);
+
+  /* The items must be aligned for the kernels accessing them by their types */
+  if (offset % nar->item_size != 0) {
+    rb_raise(rb_eArgError, "offset (%"PRIsVALUE") is not a multiple of the item size (%"PRIdSIZE")",
+             offset_v, nar->item_size);
+  }
+
+  const int fd = rb_cloexec_open(StringValueCStr(path), writable_p ? O_RDWR : O_RDONLY, 0);
+  if (fd < 0) {
+    rb_sys_fail_str(path);
+  }
+  rb_update_max_fd(fd);
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    const int e = errno;
+    close(fd);
+    rb_syserr_fail_str(e, path);
+  }
+  if (st.st_size < offset || st.st_size - offset < byte_size) {
+    close(fd);
+    rb_raise(rb_eArgError, "file is too small (%"PRIsVALUE" bytes from the offset %"PRIsVALUE" are required)",
+             SSIZET2NUM(byte_size), offset_v);
+  }
+
+  if (byte_size == 0) {
+    close(fd);
+    ndarray_alloc_data(nar, 0, NDARRAY_DEFAULT_ALIGNMENT);
+  }
+  else {
+    /* The offset of mmap must be a multiple of the page size */
+    const off_t page_size = (off_t)sysconf(_SC_PAGESIZE);
+    const off_t map_offset = offset - offset % page_size;
+    const size_t map_size = (size_t)(offset - map_offset) + byte_size;
+    const int prot = writable_p ? (PROT_READ | PROT_WRITE) : PROT_READ;
+
+    void *ptr = mmap(NULL, map_size, prot, MAP_SHARED, fd, map_offset);
+    const int e = errno;
+    close(fd);
+    if (ptr == MAP_FAILED) {
+      rb_syserr_fail_str(e, path);
+    }
+
+    nar->storage = ndarray_storage_file;
+    nar->storage_ptr = ptr;
+    nar->storage_size = map_size;
+    nar->data = (uint8_t *)ptr + (offset - map_offset);
+    nar->byte_size = byte_size;
+  }
+
+  /* Read-only maps are exported as read-only MemoryViews */
+  if (!writable_p) {
+    rb_obj_freeze(obj);
+  }
+
+  return obj;
+}
+#endif
+
+static VALUE
+ndarray_get_byte_size(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  return SSIZET2NUM(nar->byte_size);
+}
+
+static VALUE
+ndarray_get_dtype(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (ndarray_dtype_none < nar->dtype && nar->dtype < NDARRAY_NUM_DTYPES) {
+    return ID2SYM(DTYPE_ID(nar->dtype));
+  }
+  return Qnil;
+}
+
+static VALUE
+ndarray_get_item_size(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  return SSIZET2NUM(nar->item_size);
+}
+
+/* The item format in the notation of MemoryView */
+static VALUE
+ndarray_get_item_format(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (nar->dtype == ndarray_dtype_record) {
+    return nar->format;
+  }
+  if (ndarray_dtype_none < nar->dtype && nar->dtype < NDARRAY_NUM_DTYPES) {
+    return rb_str_new_cstr(nar->swapped_p ? DTYPE_SWAPPED_FORMAT(nar->dtype) : DTYPE_FORMAT(nar->dtype));
+  }
+  return Qnil;
+}
+
+static VALUE
+ndarray_get_ndim(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  return SSIZET2NUM(nar->ndim);
+}
+
+static VALUE
+ndarray_get_shape(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  VALUE ary = rb_ary_new_capa(nar->ndim);
+  int i;
+  for (i = 0; i < nar->ndim; ++i) {
+    rb_ary_push(ary, SSIZET2NUM(nar->shape[i]));
+  }
+
+  return ary;
+}
+
+static VALUE
+ndarray_get_strides(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (nar->strides == NULL) {
+    return rb_ary_new_capa(0);
+  }
+
+  VALUE ary = rb_ary_new_capa(nar->ndim);
+  int i;
+  for (i = 0; i < nar->ndim; ++i) {
+    rb_ary_push(ary, SSIZET2NUM(nar->strides[i]));
+  }
+
+  return ary;
+}
+
+#define DEFINE_GET_VALUE_FUNC(name, type, kind, load, num2type, type2num) \
+static VALUE \
+ndarray_get_value_##name(const uint8_t *value_ptr) \
+{ \
+  return type2num(*(const type *)value_ptr); \
+}
+
+NDARRAY_FOR_EACH_DTYPE(DEFINE_GET_VALUE_FUNC)
+
+#undef DEFINE_GET_VALUE_FUNC
+
+typedef VALUE (*ndarray_get_value_func_t)(const uint8_t *);
+
+#define GET_VALUE_FUNC_OF(name, type, kind, load, num2type, type2num) ndarray_get_value_##name,
+
+static const ndarray_get_value_func_t ndarray_get_value_funcs[] = {
+  NULL,
+  NDARRAY_FOR_EACH_DTYPE(GET_VALUE_FUNC_OF)
+  NULL, /* record */
+};
+
+#undef GET_VALUE_FUNC_OF
+
+static VALUE
+ndarray_get_value(const uint8_t *value_ptr, const ndarray_dtype_t dtype)
+{
+  assert(value_ptr != NULL);
+  const ndarray_get_value_func_t get_value = ndarray_get_value_funcs[dtype];
+  return get_value ? get_value(value_ptr) : Qnil;
+}
+
+/* Swap the bytes of the item of the given size */
+static inline void
+ndarray_swap_bytes(uint8_t *dst, const uint8_t *src, const ssize_t size)
+{
+  ssize_t i;
+  for (i = 0; i < size; ++i) {
+    dst[i] = src[size - 1 - i];
+  }
+}
+
+/* A record is converted to the array of the values of its fields.  The
+ * value of a repeated field is an array of the items. */
+static VALUE
+ndarray_get_record(const ndarray_t *nar, const uint8_t *value_ptr)
+{
+  VALUE ary = rb_ary_new_capa(nar->n_fields);
+  ssize_t i;
+  size_t j;
+  for (i = 0; i < nar->n_fields; ++i) {
+    const ndarray_field_t *field = &nar->fields[i];
+    const ssize_t size = SIZEOF_DTYPE(field->dtype);
+    VALUE items = field->repeat == 1 ? Qnil : rb_ary_new_capa(field->repeat);
+    for (j = 0; j < field->repeat; ++j) {
+      /* the fields are packed, so an item is copied to the aligned buffer */
+      const uint8_t *p = value_ptr + field->offset + j * size;
+      ndarray_item_buf_t buf;
+      if (field->swap_p) {
+        ndarray_swap_bytes(buf.bytes, p, size);
+      }
+      else {
+        memcpy(buf.bytes, p, size);
+      }
+      VALUE item = ndarray_get_value(buf.bytes, field->dtype);
+      if (field->repeat == 1) {
+        rb_ary_push(ary, item);
+      }
+      else {
+        rb_ary_push(items, item);
+      }
+    }
+    if (field->repeat != 1) {
+      rb_ary_push(ary, items);
+    }
+  }
+  return ary;
+}
+
+/* Swap the bytes of the item of dtype in the units of the components */
+static void
+ndarray_byteswap_item(uint8_t *dst, const uint8_t *src, const ndarray_dtype_t dtype)
+{
+  const ssize_t item_size = SIZEOF_DTYPE(dtype), unit = ndarray_dtype_swap_unit(dtype);
+  ssize_t i;
+  for (i = 0; i < item_size; i += unit) {
+    ndarray_swap_bytes(dst + i, src + i, unit);
+  }
+}
+
+static inline VALUE
+ndarray_get_item(const ndarray_t *nar, const uint8_t *value_ptr)
+{
+  if (nar->dtype == ndarray_dtype_record) {
+    return ndarray_get_record(nar, value_ptr);
+  }
+  if (nar->swapped_p) {
+    ndarray_item_buf_t buf;
+    ndarray_byteswap_item(buf.bytes, value_ptr, nar->dtype);
+    return ndarray_get_value(buf.bytes, nar->dtype);
+  }
+  return ndarray_get_value(value_ptr, nar->dtype);
+}
+
+/* Views */
+
+static VALUE cArithmeticSequence = Qnil;
+
+/* Make an array that borrows the buffer of base.  The shape and the
+ * strides of the view are left uninitialized for the caller. */
+static VALUE
+ndarray_new_view(VALUE base, const ndarray_t *nar_base, uint8_t *data, const ssize_t ndim)
+{
+  VALUE view = ndarray_s_allocate(CLASS_OF(base));
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(view, ndarray_t, &ndarray_data_type, nar);
+
+  nar->data = data;
+  ndarray_copy_dtype(nar, nar_base);
+  nar->base = base;
+  ndarray_alloc_dims(nar, ndim);
+
+  if (OBJ_FROZEN(base)) {
+    rb_obj_freeze(view);
+  }
+
+  return view;
+}
+
+static void
+ndarray_view_update_byte_size(ndarray_t *nar)
+{
+  ssize_t byte_size = nar->item_size;
+  ssize_t i;
+  for (i = 0; i < nar->ndim; ++i) {
+    byte_size *= nar->shape[i];
+  }
+  nar->byte_size = byte_size;
+}
+
+static int
+ndarray_slice_spec_p(VALUE spec)
+{
+  return rb_obj_is_kind_of(spec, rb_cRange) ||
+    (!NIL_P(cArithmeticSequence) && rb_obj_is_kind_of(spec, cArithmeticSequence));
+}
+
+static ssize_t
+ndarray_normalize_index(VALUE index_v, const ssize_t size, const ssize_t axis)
+{
+  ssize_t index = NUM2SSIZET(index_v);
+  if (index < 0) {
+    index += size;
+  }
+  if (index < 0 || size <= index) {
+    rb_raise(rb_eIndexError, "index %"PRIsVALUE" is out of bounds for axis %"PRIdSIZE" with size %"PRIdSIZE,
+             index_v, axis, size);
+  }
+  return index;
+}
+
+static ssize_t
+clamp_ssize(const ssize_t x, const ssize_t lo, const ssize_t hi)
+{
+  return x < lo ? lo : (x > hi ? hi : x);
+}
+
+/* Extract the start position, the length and the step of the slice by a
+ * Range or an ArithmeticSequence.  Negative positions count from the end,
+ * and the positions out of the axis are clipped. */
+static void
+ndarray_slice_spec_extract(VALUE spec, const ssize_t size,
+                           ssize_t *out_start, ssize_t *out_len, ssize_t *out_step)
+{
+  VALUE beg_v, end_v;
+  int excl;
+  ssize_t step = 1;
+
+  if (rb_obj_is_kind_of(spec, rb_cRange)) {
+    rb_range_values(spec, &beg_v, &end_v, &excl);
+  }
+  else {
+    beg_v = rb_funcallv(spec, rb_intern("begin"), 0, NULL);
+    end_v = rb_funcallv(spec, rb_intern("end"), 0, NULL);
+    excl = RTEST(rb_funcallv(spec, rb_intern("exclude_end?"), 0, NULL));
+
+    VALUE step_v = rb_funcallv(spec, rb_intern("step"), 0, NULL);
+    if (!RB_INTEGER_TYPE_P(step_v)) {
+      rb_raise(rb_eTypeError, "step must be an Integer (%"PRIsVALUE" given)", step_v);
+    }
+    step = NUM2SSIZET(step_v);
+    if (step == 0) {
+      rb_raise(rb_eArgError, "step can't be 0");
+    }
+  }
+
+  ssize_t start, stop, len;
+  if (step > 0) {
+    start = NIL_P(beg_v) ? 0 : NUM2SSIZET(beg_v);
+    if (start < 0) start += size;
+    start = clamp_ssize(start, 0, size);
+
+    if (NIL_P(end_v)) {
+      stop = size;
+    }
+    else {
+      stop = NUM2SSIZET(end_v);
+      if (stop < 0) stop += size;
+      if (!excl) ++stop;
+      stop = clamp_ssize(stop, 0, size);
+    }
+
+    len = start < stop ? (stop - start + step - 1) / step : 0;
+  }
+  else {
+    start = NIL_P(beg_v) ? size - 1 : NUM2SSIZET(beg_v);
+    if (start < 0) start += size;
+    start = clamp_ssize(start, -1, size - 1);
+
+    if (NIL_P(end_v)) {
+      stop = -1;
+    }
+    else {
+      stop = NUM2SSIZET(end_v);
+      if (stop < 0) stop += size;
+      if (!excl) --stop;
+      stop = clamp_ssize(stop, -1, size - 1);
+    }
+
+    len = stop < start ? (start - stop - step - 1) / -step : 0;
+  }
+
+  *out_start = start;
+  *out_len = len;
+  *out_step = step;
+}
+
+/* assume that argc equals to nar->ndim */
+static VALUE
+ndarray_slice(VALUE obj, const ndarray_t *nar, int argc, VALUE *argv)
+{
+  ssize_t new_ndim = 0;
+  int i;
+  for (i = 0; i < argc; ++i) {
+    if (ndarray_slice_spec_p(argv[i]))
+      ++new_ndim;
+  }
+
+  ssize_t offset = 0;
+  int empty = 0;
+
+  ssize_t inline_buf[3 * MAX_INLINE_DIM];
+  ssize_t *shape = inline_buf, *strides = inline_buf + MAX_INLINE_DIM, *starts = inline_buf + 2 * MAX_INLINE_DIM;
+
+  VALUE heap_buf = 0;
+  if (new_ndim > MAX_INLINE_DIM) {
+    shape = RB_ALLOCV_N(ssize_t, heap_buf, 3 * new_ndim);
+    strides = shape + new_ndim;
+    starts = shape + 2 * new_ndim;
+  }
+
+  ssize_t k = 0;
+  for (i = 0; i < argc; ++i) {
+    if (ndarray_slice_spec_p(argv[i])) {
+      ssize_t start, len, step;
+      ndarray_slice_spec_extract(argv[i], nar->shape[i], &start, &len, &step);
+      starts[k] = start * nar->strides[i];
+      shape[k] = len;
+      strides[k] = step * nar->strides[i];
+      if (len == 0) empty = 1;
+      ++k;
+    }
+    else if (RB_INTEGER_TYPE_P(argv[i])) {
+      offset += ndarray_normalize_index(argv[i], nar->shape[i], i) * nar->strides[i];
+    }
+    else {
+      rb_raise(rb_eTypeError, "invalid index (%"PRIsVALUE")", argv[i]);
+    }
+  }
+
+  /* The data pointer of an empty view is never dereferenced */
+  if (!empty) {
+    for (k = 0; k < new_ndim; ++k) {
+      offset += starts[k];
+    }
+  }
+
+  VALUE view = ndarray_new_view(obj, nar, (uint8_t *)nar->data + (empty ? 0 : offset), new_ndim);
+
+  ndarray_t *nar_view;
+  TypedData_Get_Struct(view, ndarray_t, &ndarray_data_type, nar_view);
+
+  MEMCPY(nar_view->shape, shape, ssize_t, new_ndim);
+  MEMCPY(nar_view->strides, strides, ssize_t, new_ndim);
+  ndarray_view_update_byte_size(nar_view);
+
+  RB_ALLOCV_END(heap_buf);
+  return view;
+}
+
+static ssize_t
+ndarray_normalize_axis(VALUE axis_v, const ssize_t ndim)
+{
+  ssize_t axis = NUM2SSIZET(axis_v);
+  if (axis < 0) {
+    axis += ndim;
+  }
+  if (axis < 0 || ndim <= axis) {
+    rb_raise(rb_eArgError, "axis %"PRIsVALUE" is out of bounds for array of dimension %"PRIdSIZE,
+             axis_v, ndim);
+  }
+  return axis;
+}
+
+/* Make a view whose axes are permuted by axes */
+static VALUE
+ndarray_permute_axes(VALUE obj, const ndarray_t *nar, const ssize_t *axes)
+{
+  const ssize_t ndim = nar->ndim;
+  VALUE view = ndarray_new_view(obj, nar, nar->data, ndim);
+
+  ndarray_t *nar_view;
+  TypedData_Get_Struct(view, ndarray_t, &ndarray_data_type, nar_view);
+
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) {
+    nar_view->shape[i] = nar->shape[axes[i]];
+    nar_view->strides[i] = nar->strides[axes[i]];
+  }
+  nar_view->byte_size = nar->byte_size;
+
+  return view;
+}
+
+static VALUE
+ndarray_transpose(int argc, VALUE *argv, VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  const ssize_t ndim = nar->ndim;
+  if (argc == 1 && RB_TYPE_P(argv[0], T_ARRAY)) {
+    argc = (int)RARRAY_LEN(argv[0]);
+    argv = (VALUE *)RARRAY_CONST_PTR(argv[0]);
+  }
+  if (argc != 0 && argc != ndim) {
+    rb_raise(rb_eArgError, "axes don't match array (%d for %"PRIdSIZE")", argc, ndim);
+  }
+
+  VALUE heap_buf = 0;
+  ssize_t *axes = RB_ALLOCV_N(ssize_t, heap_buf, 2 * ndim);
+  ssize_t *seen = axes + ndim;
+  MEMZERO(seen, ssize_t, ndim);
+
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) {
+    if (argc == 0) {
+      axes[i] = ndim - 1 - i;
+      continue;
+    }
+    axes[i] = ndarray_normalize_axis(argv[i], ndim);
+    if (seen[axes[i]]++) {
+      RB_ALLOCV_END(heap_buf);
+      rb_raise(rb_eArgError, "repeated axis in transpose");
+    }
+  }
+
+  VALUE view = ndarray_permute_axes(obj, nar, axes);
+  RB_ALLOCV_END(heap_buf);
+  return view;
+}
+
+static VALUE
+ndarray_swapaxes(VALUE obj, VALUE axis1_v, VALUE axis2_v)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  const ssize_t ndim = nar->ndim;
+  const ssize_t axis1 = ndarray_normalize_axis(axis1_v, ndim);
+  const ssize_t axis2 = ndarray_normalize_axis(axis2_v, ndim);
+
+  VALUE heap_buf = 0;
+  ssize_t *axes = RB_ALLOCV_N(ssize_t, heap_buf, ndim);
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) {
+    axes[i] = i;
+  }
+  axes[axis1] = axis2;
+  axes[axis2] = axis1;
+
+  VALUE view = ndarray_permute_axes(obj, nar, axes);
+  RB_ALLOCV_END(heap_buf);
+  return view;
+}
+
+/* Item access
+ *
+ * [] and []= with an integer for each axis compute the address of the item
+ * from the indices without any buffer.  Fixnum indices are taken without
+ * conversion and checked by a single comparison, and the other integers
+ * go to ndarray_normalize_index.  Negative indices count from the end.
+ * The arrays up to 3-D have the unrolled paths. */
+
+/* The byte offset of the item at index_v on the axis */
+static inline ssize_t
+ndarray_axis_offset(const ndarray_t *nar, VALUE index_v, const ssize_t axis)
+{
+  const ssize_t size = nar->shape[axis];
+  if (RB_LIKELY(FIXNUM_P(index_v))) {
+    ssize_t index = FIX2LONG(index_v);
+    if (index < 0) {
+      index += size;
+    }
+    /* the negative indices are also rejected as unsigned */
+    if (RB_LIKELY((size_t)index < (size_t)size)) {
+      return index * nar->strides[axis];
+    }
+  }
+  return ndarray_normalize_index(index_v, size, axis) * nar->strides[axis];
+}
+
+/* The address of the item at the indices in argv, whose length is ndim */
+static inline uint8_t *
+ndarray_item_ptr(const ndarray_t *nar, const VALUE *argv)
+{
+  uint8_t *p = nar->data;
+  ssize_t i;
+
+  switch (nar->ndim) {
+    case 1:
+      p += ndarray_axis_offset(nar, argv[0], 0);
+      break;
+    case 2:
+      p += ndarray_axis_offset(nar, argv[0], 0);
+      p += ndarray_axis_offset(nar, argv[1], 1);
+      break;
+    case 3:
+      p += ndarray_axis_offset(nar, argv[0], 0);
+      p += ndarray_axis_offset(nar, argv[1], 1);
+      p += ndarray_axis_offset(nar, argv[2], 2);
+      break;
+    default:
+      for (i = 0; i < nar->ndim; ++i) {
+        p += ndarray_axis_offset(nar, argv[i], i);
+      }
+      break;
+  }
+
+  return p;
+}
+
+static VALUE
+ndarray_aref(int argc, VALUE *argv, VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (nar->ndim != argc) {
+    rb_raise(rb_eIndexError, "index dimension mismatched (%d for %"PRIdSIZE")", argc, nar->ndim);
+  }
+
+  int k;
+  for (k = 0; k < argc; ++k) {
+    if (!FIXNUM_P(argv[k]) && ndarray_slice_spec_p(argv[k]))
+      return ndarray_slice(obj, nar, argc, argv);
+  }
+
+  return ndarray_get_item(nar, ndarray_item_ptr(nar, argv));
+}
+
+#define DEFINE_SET_VALUE_FUNC(name, type, kind, load, num2type, type2num) \
+static void \
+ndarray_set_value_##name(uint8_t *value_ptr, const VALUE val) \
+{ \
+  *(type *)value_ptr = num2type(val); \
+}
+
+NDARRAY_FOR_EACH_DTYPE(DEFINE_SET_VALUE_FUNC)
+
+#undef DEFINE_SET_VALUE_FUNC
+
+typedef void (*ndarray_set_value_func_t)(uint8_t *, const VALUE);
+
+#define SET_VALUE_FUNC_OF(name, type, kind, load, num2type, type2num) ndarray_set_value_##name,
+
+static const ndarray_set_value_func_t ndarray_set_value_funcs[] = {
+  NULL,
+  NDARRAY_FOR_EACH_DTYPE(SET_VALUE_FUNC_OF)
+  NULL, /* record */
+};
+
+#undef SET_VALUE_FUNC_OF
+
+static VALUE
+ndarray_set_value(uint8_t *value_ptr, const ndarray_dtype_t dtype, const VALUE val)
+{
+  assert(value_ptr != NULL);
+  const ndarray_set_value_func_t set_value = ndarray_set_value_funcs[dtype];
+  if (!set_value) return Qnil;
+  set_value(value_ptr, val);
+  return val;
+}
+
+/* A record is set from an array of the values of its fields.  The record
+ * is left unchanged when any of the values cannot be converted. */
+static VALUE
+ndarray_set_record(const ndarray_t *nar, uint8_t *value_ptr, const VALUE val)
+{
+  VALUE ary = rb_check_array_type(val);
+  if (NIL_P(ary) || RARRAY_LEN(ary) != nar->n_fields) {
+    rb_raise(rb_eTypeError, "a record must be set by an array of %"PRIdSIZE" values (%"PRIsVALUE" given)",
+             nar->n_fields, val);
+  }
+
+  VALUE heap_buf = 0;
+  uint8_t *buf = RB_ALLOCV_N(uint8_t, heap_buf, nar->item_size);
+  memcpy(buf, value_ptr, nar->item_size);
+
+  ssize_t i;
+  size_t j;
+  for (i = 0; i < nar->n_fields; ++i) {
+    const ndarray_field_t *field = &nar->fields[i];
+    const ssize_t size = SIZEOF_DTYPE(field->dtype);
+    VALUE items = RARRAY_AREF(ary, i);
+    if (field->repeat != 1) {
+      items = rb_check_array_type(items);
+      if (NIL_P(items) || (size_t)RARRAY_LEN(items) != field->repeat) {
+        rb_raise(rb_eTypeError, "the field %"PRIdSIZE" must be set by an array of %"PRIuSIZE" values",
+                 i, field->repeat);
+      }
+    }
+    for (j = 0; j < field->repeat; ++j) {
+      /* the fields are packed, so an item is set in the aligned buffer */
+      uint8_t *p = buf + field->offset + j * size;
+      ndarray_item_buf_t tmp;
+      ndarray_set_value(tmp.bytes, field->dtype, field->repeat == 1 ? items : RARRAY_AREF(items, j));
+      if (field->swap_p) {
+        ndarray_swap_bytes(p, tmp.bytes, size);
+      }
+      else {
+        memcpy(p, tmp.bytes, size);
+      }
+    }
+  }
+
+  memcpy(value_ptr, buf, nar->item_size);
+  RB_ALLOCV_END(heap_buf);
+  return val;
+}
+
+static inline VALUE
+ndarray_set_item(const ndarray_t *nar, uint8_t *value_ptr, const VALUE val)
+{
+  if (nar->dtype == ndarray_dtype_record) {
+    return ndarray_set_record(nar, value_ptr, val);
+  }
+  if (nar->swapped_p) {
+    ndarray_item_buf_t buf;
+    const VALUE res = ndarray_set_value(buf.bytes, nar->dtype, val);
+    ndarray_byteswap_item(value_ptr, buf.bytes, nar->dtype);
+    return res;
+  }
+  return ndarray_set_value(value_ptr, nar->dtype, val);
+}
+
+static VALUE
+ndarray_aset(int argc, VALUE *argv, VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  rb_check_frozen(obj);
+
+  if (nar->ndim != argc - 1) {
+    rb_raise(rb_eIndexError, "index dimension mismatched (%d for %"PRIdSIZE")", argc - 1, nar->ndim);
+  }
+
+  const VALUE val = argv[argc-1];
+  return ndarray_set_item(nar, ndarray_item_ptr(nar, argv), val);
+}
+
+/* Conversion from nested Arrays */
+
+typedef struct {
+  ndarray_dtype_t fixed_dtype;
+  ndarray_dtype_t dtype;
+  ssize_t max_dim;
+
+  ssize_t ndim;
+  ssize_t shape_capa;
+  ssize_t *shape;
+  VALUE shape_buf;
+} ndarray_conversion_t;
+
+enum {
+  conversion_done = 0,
+  conversion_fallback
+};
+
+static const char *
+ordinal_suffix(ssize_t n)
+{
+  switch (n % 10) {
+    case 1:
+      return n != 11 ? "st" : "th";
+    case 2:
+      return n != 12 ? "nd" : "th";
+    case 3:
+      return n != 13 ? "rd" : "th";
+    default:
+      return "th";
+  }
+}
+
+static int
+ndarray_dtype_is_integer(const ndarray_dtype_t dtype)
+{
+  return ndarray_dtype_int8 <= dtype && dtype <= ndarray_dtype_uint64;
+}
+
+static int
+ndarray_dtype_is_complex(const ndarray_dtype_t dtype)
+{
+  return dtype == ndarray_dtype_complex64 || dtype == ndarray_dtype_complex128;
+}
+
+/* Integers are promoted to the float or complex dtype of the other, and
+ * floats are promoted to the complex dtype that has the precision of both.
+ * float16 and bfloat16 are promoted to float32 together.  bool and the
+ * record dtype are not promoted. */
+static ndarray_dtype_t
+ndarray_promote_dtype(const ndarray_dtype_t dtype_a, const ndarray_dtype_t dtype_b)
+{
+  if (dtype_a == dtype_b) {
+    return dtype_a;
+  }
+  else if (dtype_a == ndarray_dtype_none || dtype_b == ndarray_dtype_none) {
+    return dtype_a != ndarray_dtype_none ? dtype_a : dtype_b;
+  }
+
+  if (dtype_a == ndarray_dtype_record || dtype_b == ndarray_dtype_record) {
+    rb_raise(rb_eTypeError, "auto promotion of record is not supported");
+  }
+  if (dtype_a == ndarray_dtype_bool || dtype_b == ndarray_dtype_bool) {
+    rb_raise(rb_eTypeError, "auto promotion between bool and numeric is not supported");
+  }
+
+  const int complex_a = ndarray_dtype_is_complex(dtype_a);
+  const int complex_b = ndarray_dtype_is_complex(dtype_b);
+  if (complex_a || complex_b) {
+    const ndarray_dtype_t other = complex_a ? dtype_b : dtype_a;
+    if (other == ndarray_dtype_float64 || other == ndarray_dtype_complex128) {
+      return ndarray_dtype_complex128;
+    }
+    return complex_a ? dtype_a : dtype_b;
+  }
+
+  const int sizeof_a = SIZEOF_DTYPE(dtype_a);
+  const int sizeof_b = SIZEOF_DTYPE(dtype_b);
+  const int integer_a = ndarray_dtype_is_integer(dtype_a);
+  const int integer_b = ndarray_dtype_is_integer(dtype_b);
+
+  if (integer_a && integer_b) {
+    if (sizeof_a > sizeof_b)
+      return dtype_a;
+    else if (sizeof_b > sizeof_a)
+      return dtype_b;
+    rb_raise(rb_eTypeError, "auto promotion between signed and unsigned is not supported");
+  }
+  else if (integer_a) {
+    return dtype_b;
+  }
+  else if (integer_b) {
+    return dtype_a;
+  }
+  else if (sizeof_a == sizeof_b) {
+    /* float16 and bfloat16 */
+    return ndarray_dtype_float32;
+  }
+  return sizeof_a > sizeof_b ? dtype_a : dtype_b;
+}
+
+/* Returns ndarray_dtype_none for an Array, or raises TypeError for an
+ * unsupported object.  The other array-like objects are reported by
+ * conversion_fallback because they are handled in the Ruby side. */
+static int
+ndarray_detect_scalar_dtype(VALUE obj, ndarray_dtype_t *out_dtype)
+{
+  if (RB_INTEGER_TYPE_P(obj)) {
+    *out_dtype = ndarray_dtype_int64;
+    return conversion_done;
+  }
+  else if (RB_FLOAT_TYPE_P(obj) || RB_TYPE_P(obj, T_RATIONAL)) {
+    *out_dtype = ndarray_dtype_float64;
+    return conversion_done;
+  }
+  else if (RB_TYPE_P(obj, T_ARRAY)) {
+    *out_dtype = ndarray_dtype_none;
+    return conversion_done;
+  }
+  else if (RB_TYPE_P(obj, T_COMPLEX)) {
+    VALUE imag = rb_funcallv(obj, rb_intern("imag"), 0, NULL);
+    if (RTEST(rb_equal(imag, INT2FIX(0)))) {
+      VALUE real = rb_funcallv(obj, rb_intern("real"), 0, NULL);
+      return ndarray_detect_scalar_dtype(real, out_dtype);
+    }
+    *out_dtype = ndarray_dtype_complex128;
+    return conversion_done;
+  }
+  else if (obj == Qtrue || obj == Qfalse) {
+    *out_dtype = ndarray_dtype_bool;
+    return conversion_done;
+  }
+  else if (rb_obj_is_kind_of(obj, rb_mEnumerable) || rb_respond_to(obj, rb_intern("to_ary"))) {
+    return conversion_fallback;
+  }
+
+  rb_raise(rb_eTypeError, "%"PRIsVALUE" is unsupported", rb_obj_class(obj));
+}
+
+static int
+ndarray_detect_dtype_and_shape_recursive(VALUE obj, ssize_t dim, ndarray_conversion_t *conv)
+{
+  ndarray_dtype_t dtype;
+  if (ndarray_detect_scalar_dtype(obj, &dtype) == conversion_fallback) {
+    return conversion_fallback;
+  }
+
+  if (dtype != ndarray_dtype_none) {
+    /* obj is scalar */
+    if (conv->max_dim < 0) {
+      conv->max_dim = dim;
+    }
+    else if (dim != conv->max_dim) {
+      const ssize_t dim_failed = dim < conv->max_dim ? dim : conv->max_dim;
+      rb_raise(rb_eArgError, "inhomogeneous array detected at the the %"PRIdSIZE"%s dimension",
+               dim_failed, ordinal_suffix(dim_failed));
+    }
+    if (conv->fixed_dtype == ndarray_dtype_none) {
+      conv->dtype = ndarray_promote_dtype(conv->dtype, dtype);
+    }
+    return conversion_done;
+  }
+
+  /* obj is an Array */
+  if (ruby_stack_check()) {
+    rb_raise(rb_eArgError, "too deeply nested array");
+  }
+
+  const ssize_t dim_size = RARRAY_LEN(obj);
+  if (conv->ndim <= dim) {
+    if (conv->shape_capa <= dim) {
+      /* grown on the heap, as alloca would be released with this frame;
+       * the buffer is owned by ndarray_s_try_convert_impl via shape_buf */
+      VALUE new_shape_buf = 0;
+      const ssize_t new_capa = 2 * conv->shape_capa;
+      ssize_t *new_shape = rb_alloc_tmp_buffer2(&new_shape_buf, new_capa, sizeof(ssize_t));
+      memcpy(new_shape, conv->shape, conv->shape_capa * sizeof(ssize_t));
+      RB_ALLOCV_END(conv->shape_buf);
+      conv->shape = new_shape;
+      conv->shape_buf = new_shape_buf;
+      conv->shape_capa = new_capa;
+    }
+    conv->shape[dim] = dim_size;
+    conv->ndim = dim + 1;
+  }
+  else if (conv->shape[dim] != dim_size) {
+    rb_raise(rb_eArgError, "size mismatch at the %"PRIdSIZE"%s dimension (%"PRIdSIZE" for %"PRIdSIZE")",
+             dim, ordinal_suffix(dim), dim_size, conv->shape[dim]);
+  }
+
+  ssize_t i;
+  for (i = 0; i < dim_size; ++i) {
+    VALUE sub = RARRAY_AREF(obj, i);
+    if (ndarray_detect_dtype_and_shape_recursive(sub, dim + 1, conv) == conversion_fallback) {
+      return conversion_fallback;
+    }
+  }
+
+  return conversion_done;
+}
+
+#define DEFINE_FILL_ROW_FUNC(name, type, kind, load, num2type, type2num) \
+static void \
+ndarray_fill_row_##name(uint8_t *p, const ssize_t stride, const VALUE *items, const long n) \
+{ \
+  long i; \
+  for (i = 0; i < n; ++i, p += stride) { \
+    *(type *)p = num2type(items[i]); \
+  } \
+}
+
+NDARRAY_FOR_EACH_DTYPE(DEFINE_FILL_ROW_FUNC)
+
+#undef DEFINE_FILL_ROW_FUNC
+
+typedef void (*ndarray_fill_row_func_t)(uint8_t *, const ssize_t, const VALUE *, const long);
+
+#define FILL_ROW_FUNC_OF(name, type, kind, load, num2type, type2num) ndarray_fill_row_##name,
+
+static const ndarray_fill_row_func_t ndarray_fill_row_funcs[] = {
+  NULL,
+  NDARRAY_FOR_EACH_DTYPE(FILL_ROW_FUNC_OF)
+  NULL,
+};
+
+#undef FILL_ROW_FUNC_OF
+
+static void
+ndarray_fill_recursive(const ndarray_t *nar, VALUE ary, ssize_t dim, uint8_t *p,
+                       ndarray_fill_row_func_t fill_row)
+{
+  const long n = RARRAY_LEN(ary);
+  const ssize_t stride = nar->strides[dim];
+
+  if (dim == nar->ndim - 1) {
+    fill_row(p, stride, RARRAY_CONST_PTR(ary), n);
+  }
+  else {
+    long i;
+    for (i = 0; i < n; ++i, p += stride) {
+      ndarray_fill_recursive(nar, RARRAY_AREF(ary, i), dim + 1, p, fill_row);
+    }
+  }
+}
+
+static VALUE
+ndarray_s_try_convert_impl(VALUE klass, VALUE ary, VALUE dtype_name, VALUE order, VALUE alignment)
+{
+  Check_Type(ary, T_ARRAY);
+
+  ndarray_conversion_t conv;
+  conv.fixed_dtype = NIL_P(dtype_name) ? ndarray_dtype_none : ndarray_obj_to_dtype_t(dtype_name);
+  conv.dtype = ndarray_dtype_none;
+  conv.max_dim = -1;
+  conv.ndim = 0;
+  conv.shape_capa = MAX_INLINE_DIM;
+  conv.shape_buf = 0;
+  conv.shape = RB_ALLOCV_N(ssize_t, conv.shape_buf, conv.shape_capa);
+
+  if (ndarray_detect_dtype_and_shape_recursive(ary, 0, &conv) == conversion_fallback) {
+    RB_ALLOCV_END(conv.shape_buf);
+    return Qnil;
+  }
+
+  VALUE shape_ary = rb_ary_new_capa(conv.ndim);
+  ssize_t i;
+  for (i = 0; i < conv.ndim; ++i) {
+    rb_ary_push(shape_ary, SSIZET2NUM(conv.shape[i]));
+  }
+  RB_ALLOCV_END(conv.shape_buf);
+
+  const ndarray_dtype_t dtype = conv.fixed_dtype != ndarray_dtype_none ? conv.fixed_dtype : conv.dtype;
+  VALUE dtype_sym = dtype != ndarray_dtype_none ? ID2SYM(DTYPE_ID(dtype)) : Qnil;
+
+  VALUE obj = ndarray_s_allocate(klass);
+  ndarray_initialize_impl(obj, shape_ary, dtype_sym, order, alignment, Qnil, Qnil);
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (nar->byte_size > 0) {
+    ndarray_fill_recursive(nar, ary, 0, nar->data, ndarray_fill_row_funcs[nar->dtype]);
+  }
+
+  return obj;
+}
+
+/* Comparison */
+
+typedef enum {
+  ndarray_scalar_signed,
+  ndarray_scalar_unsigned,
+  ndarray_scalar_float,
+  ndarray_scalar_complex
+} ndarray_scalar_kind_t;
+
+typedef struct {
+  ndarray_scalar_kind_t kind;
+  union {
+    int64_t i;
+    uint64_t u;
+    double f;
+    ndarray_complex128_t c;
+  } v;
+} ndarray_scalar_t;
+
+/* The kind of scalar and its member holding the items computed in each kind */
+#define NDARRAY_SCALAR_KIND_i64 ndarray_scalar_signed
+#define NDARRAY_SCALAR_KIND_u64 ndarray_scalar_unsigned
+#define NDARRAY_SCALAR_KIND_f64 ndarray_scalar_float
+#define NDARRAY_SCALAR_KIND_c128 ndarray_scalar_complex
+#define NDARRAY_SCALAR_KIND(kind) NDARRAY_SCALAR_KIND_##kind
+
+#define NDARRAY_SCALAR_MEMBER_i64 i
+#define NDARRAY_SCALAR_MEMBER_u64 u
+#define NDARRAY_SCALAR_MEMBER_f64 f
+#define NDARRAY_SCALAR_MEMBER_c128 c
+#define NDARRAY_SCALAR_MEMBER(kind) NDARRAY_SCALAR_MEMBER_##kind
+
+#define DEFINE_LOAD_SCALAR_FUNC(name, type, skind, load, num2type, type2num) \
+static void \
+ndarray_load_scalar_##name(const uint8_t *p, ndarray_scalar_t *out) \
+{ \
+  out->kind = NDARRAY_SCALAR_KIND(skind); \
+  out->v.NDARRAY_SCALAR_MEMBER(skind) = load(*(const type *)p); \
+}
+
+NDARRAY_FOR_EACH_DTYPE(DEFINE_LOAD_SCALAR_FUNC)
+
+#undef DEFINE_LOAD_SCALAR_FUNC
+
+typedef void (*ndarray_load_scalar_func_t)(const uint8_t *, ndarray_scalar_t *);
+
+#define LOAD_SCALAR_FUNC_OF(name, type, kind, load, num2type, type2num) ndarray_load_scalar_##name,
+
+static const ndarray_load_scalar_func_t ndarray_load_scalar_funcs[] = {
+  NULL,
+  NDARRAY_FOR_EACH_DTYPE(LOAD_SCALAR_FUNC_OF)
+  NULL, /* record */
+};
+
+#undef LOAD_SCALAR_FUNC_OF
+
+/* 2**63 and 2**64 are exactly representable in double */
+#define DBL_2_63 9223372036854775808.0
+#define DBL_2_64 18446744073709551616.0
+
+/* The same semantics as Integer#==, Float#==, and Complex#== */
+static inline int
+ndarray_scalar_eq(const ndarray_scalar_t *a, const ndarray_scalar_t *b)
+{
+  if (a->kind == b->kind) {
+    switch (a->kind) {
+      case ndarray_scalar_signed:
+        return a->v.i == b->v.i;
+      case ndarray_scalar_unsigned:
+        return a->v.u == b->v.u;
+      case ndarray_scalar_complex:
+        return a->v.c.re == b->v.c.re && a->v.c.im == b->v.c.im;
+      default:
+        return a->v.f == b->v.f;
+    }
+  }
+
+  if (a->kind == ndarray_scalar_complex || b->kind == ndarray_scalar_complex) {
+    /* compare the real part with the real number if the imaginary part is 0 */
+    const ndarray_scalar_t *z = a->kind == ndarray_scalar_complex ? a : b;
+    const ndarray_scalar_t *x = z == a ? b : a;
+    ndarray_scalar_t re;
+    re.kind = ndarray_scalar_float;
+    re.v.f = z->v.c.re;
+    return z->v.c.im == 0.0 && ndarray_scalar_eq(&re, x);
+  }
+
+  if (b->kind == ndarray_scalar_float) {
+    const ndarray_scalar_t *t = a;
+    a = b;
+    b = t;
+  }
+
+  if (a->kind == ndarray_scalar_float) {
+    const double f = a->v.f;
+    if (b->kind == ndarray_scalar_signed) {
+      return -DBL_2_63 <= f && f < DBL_2_63 && (double)(int64_t)f == f && (int64_t)f == b->v.i;
+    }
+    else {
+      return 0 <= f && f < DBL_2_64 && (double)(uint64_t)f == f && (uint64_t)f == b->v.u;
+    }
+  }
+
+  /* signed and unsigned */
+  if (a->kind == ndarray_scalar_signed) {
+    return a->v.i >= 0 && (uint64_t)a->v.i == b->v.u;
+  }
+  else {
+    return b->v.i >= 0 && (uint64_t)b->v.i == a->v.u;
+  }
+}
+
+#define EQ_BLOCK_SIZE 256
+
+/* Integers are equal iff their representations are equal, so contiguous
+ * integer rows are compared by memcmp.  Float rows are compared in blocks
+ * without early exit so that the comparison can be vectorized. */
+#define DEFINE_EQ_ROW_FUNC(name, type, kind, load, num2type, type2num) \
+static int \
+ndarray_eq_row_##name(const uint8_t *p1, const ssize_t stride1, \
+                      const uint8_t *p2, const ssize_t stride2, const ssize_t n) \
+{ \
+  ssize_t i; \
+  if (stride1 == sizeof(type) && stride2 == sizeof(type)) { \
+    if (NDARRAY_SCALAR_KIND(kind) != ndarray_scalar_float) { \
+      return memcmp(p1, p2, n * sizeof(type)) == 0; \
+    } \
+    const type *a = (const type *)p1, *b = (const type *)p2; \
+    for (i = 0; i < n; i += EQ_BLOCK_SIZE) { \
+      const ssize_t m = n - i < EQ_BLOCK_SIZE ? n - i : EQ_BLOCK_SIZE; \
+      int eq = 1; \
+      ssize_t j; \
+      for (j = 0; j < m; ++j) { \
+        eq &= a[i + j] == b[i + j]; \
+      } \
+      if (!eq) return 0; \
+    } \
+    return 1; \
+  } \
+  for (i = 0; i < n; ++i, p1 += stride1, p2 += stride2) { \
+    if (!(*(const type *)p1 == *(const type *)p2)) return 0; \
+  } \
+  return 1; \
+}
+
+NDARRAY_FOR_EACH_REAL_DTYPE(DEFINE_EQ_ROW_FUNC)
+
+#undef DEFINE_EQ_ROW_FUNC
+
+/* The items that are not compared by == of C are compared as loaded */
+#define DEFINE_EQ_ROW_FUNC_BY_LOAD(name, type, kind, load, num2type, type2num) \
+static int \
+ndarray_eq_row_##name(const uint8_t *p1, const ssize_t stride1, \
+                      const uint8_t *p2, const ssize_t stride2, const ssize_t n) \
+{ \
+  ssize_t i; \
+  for (i = 0; i < n; ++i, p1 += stride1, p2 += stride2) { \
+    if (!EQ_##kind(load(*(const type *)p1), load(*(const type *)p2))) return 0; \
+  } \
+  return 1; \
+}
+
+#define EQ_f64(x, y) ((x) == (y))
+#define EQ_c128(x, y) ((x).re == (y).re && (x).im == (y).im)
+
+NDARRAY_FOR_EACH_HALF_DTYPE(DEFINE_EQ_ROW_FUNC_BY_LOAD)
+NDARRAY_FOR_EACH_COMPLEX_DTYPE(DEFINE_EQ_ROW_FUNC_BY_LOAD)
+
+#undef EQ_f64
+#undef EQ_c128
+#undef DEFINE_EQ_ROW_FUNC_BY_LOAD
+
+typedef int (*ndarray_eq_row_func_t)(const uint8_t *, const ssize_t, const uint8_t *, const ssize_t, const ssize_t);
+
+#define EQ_ROW_FUNC_OF(name, type, kind, load, num2type, type2num) ndarray_eq_row_##name,
+
+static const ndarray_eq_row_func_t ndarray_eq_row_funcs[] = {
+  NULL,
+  NDARRAY_FOR_EACH_REAL_DTYPE(EQ_ROW_FUNC_OF)
+  NDARRAY_FOR_EACH_HALF_DTYPE(EQ_ROW_FUNC_OF)
+  NDARRAY_FOR_EACH_COMPLEX_DTYPE(EQ_ROW_FUNC_OF)
+  ndarray_eq_row_uint8, /* bool */
+  NULL, /* record */
+};
+
+#undef EQ_ROW_FUNC_OF
+
+typedef struct {
+  ndarray_dtype_t dtype1;
+  ndarray_dtype_t dtype2;
+  ssize_t item_size;
+} ndarray_eq_arg_t;
+
+static int
+ndarray_eq_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_eq_arg_t *eq_arg = arg;
+  return !ndarray_eq_row_funcs[eq_arg->dtype1](ptrs[0], strides[0], ptrs[1], strides[1], n);
+}
+
+static int
+ndarray_eq_mixed_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_eq_arg_t *eq_arg = arg;
+  const uint8_t *p1 = ptrs[0], *p2 = ptrs[1];
+  ndarray_scalar_t v1, v2;
+  const ndarray_load_scalar_func_t load1 = ndarray_load_scalar_funcs[eq_arg->dtype1];
+  const ndarray_load_scalar_func_t load2 = ndarray_load_scalar_funcs[eq_arg->dtype2];
+  ssize_t i;
+  for (i = 0; i < n; ++i, p1 += strides[0], p2 += strides[1]) {
+    load1(p1, &v1);
+    load2(p2, &v2);
+    if (!ndarray_scalar_eq(&v1, &v2))
+      return 1;
+  }
+  return 0;
+}
+
+/* Records are equal iff their bytes are equal */
+static int
+ndarray_eq_bytes_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_eq_arg_t *eq_arg = arg;
+  const uint8_t *p1 = ptrs[0], *p2 = ptrs[1];
+  ssize_t i;
+  for (i = 0; i < n; ++i, p1 += strides[0], p2 += strides[1]) {
+    if (memcmp(p1, p2, eq_arg->item_size) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+/* assume that the shapes of the both arrays are the same */
+static VALUE
+ndarray_eq_items(const ndarray_t *nar1, const ndarray_t *nar2)
+{
+  uint8_t *data[2] = { nar1->data, nar2->data };
+  const ssize_t *strides[2] = { nar1->strides, nar2->strides };
+  ndarray_eq_arg_t arg = { nar1->dtype, nar2->dtype, nar1->item_size };
+
+  ndarray_iter_kernel_t kernel = arg.dtype1 == arg.dtype2 ? ndarray_eq_kernel : ndarray_eq_mixed_kernel;
+  if (arg.dtype1 == ndarray_dtype_record || arg.dtype2 == ndarray_dtype_record) {
+    if (arg.dtype1 != arg.dtype2 || !RTEST(rb_str_equal(nar1->format, nar2->format)))
+      return Qfalse;
+    kernel = ndarray_eq_bytes_kernel;
+  }
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 2, data, strides, nar1->ndim, nar1->shape, 0);
+  const int stop = ndarray_iter_run_parallel(&it, kernel, &arg);
+  ndarray_iter_release(&it);
+
+  return stop ? Qfalse : Qtrue;
+}
+
+static VALUE
+ndarray_eq(VALUE obj, VALUE other)
+{
+  if (obj == other)
+    return Qtrue;
+  else if (!rb_typeddata_is_kind_of(other, &ndarray_data_type)) {
+    return Qfalse;
+  }
+
+  obj = ndarray_to_native(obj);
+  other = ndarray_to_native(other);
+
+  ndarray_t *nar1, *nar2;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar1);
+  TypedData_Get_Struct(other, ndarray_t, &ndarray_data_type, nar2);
+
+  const ssize_t ndim = nar1->ndim;
+  if (ndim != nar2->ndim)
+    return Qfalse;
+
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) {
+    if (nar1->shape[i] != nar2->shape[i])
+      return Qfalse;
+  }
+
+  const VALUE result = ndarray_eq_items(nar1, nar2);
+  RB_GC_GUARD(obj);
+  RB_GC_GUARD(other);
+  return result;
+}
+
+/* Approximate comparison */
+
+typedef struct {
+  ndarray_dtype_t dtype1;
+  ndarray_dtype_t dtype2;
+  double rtol;
+  double atol;
+  int equal_nan;
+} ndarray_close_arg_t;
+
+/* The same condition as numpy.isclose: |a - b| <= atol + rtol * |b| */
+static inline int
+ndarray_isclose(const double a, const double b, const ndarray_close_arg_t *arg)
+{
+  if (isnan(a) || isnan(b))
+    return arg->equal_nan && isnan(a) && isnan(b);
+  if (a == b)
+    return 1;
+  if (isinf(a) || isinf(b))
+    return 0;
+  return fabs(a - b) <= arg->atol + arg->rtol * fabs(b);
+}
+
+/* Complex numbers are compared by the absolute values as numpy.isclose */
+static inline int
+ndarray_isclose_complex(const ndarray_complex128_t a, const ndarray_complex128_t b, const ndarray_close_arg_t *arg)
+{
+  const int nan_a = isnan(a.re) || isnan(a.im), nan_b = isnan(b.re) || isnan(b.im);
+  if (nan_a || nan_b)
+    return arg->equal_nan && nan_a && nan_b;
+  if (a.re == b.re && a.im == b.im)
+    return 1;
+  if (isinf(a.re) || isinf(a.im) || isinf(b.re) || isinf(b.im))
+    return 0;
+  return hypot(a.re - b.re, a.im - b.im) <= arg->atol + arg->rtol * hypot(b.re, b.im);
+}
+
+static inline double
+ndarray_scalar_to_double(const ndarray_scalar_t *x)
+{
+  switch (x->kind) {
+    case ndarray_scalar_signed:
+      return (double)x->v.i;
+    case ndarray_scalar_unsigned:
+      return (double)x->v.u;
+    case ndarray_scalar_complex:
+      return x->v.c.re;
+    default:
+      return x->v.f;
+  }
+}
+
+static inline int
+ndarray_scalar_isclose(const ndarray_scalar_t *a, const ndarray_scalar_t *b, const ndarray_close_arg_t *arg)
+{
+  if (a->kind == ndarray_scalar_complex || b->kind == ndarray_scalar_complex) {
+    const ndarray_complex128_t za = a->kind == ndarray_scalar_complex ? a->v.c : (ndarray_complex128_t){ ndarray_scalar_to_double(a), 0.0 };
+    const ndarray_complex128_t zb = b->kind == ndarray_scalar_complex ? b->v.c : (ndarray_complex128_t){ ndarray_scalar_to_double(b), 0.0 };
+    return ndarray_isclose_complex(za, zb, arg);
+  }
+  return ndarray_isclose(ndarray_scalar_to_double(a), ndarray_scalar_to_double(b), arg);
+}
+
+#define DEFINE_CLOSE_ROW_FUNC(name, type, kind, load, num2type, type2num) \
+static int \
+ndarray_close_row_##name(const uint8_t *p1, const ssize_t stride1, \
+                         const uint8_t *p2, const ssize_t stride2, \
+                         const ssize_t n, const ndarray_close_arg_t *arg) \
+{ \
+  ssize_t i; \
+  for (i = 0; i < n; ++i, p1 += stride1, p2 += stride2) { \
+    if (!ndarray_isclose((double)load(*(const type *)p1), (double)load(*(const type *)p2), arg)) return 0; \
+  } \
+  return 1; \
+}
+
+NDARRAY_FOR_EACH_REAL_DTYPE(DEFINE_CLOSE_ROW_FUNC)
+NDARRAY_FOR_EACH_HALF_DTYPE(DEFINE_CLOSE_ROW_FUNC)
+
+#undef DEFINE_CLOSE_ROW_FUNC
+
+typedef int (*ndarray_close_row_func_t)(const uint8_t *, const ssize_t, const uint8_t *, const ssize_t,
+                                        const ssize_t, const ndarray_close_arg_t *);
+
+#define CLOSE_ROW_FUNC_OF(name, type, kind, load, num2type, type2num) ndarray_close_row_##name,
+
+static const ndarray_close_row_func_t ndarray_close_row_funcs[] = {
+  NULL,
+  NDARRAY_FOR_EACH_REAL_DTYPE(CLOSE_ROW_FUNC_OF)
+  NDARRAY_FOR_EACH_HALF_DTYPE(CLOSE_ROW_FUNC_OF)
+  NULL, /* complex64 and complex128 are compared by the mixed kernel */
+  NULL,
+  ndarray_close_row_uint8, /* bool */
+  NULL, /* record */
+};
+
+#undef CLOSE_ROW_FUNC_OF
+
+static int
+ndarray_close_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_close_arg_t *close_arg = arg;
+  return !ndarray_close_row_funcs[close_arg->dtype1](ptrs[0], strides[0], ptrs[1], strides[1], n, close_arg);
+}
+
+static int
+ndarray_close_mixed_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_close_arg_t *close_arg = arg;
+  const uint8_t *p1 = ptrs[0], *p2 = ptrs[1];
+  ndarray_scalar_t v1 = { 0 }, v2 = { 0 };
+  const ndarray_load_scalar_func_t load1 = ndarray_load_scalar_funcs[close_arg->dtype1];
+  const ndarray_load_scalar_func_t load2 = ndarray_load_scalar_funcs[close_arg->dtype2];
+  ssize_t i;
+  for (i = 0; i < n; ++i, p1 += strides[0], p2 += strides[1]) {
+    load1(p1, &v1);
+    load2(p2, &v2);
+    if (!ndarray_scalar_isclose(&v1, &v2, close_arg))
+      return 1;
+  }
+  return 0;
+}
+
+static void
+ndarray_check_same_shape(const ndarray_t *nar1, const ndarray_t *nar2)
+{
+  ssize_t i;
+  int same_p = nar1->ndim == nar2->ndim;
+  for (i = 0; same_p && i < nar1->ndim; ++i) {
+    same_p = nar1->shape[i] == nar2->shape[i];
+  }
+  if (!same_p) {
+    VALUE shape1 = rb_ary_new_capa(nar1->ndim), shape2 = rb_ary_new_capa(nar2->ndim);
+    for (i = 0; i < nar1->ndim; ++i) rb_ary_push(shape1, SSIZET2NUM(nar1->shape[i]));
+    for (i = 0; i < nar2->ndim; ++i) rb_ary_push(shape2, SSIZET2NUM(nar2->shape[i]));
+    rb_raise(rb_eArgError, "shape mismatch (%"PRIsVALUE" for %"PRIsVALUE")", shape2, shape1);
+  }
+}
+
+static VALUE
+ndarray_allclose_impl(VALUE obj, VALUE other, VALUE rtol, VALUE atol, VALUE equal_nan)
+{
+  obj = ndarray_to_native(obj);
+  other = ndarray_to_native(other);
+
+  ndarray_t *nar1, *nar2;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar1);
+  TypedData_Get_Struct(other, ndarray_t, &ndarray_data_type, nar2);
+
+  ndarray_check_same_shape(nar1, nar2);
+  ndarray_check_not_record(nar1, "allclose?");
+  ndarray_check_not_record(nar2, "allclose?");
+
+  ndarray_close_arg_t arg;
+  arg.dtype1 = nar1->dtype;
+  arg.dtype2 = nar2->dtype;
+  arg.rtol = NUM2DBL(rtol);
+  arg.atol = NUM2DBL(atol);
+  arg.equal_nan = RTEST(equal_nan);
+
+  uint8_t *data[2] = { nar1->data, nar2->data };
+  const ssize_t *strides[2] = { nar1->strides, nar2->strides };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 2, data, strides, nar1->ndim, nar1->shape, 0);
+  const int same_p = arg.dtype1 == arg.dtype2 && ndarray_close_row_funcs[arg.dtype1] != NULL;
+  const int stop = ndarray_iter_run_parallel(&it, same_p ? ndarray_close_kernel : ndarray_close_mixed_kernel, &arg);
+  ndarray_iter_release(&it);
+
+  RB_GC_GUARD(obj);
+  RB_GC_GUARD(other);
+  return stop ? Qfalse : Qtrue;
+}
+
+typedef struct {
+  ndarray_close_arg_t close;
+  int exact;
+  ssize_t limit;
+  /* the number of the items visited */
+  ssize_t count;
+  /* the mismatched items found */
+  ssize_t n_found;
+  ssize_t *found_indices;
+  const uint8_t **found_ptrs;
+} ndarray_mismatch_arg_t;
+
+static int
+ndarray_mismatch_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  ndarray_mismatch_arg_t *mismatch_arg = arg;
+  const uint8_t *p1 = ptrs[0], *p2 = ptrs[1];
+  ndarray_scalar_t v1 = { 0 }, v2 = { 0 };
+  const ndarray_load_scalar_func_t load1 = ndarray_load_scalar_funcs[mismatch_arg->close.dtype1];
+  const ndarray_load_scalar_func_t load2 = ndarray_load_scalar_funcs[mismatch_arg->close.dtype2];
+  ssize_t i;
+  for (i = 0; i < n; ++i, p1 += strides[0], p2 += strides[1]) {
+    load1(p1, &v1);
+    load2(p2, &v2);
+    const int same_p = mismatch_arg->exact ?
+      ndarray_scalar_eq(&v1, &v2) :
+      ndarray_scalar_isclose(&v1, &v2, &mismatch_arg->close);
+    if (!same_p) {
+      const ssize_t k = mismatch_arg->n_found++;
+      mismatch_arg->found_indices[k] = mismatch_arg->count + i;
+      mismatch_arg->found_ptrs[2*k] = p1;
+      mismatch_arg->found_ptrs[2*k + 1] = p2;
+      if (mismatch_arg->n_found == mismatch_arg->limit)
+        return 1;
+    }
+  }
+  mismatch_arg->count += n;
+  return 0;
+}
+
+/* Returns the first limit mismatched items in row-major order as the
+ * array of [index, item of obj, item of other].  The items are compared
+ * exactly as #== when both of rtol and atol are nil. */
+static VALUE
+ndarray_mismatch_impl(VALUE obj, VALUE other, VALUE limit_v, VALUE rtol, VALUE atol, VALUE equal_nan)
+{
+  obj = ndarray_to_native(obj);
+  other = ndarray_to_native(other);
+
+  ndarray_t *nar1, *nar2;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar1);
+  TypedData_Get_Struct(other, ndarray_t, &ndarray_data_type, nar2);
+
+  ndarray_check_same_shape(nar1, nar2);
+  ndarray_check_not_record(nar1, "mismatch");
+  ndarray_check_not_record(nar2, "mismatch");
+
+  const ssize_t limit = NUM2SSIZET(limit_v);
+  if (limit <= 0) {
+    rb_raise(rb_eArgError, "limit must be positive (%"PRIdSIZE" given)", limit);
+  }
+  const ssize_t n_items = ndarray_n_items(nar1);
+  const ssize_t capa = limit < n_items ? limit : n_items;
+
+  ndarray_mismatch_arg_t arg;
+  arg.close.dtype1 = nar1->dtype;
+  arg.close.dtype2 = nar2->dtype;
+  arg.exact = NIL_P(rtol) && NIL_P(atol);
+  arg.close.rtol = NIL_P(rtol) ? 0.0 : NUM2DBL(rtol);
+  arg.close.atol = NIL_P(atol) ? 0.0 : NUM2DBL(atol);
+  arg.close.equal_nan = RTEST(equal_nan);
+  arg.limit = limit;
+  arg.count = 0;
+  arg.n_found = 0;
+
+  VALUE indices_buf = 0, ptrs_buf = 0;
+  arg.found_indices = RB_ALLOCV_N(ssize_t, indices_buf, capa > 0 ? capa : 1);
+  arg.found_ptrs = RB_ALLOCV_N(const uint8_t *, ptrs_buf, capa > 0 ? 2 * capa : 1);
+
+  uint8_t *data[2] = { nar1->data, nar2->data };
+  const ssize_t *strides[2] = { nar1->strides, nar2->strides };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 2, data, strides, nar1->ndim, nar1->shape, NDARRAY_ITER_KEEP_ORDER);
+  ndarray_iter_run(&it, ndarray_mismatch_kernel, &arg);
+  ndarray_iter_release(&it);
+
+  VALUE result = rb_ary_new_capa(arg.n_found);
+  ssize_t k, i;
+  for (k = 0; k < arg.n_found; ++k) {
+    VALUE index = rb_ary_new_capa(nar1->ndim);
+    ssize_t flat = arg.found_indices[k];
+    for (i = nar1->ndim - 1; i >= 0; --i) {
+      rb_ary_store(index, i, SSIZET2NUM(flat % nar1->shape[i]));
+      flat /= nar1->shape[i];
+    }
+    rb_ary_push(result, rb_ary_new_from_args(3, index,
+                                             ndarray_get_value(arg.found_ptrs[2*k], nar1->dtype),
+                                             ndarray_get_value(arg.found_ptrs[2*k + 1], nar2->dtype)));
+  }
+
+  RB_ALLOCV_END(ptrs_buf);
+  RB_ALLOCV_END(indices_buf);
+
+  RB_GC_GUARD(obj);
+  RB_GC_GUARD(other);
+  return result;
+}
+
+/* Bulk access */
+
+typedef struct {
+  ssize_t item_size;
+  const uint8_t *value;
+} ndarray_fill_arg_t;
+
+static int
+ndarray_fill_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_fill_arg_t *fill_arg = arg;
+  uint8_t *p = ptrs[0];
+  const ssize_t stride = strides[0];
+  ssize_t i;
+
+#define STRIDED_FILL(type) do { \
+    const type v = *(const type *)fill_arg->value; \
+    for (i = 0; i < n; ++i, p += stride) *(type *)p = v; \
+  } while (0)
+
+  switch (fill_arg->item_size) {
+    case 1: STRIDED_FILL(uint8_t); break;
+    case 2: STRIDED_FILL(uint16_t); break;
+    case 4: STRIDED_FILL(uint32_t); break;
+    case 8: STRIDED_FILL(uint64_t); break;
+    default:
+      for (i = 0; i < n; ++i, p += stride) memcpy(p, fill_arg->value, fill_arg->item_size);
+      break;
+  }
+
+#undef STRIDED_FILL
+
+  return 0;
+}
+
+/* Copy the item at value to all the items of nar */
+static void
+ndarray_fill_items(const ndarray_t *nar, const uint8_t *value)
+{
+  ndarray_fill_arg_t arg;
+  arg.item_size = nar->item_size;
+  arg.value = value;
+
+  uint8_t *data[1] = { nar->data };
+  const ssize_t *strides[1] = { nar->strides };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 1, data, strides, nar->ndim, nar->shape, 0);
+  ndarray_iter_run_parallel(&it, ndarray_fill_kernel, &arg);
+  ndarray_iter_release(&it);
+}
+
+static VALUE
+ndarray_fill(VALUE obj, VALUE val)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  rb_check_frozen(obj);
+
+  /* convert the value only once */
+  VALUE heap_buf = 0;
+  uint8_t *value = RB_ALLOCV_N(uint8_t, heap_buf, nar->item_size);
+  MEMZERO(value, uint8_t, nar->item_size);
+  ndarray_set_item(nar, value, val);
+
+  ndarray_fill_items(nar, value);
+
+  RB_ALLOCV_END(heap_buf);
+  return obj;
+}
+
+static VALUE
+ndarray_to_a_recursive(const ndarray_t *nar, const ssize_t dim, const uint8_t *p)
+{
+  const ssize_t n = nar->shape[dim];
+  const ssize_t stride = nar->strides[dim];
+  VALUE ary = rb_ary_new_capa(n);
+  ssize_t i;
+
+  if (dim == nar->ndim - 1) {
+    for (i = 0; i < n; ++i, p += stride) {
+      rb_ary_push(ary, ndarray_get_item(nar, p));
+    }
+  }
+  else {
+    for (i = 0; i < n; ++i, p += stride) {
+      rb_ary_push(ary, ndarray_to_a_recursive(nar, dim + 1, p));
+    }
+  }
+
+  return ary;
+}
+
+static VALUE
+ndarray_to_a(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  /* a 0-D array has its only item as x[] does */
+  if (nar->ndim == 0) {
+    return ndarray_get_item(nar, nar->data);
+  }
+  return ndarray_to_a_recursive(nar, 0, nar->data);
+}
+
+/* :auto means column-major if nar is column-major contiguous only */
+static ndarray_order_t
+ndarray_resolve_order(const ndarray_t *nar, const ndarray_order_t order)
+{
+  if (order != ndarray_order_auto) {
+    return order;
+  }
+  return (ndarray_is_column_major_contiguous(nar) && !ndarray_is_row_major_contiguous(nar)) ?
+    ndarray_order_column_major : ndarray_order_row_major;
+}
+
+static VALUE
+ndarray_to_binary_impl(VALUE obj, VALUE order_v)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  const ndarray_order_t order = ndarray_resolve_order(nar, ndarray_obj_to_order_t(order_v));
+
+  const ssize_t ndim = nar->ndim;
+  const ssize_t item_size = nar->item_size;
+  VALUE str = rb_str_new(NULL, ndarray_n_items(nar) * item_size);
+
+  ssize_t inline_strides_buf[MAX_INLINE_DIM];
+  ssize_t *strides = inline_strides_buf;
+
+  VALUE heap_strides_buf = 0;
+  if (ndim > MAX_INLINE_DIM) {
+    strides = RB_ALLOCV_N(ssize_t, heap_strides_buf, ndim);
+  }
+
+  if (order == ndarray_order_row_major) {
+    ndarray_init_row_major_strides(item_size, ndim, nar->shape, strides);
+  }
+  else {
+    ndarray_init_column_major_strides(item_size, ndim, nar->shape, strides);
+  }
+
+  ndarray_strided_copy((uint8_t *)RSTRING_PTR(str), strides, nar->data, nar->strides,
+                       ndim, nar->shape, item_size);
+
+  RB_ALLOCV_END(heap_strides_buf);
+  return str;
+}
+
+static VALUE
+ndarray_s_from_binary_impl(VALUE klass, VALUE str, VALUE shape_ary, VALUE dtype_name, VALUE order, VALUE alignment,
+                           VALUE format, VALUE byte_order)
+{
+  StringValue(str);
+
+  VALUE obj = ndarray_s_allocate(klass);
+  ndarray_initialize_impl(obj, shape_ary, dtype_name, order, alignment, format, byte_order);
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (RSTRING_LEN(str) != nar->byte_size) {
+    rb_raise(rb_eArgError, "byte size mismatched (%ld for %"PRIdSIZE")", RSTRING_LEN(str), nar->byte_size);
+  }
+  memcpy(nar->data, RSTRING_PTR(str), nar->byte_size);
+
+  return obj;
+}
+
+static void
+check_order(VALUE order)
+{
+  if (order != sym_row_major && order != sym_column_major && order != sym_auto) {
+    rb_raise(rb_eArgError,
+             "order must be either :row_major, :column_major, or :auto (%"PRIsVALUE" given)",
+             order);
+  }
+}
+
+/* Set the shape, the contiguous strides, and the data buffer to nar whose
+ * dtype has been set */
+static void
+ndarray_init_contiguous(ndarray_t *nar, const ssize_t ndim, const ssize_t *shape, const ndarray_order_t order)
+{
+  ssize_t byte_size = nar->item_size;
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) {
+    byte_size *= shape[i];
+  }
+
+  ndarray_alloc_dims(nar, ndim);
+  MEMCPY(nar->shape, shape, ssize_t, ndim);
+
+  if (order == ndarray_order_column_major) {
+    ndarray_init_column_major_strides(nar->item_size, ndim, nar->shape, nar->strides);
+  }
+  else {
+    ndarray_init_row_major_strides(nar->item_size, ndim, nar->shape, nar->strides);
+  }
+
+  ndarray_alloc_data(nar, byte_size, NDARRAY_DEFAULT_ALIGNMENT);
+}
+
+/* Make a new array of the given dtype and shape that has the data buffer
+ * of the contiguous layout of the given order.  The items are not
+ * initialized. */
+static VALUE
+ndarray_new_contiguous(VALUE klass, const ndarray_dtype_t dtype, const ssize_t ndim, const ssize_t *shape,
+                       const ndarray_order_t order)
+{
+  VALUE obj = ndarray_s_allocate(klass);
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  ndarray_set_dtype(nar, dtype, Qnil);
+  ndarray_init_contiguous(nar, ndim, shape, order);
+
+  return obj;
+}
+
+/* Set the copy of the items of nar in the contiguous layout of the given
+ * order to nar_copy that is not initialized */
+static void
+ndarray_init_copy(ndarray_t *nar_copy, const ndarray_t *nar, const ndarray_order_t order)
+{
+  ndarray_copy_dtype(nar_copy, nar);
+  ndarray_init_contiguous(nar_copy, nar->ndim, nar->shape, order);
+
+  ndarray_strided_copy(nar_copy->data, nar_copy->strides, nar->data, nar->strides,
+                       nar->ndim, nar->shape, nar->item_size);
+}
+
+/* Make a new array that has the copy of the items of nar in the
+ * contiguous layout of the given order */
+static VALUE
+ndarray_copy_contiguous(VALUE klass, const ndarray_t *nar, const ndarray_order_t order)
+{
+  VALUE obj = ndarray_s_allocate(klass);
+
+  ndarray_t *nar_copy;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar_copy);
+
+  ndarray_init_copy(nar_copy, nar, order);
+
+  return obj;
+}
+
+/* Contiguous copies
+ *
+ * contiguous? tells whether the items are contiguous in the given order,
+ * or in either order for :auto.  to_row_major and to_column_major return
+ * the receiver if it is contiguous in the order, and the copy otherwise.
+ * dup and clone always copy, to the given order or the order of the
+ * receiver.  The copies keep the byte order. */
+
+static int
+ndarray_is_contiguous_in(const ndarray_t *nar, const ndarray_order_t order)
+{
+  switch (order) {
+    case ndarray_order_row_major:
+      return ndarray_is_row_major_contiguous(nar);
+    case ndarray_order_column_major:
+      return ndarray_is_column_major_contiguous(nar);
+    default:
+      return ndarray_is_row_major_contiguous(nar) || ndarray_is_column_major_contiguous(nar);
+  }
+}
+
+static VALUE
+ndarray_is_contiguous(int argc, VALUE *argv, VALUE obj)
+{
+  VALUE order_v;
+  rb_scan_args(argc, argv, "01", &order_v);
+  const ndarray_order_t order = NIL_P(order_v) ? ndarray_order_row_major : ndarray_obj_to_order_t(order_v);
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  return ndarray_is_contiguous_in(nar, order) ? Qtrue : Qfalse;
+}
+
+static VALUE
+ndarray_to_contiguous(VALUE obj, const ndarray_order_t order)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (ndarray_is_contiguous_in(nar, order)) {
+    return obj;
+  }
+  return ndarray_copy_contiguous(rb_obj_class(obj), nar, order);
+}
+
+static VALUE
+ndarray_to_row_major(VALUE obj)
+{
+  return ndarray_to_contiguous(obj, ndarray_order_row_major);
+}
+
+static VALUE
+ndarray_to_column_major(VALUE obj)
+{
+  return ndarray_to_contiguous(obj, ndarray_order_column_major);
+}
+
+static VALUE
+ndarray_copy_impl(VALUE obj, VALUE order_v)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  const ndarray_order_t order = ndarray_resolve_order(nar, ndarray_obj_to_order_t(order_v));
+  return ndarray_copy_contiguous(rb_obj_class(obj), nar, order);
+}
+
+static VALUE
+ndarray_initialize_copy(VALUE obj, VALUE orig)
+{
+  if (obj == orig) {
+    return obj;
+  }
+  rb_check_frozen(obj);
+
+  ndarray_t *nar, *nar_orig;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+  TypedData_Get_Struct(orig, ndarray_t, &ndarray_data_type, nar_orig);
+
+  if (nar->data != NULL || nar->base) {
+    rb_raise(rb_eTypeError, "already initialized array");
+  }
+  ndarray_init_copy(nar, nar_orig, ndarray_resolve_order(nar_orig, ndarray_order_auto));
+
+  return obj;
+}
+
+/* Returns obj if its items are in the native byte order, or the copy of
+ * obj in the native byte order otherwise */
+static VALUE
+ndarray_to_native(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (!nar->swapped_p) {
+    return obj;
+  }
+
+  VALUE copy = ndarray_s_allocate(rb_obj_class(obj));
+  ndarray_t *nar_copy;
+  TypedData_Get_Struct(copy, ndarray_t, &ndarray_data_type, nar_copy);
+
+  ndarray_copy_dtype(nar_copy, nar);
+  nar_copy->swapped_p = false;
+  ndarray_init_contiguous(nar_copy, nar->ndim, nar->shape, ndarray_resolve_order(nar, ndarray_order_auto));
+
+  ndarray_byteswap_copy(nar_copy->data, nar_copy->strides, nar->data, nar->strides,
+                        nar->ndim, nar->shape, nar->dtype);
+
+  return copy;
+}
+
+static VALUE
+ndarray_get_byte_order(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (nar->dtype == ndarray_dtype_record) {
+    return Qnil;
+  }
+#ifdef WORDS_BIGENDIAN
+  return nar->swapped_p ? sym_little : sym_big;
+#else
+  return nar->swapped_p ? sym_big : sym_little;
+#endif
+}
+
+/* Swap the bytes of the items in place.  The byte order is kept, so the
+ * values change. */
+static VALUE
+ndarray_byteswap_bang(VALUE obj)
+{
+  rb_check_frozen(obj);
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+  ndarray_check_not_record(nar, "byteswap!");
+
+  if (nar->item_size > 1) {
+    ndarray_byteswap_copy(nar->data, nar->strides, nar->data, nar->strides,
+                          nar->ndim, nar->shape, nar->dtype);
+  }
+
+  return obj;
+}
+
+/* Make a view that reads the items in the given byte order, :swap by
+ * default.  The bytes are kept, so the values change. */
+static VALUE
+ndarray_newbyteorder(int argc, VALUE *argv, VALUE obj)
+{
+  VALUE byte_order;
+  rb_scan_args(argc, argv, "01", &byte_order);
+  if (NIL_P(byte_order)) {
+    byte_order = sym_swap;
+  }
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+  ndarray_check_not_record(nar, "newbyteorder");
+
+  VALUE view = ndarray_new_view(obj, nar, nar->data, nar->ndim);
+  ndarray_t *nar_view;
+  TypedData_Get_Struct(view, ndarray_t, &ndarray_data_type, nar_view);
+
+  MEMCPY(nar_view->shape, nar->shape, ssize_t, nar->ndim);
+  MEMCPY(nar_view->strides, nar->strides, ssize_t, nar->ndim);
+  nar_view->byte_size = nar->byte_size;
+  ndarray_set_byte_order(nar_view, byte_order, true);
+
+  return view;
+}
+
+/* Try to compute the strides of the array of new_shape that is a view of
+ * nar, in the same manner as numpy's _attempt_nocopy_reshape.  The items
+ * are taken in row-major (or column-major) order from nar and put in the
+ * same order to the view.  Returns 0 if the view cannot be made. */
+static int
+ndarray_attempt_nocopy_reshape(const ndarray_t *nar, const ssize_t new_ndim, const ssize_t *new_shape,
+                               const int column_major_p, ssize_t *new_strides)
+{
+  const ssize_t ndim = nar->ndim;
+
+  VALUE heap_buf = 0;
+  ssize_t *old_shape = RB_ALLOCV_N(ssize_t, heap_buf, 2 * (ndim > 0 ? ndim : 1));
+  ssize_t *old_strides = old_shape + ndim;
+
+  /* remove axes of size 1, whose strides do not matter */
+  ssize_t old_ndim = 0;
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) {
+    if (nar->shape[i] != 1) {
+      old_shape[old_ndim] = nar->shape[i];
+      old_strides[old_ndim] = nar->strides[i];
+      ++old_ndim;
+    }
+  }
+
+  /* [oi, oj) and [ni, nj) are the axis ranges currently worked with */
+  ssize_t oi = 0, oj = 1, ni = 0, nj = 1, k;
+  while (ni < new_ndim && oi < old_ndim) {
+    ssize_t np = new_shape[ni];
+    ssize_t op = old_shape[oi];
+
+    while (np != op) {
+      if (np < op) {
+        np *= new_shape[nj++];
+      }
+      else {
+        op *= old_shape[oj++];
+      }
+    }
+
+    /* check whether the original axes can be combined */
+    for (k = oi; k < oj - 1; ++k) {
+      if (column_major_p) {
+        if (old_strides[k + 1] != old_shape[k] * old_strides[k]) {
+          RB_ALLOCV_END(heap_buf);
+          return 0;
+        }
+      }
+      else {
+        if (old_strides[k] != old_shape[k + 1] * old_strides[k + 1]) {
+          RB_ALLOCV_END(heap_buf);
+          return 0;
+        }
+      }
+    }
+
+    /* calculate new strides for all axes currently worked with */
+    if (column_major_p) {
+      new_strides[ni] = old_strides[oi];
+      for (k = ni + 1; k < nj; ++k) {
+        new_strides[k] = new_strides[k - 1] * new_shape[k - 1];
+      }
+    }
+    else {
+      new_strides[nj - 1] = old_strides[oj - 1];
+      for (k = nj - 1; k > ni; --k) {
+        new_strides[k - 1] = new_strides[k] * new_shape[k];
+      }
+    }
+
+    ni = nj++;
+    oi = oj++;
+  }
+
+  /* set strides corresponding to trailing 1s of the new shape */
+  ssize_t last_stride = nar->item_size;
+  if (ni >= 1) {
+    last_stride = new_strides[ni - 1];
+    if (column_major_p) {
+      last_stride *= new_shape[ni - 1];
+    }
+  }
+  for (k = ni; k < new_ndim; ++k) {
+    new_strides[k] = last_stride;
+  }
+
+  RB_ALLOCV_END(heap_buf);
+  return 1;
+}
+
+static VALUE
+ndarray_reshape_impl(VALUE base, VALUE new_shape_v, VALUE order)
+{
+  enum {
+    nothing,
+    zero_or_negative_size_in_shape,
+    incompatible_new_shape,
+  } failure_reason = nothing;
+
+  ndarray_t *nar_base;
+  TypedData_Get_Struct(base, ndarray_t, &ndarray_data_type, nar_base);
+
+  Check_Type(new_shape_v, T_ARRAY);
+  check_order(order);
+
+  VALUE view = Qnil;
+  int column_major_p;
+  if (order == sym_auto) {
+    column_major_p = ndarray_is_column_major_contiguous(nar_base) && !ndarray_is_row_major_contiguous(nar_base);
+  }
+  else {
+    column_major_p = order == sym_column_major;
+  }
+
+  const ssize_t new_ndim = RARRAY_LEN(new_shape_v);
+
+  /* preparing the buffer for new_shape and new_strides */
+
+  ssize_t inline_buf[2 * MAX_INLINE_DIM] = { 0, };
+  ssize_t *new_shape = inline_buf;
+
+  VALUE heap_buf = 0;
+  if (new_ndim > MAX_INLINE_DIM) {
+    new_shape = RB_ALLOCV_N(ssize_t, heap_buf, 2 * new_ndim);
+  }
+  ssize_t *new_strides = new_shape + (new_ndim > MAX_INLINE_DIM ? new_ndim : MAX_INLINE_DIM);
+
+  /* extracting new_shape */
+
+  ssize_t n_items = 1;
+  ssize_t i;
+  for (i = 0; i < new_ndim; ++i) {
+    ssize_t dim_size = NUM2SSIZET(RARRAY_AREF(new_shape_v, i));
+    if (dim_size <= 0) {
+      failure_reason = zero_or_negative_size_in_shape;
+      goto finish;
+    }
+    new_shape[i] = dim_size;
+    n_items *= dim_size;
+  }
+
+  if (n_items != ndarray_n_items(nar_base)) {
+    failure_reason = incompatible_new_shape;
+    goto finish;
+  }
+
+  if (ndarray_attempt_nocopy_reshape(nar_base, new_ndim, new_shape, column_major_p, new_strides)) {
+    view = ndarray_new_view(base, nar_base, nar_base->data, new_ndim);
+  }
+  else {
+    /* the items cannot be traversed by strides, so reshape a copy */
+    const ndarray_order_t copy_order = column_major_p ? ndarray_order_column_major : ndarray_order_row_major;
+    VALUE copy = ndarray_copy_contiguous(CLASS_OF(base), nar_base, copy_order);
+
+    ndarray_t *nar_copy;
+    TypedData_Get_Struct(copy, ndarray_t, &ndarray_data_type, nar_copy);
+
+    if (column_major_p) {
+      ndarray_init_column_major_strides(nar_copy->item_size, new_ndim, new_shape, new_strides);
+    }
+    else {
+      ndarray_init_row_major_strides(nar_copy->item_size, new_ndim, new_shape, new_strides);
+    }
+
+    view = ndarray_new_view(copy, nar_copy, nar_copy->data, new_ndim);
+  }
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(view, ndarray_t, &ndarray_data_type, nar);
+
+  MEMCPY(nar->shape, new_shape, ssize_t, new_ndim);
+  MEMCPY(nar->strides, new_strides, ssize_t, new_ndim);
+  ndarray_view_update_byte_size(nar);
+
+finish:
+  RB_ALLOCV_END(heap_buf);
+
+  switch (failure_reason) {
+    case zero_or_negative_size_in_shape:
+      rb_raise(rb_eArgError, "zero or negative size is given in new_shape");
+
+    case incompatible_new_shape:
+      rb_raise(rb_eArgError,
+               "new_shape is incompatible with the base shape (%"PRIsVALUE" for %"PRIsVALUE")",
+               new_shape_v, ndarray_get_shape(base));
+
+    default:
+      break;
+  }
+
+  return view;
+}
+
+/* Casting
+ *
+ * The items are converted by the row function of each pair of the source
+ * and the destination dtypes.  The source items are loaded as int64_t,
+ * uint64_t, double, or ndarray_complex128_t according to their kind, and
+ * stored by the conversion function of the destination dtype.  float16
+ * and bfloat16 are loaded as double, and bool as uint64_t.
+ *
+ * In the unchecked mode, integers are truncated to the width of the
+ * destination, floats are saturated at the range of the destination
+ * integer type (NaN becomes 0), the imaginary parts are dropped for the
+ * real destinations, and the conversions to floats follow C.  In the
+ * checked mode, the conversion fails for the values that the item setter
+ * rejects: the integers and the truncated floats out of the range of the
+ * destination, NaNs to integers, the values beyond FLT_MAX to float32 and
+ * complex64, the values overflowing float16 and bfloat16, and the complex
+ * numbers with nonzero imaginary parts to the real destinations.  Any
+ * value can be converted to bool, where nonzero values become true. */
+
+#define DEFINE_INT_CAST_FUNCS(dname, dtype, dmin, dmax, dupper) \
+static inline int \
+ndarray_cast_i64_to_##dname(const int64_t v, dtype *out, const int checked) \
+{ \
+  if (checked && (v < (int64_t)(dmin) || (v > 0 && (uint64_t)v > (uint64_t)(dmax)))) return 0; \
+  *out = (dtype)v; \
+  return 1; \
+} \
+static inline int \
+ndarray_cast_u64_to_##dname(const uint64_t v, dtype *out, const int checked) \
+{ \
+  if (checked && v > (uint64_t)(dmax)) return 0; \
+  *out = (dtype)v; \
+  return 1; \
+} \
+static inline int \
+ndarray_cast_f64_to_##dname(const double v, dtype *out, const int checked) \
+{ \
+  const double t = trunc(v); \
+  if ((double)(dmin) <= t && t < (dupper)) { \
+    *out = (dtype)t; \
+    return 1; \
+  } \
+  if (checked) return 0; \
+  *out = isnan(v) ? 0 : (v < 0 ? (dmin) : (dmax)); \
+  return 1; \
+} \
+static inline int \
+ndarray_cast_c128_to_##dname(const ndarray_complex128_t v, dtype *out, const int checked) \
+{ \
+  if (checked && v.im != 0.0) return 0; \
+  return ndarray_cast_f64_to_##dname(v.re, out, checked); \
+}
+
+DEFINE_INT_CAST_FUNCS(int8, int8_t, INT8_MIN, INT8_MAX, 128.0)
+DEFINE_INT_CAST_FUNCS(uint8, uint8_t, 0, UINT8_MAX, 256.0)
+DEFINE_INT_CAST_FUNCS(int16, int16_t, INT16_MIN, INT16_MAX, 32768.0)
+DEFINE_INT_CAST_FUNCS(uint16, uint16_t, 0, UINT16_MAX, 65536.0)
+DEFINE_INT_CAST_FUNCS(int32, int32_t, INT32_MIN, INT32_MAX, 2147483648.0)
+DEFINE_INT_CAST_FUNCS(uint32, uint32_t, 0, UINT32_MAX, 4294967296.0)
+DEFINE_INT_CAST_FUNCS(int64, int64_t, INT64_MIN, INT64_MAX, 9223372036854775808.0)
+DEFINE_INT_CAST_FUNCS(uint64, uint64_t, 0, UINT64_MAX, 18446744073709551616.0)
+
+#undef DEFINE_INT_CAST_FUNCS
+
+#define DEFINE_FLOAT_CAST_FUNCS(dname, dtype, range_check) \
+static inline int \
+ndarray_cast_i64_to_##dname(const int64_t v, dtype *out, const int checked) \
+{ \
+  *out = (dtype)v; \
+  return 1; \
+} \
+static inline int \
+ndarray_cast_u64_to_##dname(const uint64_t v, dtype *out, const int checked) \
+{ \
+  *out = (dtype)v; \
+  return 1; \
+} \
+static inline int \
+ndarray_cast_f64_to_##dname(const double v, dtype *out, const int checked) \
+{ \
+  if (checked && (range_check) && (v < -FLT_MAX || FLT_MAX < v)) return 0; \
+  *out = (dtype)v; \
+  return 1; \
+} \
+static inline int \
+ndarray_cast_c128_to_##dname(const ndarray_complex128_t v, dtype *out, const int checked) \
+{ \
+  if (checked && v.im != 0.0) return 0; \
+  return ndarray_cast_f64_to_##dname(v.re, out, checked); \
+}
+
+DEFINE_FLOAT_CAST_FUNCS(float32, float, 1)
+DEFINE_FLOAT_CAST_FUNCS(float64, double, 0)
+
+#undef DEFINE_FLOAT_CAST_FUNCS
+
+/* The values are rounded to float to odd first, and fail in the checked
+ * mode if the finite values become infinite */
+#define DEFINE_HALF_CAST_FUNCS(dname, dtype, from_float) \
+static inline int \
+ndarray_cast_f64_to_##dname(const double v, dtype *out, const int checked) \
+{ \
+  const dtype h = from_float(double_to_float_odd(v)); \
+  if (checked && isfinite(v) && (h & 0x7fff) == (from_float(INFINITY) & 0x7fff)) return 0; \
+  *out = h; \
+  return 1; \
+} \
+static inline int \
+ndarray_cast_i64_to_##dname(const int64_t v, dtype *out, const int checked) \
+{ \
+  return ndarray_cast_f64_to_##dname((double)v, out, checked); \
+} \
+static inline int \
+ndarray_cast_u64_to_##dname(const uint64_t v, dtype *out, const int checked) \
+{ \
+  return ndarray_cast_f64_to_##dname((double)v, out, checked); \
+} \
+static inline int \
+ndarray_cast_c128_to_##dname(const ndarray_complex128_t v, dtype *out, const int checked) \
+{ \
+  if (checked && v.im != 0.0) return 0; \
+  return ndarray_cast_f64_to_##dname(v.re, out, checked); \
+}
+
+DEFINE_HALF_CAST_FUNCS(float16, ndarray_float16_t, float_to_float16)
+DEFINE_HALF_CAST_FUNCS(bfloat16, ndarray_bfloat16_t, float_to_bfloat16)
+
+#undef DEFINE_HALF_CAST_FUNCS
+
+#define DEFINE_COMPLEX_CAST_FUNCS(dname, dtype, ctype, range_check) \
+static inline int \
+ndarray_cast_c128_to_##dname(const ndarray_complex128_t v, dtype *out, const int checked) \
+{ \
+  if (checked && (range_check) && \
+      (v.re < -FLT_MAX || FLT_MAX < v.re || v.im < -FLT_MAX || FLT_MAX < v.im)) return 0; \
+  out->re = (ctype)v.re; \
+  out->im = (ctype)v.im; \
+  return 1; \
+} \
+static inline int \
+ndarray_cast_f64_to_##dname(const double v, dtype *out, const int checked) \
+{ \
+  return ndarray_cast_c128_to_##dname((ndarray_complex128_t){ v, 0.0 }, out, checked); \
+} \
+static inline int \
+ndarray_cast_i64_to_##dname(const int64_t v, dtype *out, const int checked) \
+{ \
+  out->re = (ctype)v; \
+  out->im = 0; \
+  return 1; \
+} \
+static inline int \
+ndarray_cast_u64_to_##dname(const uint64_t v, dtype *out, const int checked) \
+{ \
+  out->re = (ctype)v; \
+  out->im = 0; \
+  return 1; \
+}
+
+DEFINE_COMPLEX_CAST_FUNCS(complex64, ndarray_complex64_t, float, 1)
+DEFINE_COMPLEX_CAST_FUNCS(complex128, ndarray_complex128_t, double, 0)
+
+#undef DEFINE_COMPLEX_CAST_FUNCS
+
+/* named boolean as bool is a macro of stdbool.h */
+static inline int
+ndarray_cast_i64_to_boolean(const int64_t v, uint8_t *out, const int checked)
+{
+  *out = v != 0;
+  return 1;
+}
+
+static inline int
+ndarray_cast_u64_to_boolean(const uint64_t v, uint8_t *out, const int checked)
+{
+  *out = v != 0;
+  return 1;
+}
+
+static inline int
+ndarray_cast_f64_to_boolean(const double v, uint8_t *out, const int checked)
+{
+  *out = v != 0.0;
+  return 1;
+}
+
+static inline int
+ndarray_cast_c128_to_boolean(const ndarray_complex128_t v, uint8_t *out, const int checked)
+{
+  *out = v.re != 0.0 || v.im != 0.0;
+  return 1;
+}
+
+typedef int (*ndarray_cast_row_func_t)(const uint8_t *src, const ssize_t src_stride,
+                                       uint8_t *dst, const ssize_t dst_stride,
+                                       const ssize_t n, const int checked);
+
+/* The contiguous loops are written separately so that they are
+ * vectorized, and the checked flag is hoisted out of the loops. */
+#define CAST_ROW_LOOP(skind, stype, load, dname, dtype, checked) do { \
+    if (src_stride == sizeof(stype) && dst_stride == sizeof(dtype)) { \
+      const stype *s = (const stype *)src; \
+      dtype *d = (dtype *)dst; \
+      for (i = 0; i < n; ++i) { \
+        if (!ndarray_cast_##skind##_to_##dname(load(s[i]), &d[i], checked)) return 1; \
+      } \
+    } \
+    else { \
+      for (i = 0; i < n; ++i, src += src_stride, dst += dst_stride) { \
+        if (!ndarray_cast_##skind##_to_##dname(load(*(const stype *)src), (dtype *)dst, checked)) return 1; \
+      } \
+    } \
+  } while (0)
+
+#define DEFINE_CAST_ROW_FUNC(prefix, stype, skind, load, dname, dtype) \
+static int \
+prefix##_to_##dname(const uint8_t *src, const ssize_t src_stride, \
+                    uint8_t *dst, const ssize_t dst_stride, \
+                    const ssize_t n, const int checked) \
+{ \
+  ssize_t i; \
+  if (checked) \
+    CAST_ROW_LOOP(skind, stype, load, dname, dtype, 1); \
+  else \
+    CAST_ROW_LOOP(skind, stype, load, dname, dtype, 0); \
+  return 0; \
+}
+
+/* The destinations are listed here as NDARRAY_FOR_EACH_DTYPE cannot be
+ * expanded in itself, and the name of the source is pasted to the prefix
+ * before it is passed to DEFINE_CAST_ROW_FUNC. */
+#define DEFINE_CAST_ROW_FUNCS_FROM(sname, stype, skind, load, num2type, type2num) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, int8, int8_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, uint8, uint8_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, int16, int16_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, uint16, uint16_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, int32, int32_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, uint32, uint32_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, int64, int64_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, uint64, uint64_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, float32, float) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, float64, double) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, float16, ndarray_float16_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, bfloat16, ndarray_bfloat16_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, complex64, ndarray_complex64_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, complex128, ndarray_complex128_t) \
+  DEFINE_CAST_ROW_FUNC(ndarray_cast_row_##sname, stype, skind, load, boolean, uint8_t)
+
+NDARRAY_FOR_EACH_DTYPE(DEFINE_CAST_ROW_FUNCS_FROM)
+
+#undef DEFINE_CAST_ROW_FUNCS_FROM
+#undef DEFINE_CAST_ROW_FUNC
+#undef CAST_ROW_LOOP
+
+#define CAST_ROW_FUNCS_FROM(sname, stype, skind, load, num2type, type2num) { \
+    NULL, \
+    ndarray_cast_row_##sname##_to_int8, \
+    ndarray_cast_row_##sname##_to_uint8, \
+    ndarray_cast_row_##sname##_to_int16, \
+    ndarray_cast_row_##sname##_to_uint16, \
+    ndarray_cast_row_##sname##_to_int32, \
+    ndarray_cast_row_##sname##_to_uint32, \
+    ndarray_cast_row_##sname##_to_int64, \
+    ndarray_cast_row_##sname##_to_uint64, \
+    ndarray_cast_row_##sname##_to_float32, \
+    ndarray_cast_row_##sname##_to_float64, \
+    ndarray_cast_row_##sname##_to_float16, \
+    ndarray_cast_row_##sname##_to_bfloat16, \
+    ndarray_cast_row_##sname##_to_complex64, \
+    ndarray_cast_row_##sname##_to_complex128, \
+    ndarray_cast_row_##sname##_to_boolean, \
+    NULL, /* record */ \
+  },
+
+/* indexed by [source dtype][destination dtype] */
+static const ndarray_cast_row_func_t ndarray_cast_row_funcs[][NDARRAY_NUM_DTYPES] = {
+  { NULL, },
+  NDARRAY_FOR_EACH_DTYPE(CAST_ROW_FUNCS_FROM)
+  { NULL, }, /* record */
+};
+
+#undef CAST_ROW_FUNCS_FROM
+
+typedef struct {
+  ndarray_cast_row_func_t func;
+  int checked;
+  /* the source item that cannot be converted, found by ndarray_cast_find_kernel */
+  const uint8_t *failed_ptr;
+} ndarray_cast_arg_t;
+
+/* ptrs[0] is the destination, and ptrs[1] is the source */
+static int
+ndarray_cast_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_cast_arg_t *cast_arg = arg;
+  return cast_arg->func(ptrs[1], strides[1], ptrs[0], strides[0], n, cast_arg->checked);
+}
+
+static int
+ndarray_cast_find_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  ndarray_cast_arg_t *cast_arg = arg;
+  const uint8_t *src = ptrs[1];
+  ndarray_item_buf_t tmp;
+  ssize_t i;
+  for (i = 0; i < n; ++i, src += strides[1]) {
+    if (cast_arg->func(src, 0, tmp.bytes, 0, 1, 1)) {
+      cast_arg->failed_ptr = src;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Convert the items of src to dst that has the same shape */
+static void
+ndarray_cast_items(const ndarray_t *dst, const ndarray_t *src, const int checked)
+{
+  uint8_t *data[2] = { dst->data, src->data };
+  const ssize_t *strides[2] = { dst->strides, src->strides };
+  ndarray_cast_arg_t arg = { ndarray_cast_row_funcs[src->dtype][dst->dtype], checked, NULL };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 2, data, strides, src->ndim, src->shape, 0);
+  int stop = ndarray_iter_run_parallel(&it, ndarray_cast_kernel, &arg);
+  if (stop) {
+    /* find the item to report again, as the workers don't record it */
+    ndarray_iter_run(&it, ndarray_cast_find_kernel, &arg);
+  }
+  ndarray_iter_release(&it);
+
+  if (stop) {
+    VALUE val = ndarray_get_value(arg.failed_ptr, src->dtype);
+    rb_raise(rb_eRangeError, "%"PRIsVALUE" is out of the range of %"PRIsVALUE,
+             val, rb_sym2str(ID2SYM(DTYPE_ID(dst->dtype))));
+  }
+}
+
+static VALUE
+ndarray_astype_impl(VALUE obj, VALUE dtype_name, VALUE order_v, VALUE copy, VALUE checked)
+{
+  const ndarray_dtype_t dtype = ndarray_obj_to_dtype_t(dtype_name);
+  const ndarray_order_t order = ndarray_obj_to_order_t(order_v);
+
+  /* the native copy of a swapped array needs no more copy */
+  const VALUE native = ndarray_to_native(obj);
+  if (native != obj) {
+    copy = Qfalse;
+    obj = native;
+  }
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (!RTEST(copy) && dtype == nar->dtype) {
+    if (order == ndarray_order_auto ||
+        (order == ndarray_order_row_major && ndarray_is_row_major_contiguous(nar)) ||
+        (order == ndarray_order_column_major && ndarray_is_column_major_contiguous(nar))) {
+      return obj;
+    }
+  }
+
+  if (dtype == nar->dtype) {
+    return ndarray_copy_contiguous(rb_obj_class(obj), nar, ndarray_resolve_order(nar, order));
+  }
+  if (dtype == ndarray_dtype_record || nar->dtype == ndarray_dtype_record) {
+    rb_raise(rb_eTypeError, "unable to cast %"PRIsVALUE" to %"PRIsVALUE,
+             rb_sym2str(ID2SYM(DTYPE_ID(nar->dtype))), rb_sym2str(ID2SYM(DTYPE_ID(dtype))));
+  }
+
+  VALUE result = ndarray_new_contiguous(rb_obj_class(obj), dtype, nar->ndim, nar->shape,
+                                        ndarray_resolve_order(nar, order));
+
+  ndarray_t *nar_result;
+  TypedData_Get_Struct(result, ndarray_t, &ndarray_data_type, nar_result);
+  ndarray_cast_items(nar_result, nar, RTEST(checked));
+
+  return result;
+}
+
+/* Reduction
+ *
+ * A reduction accumulates the items into ndarray_reduce_acc_t by the row
+ * function of the operation and the dtype.  The row functions are called
+ * with the items in a row, and can be called repeatedly for the rows of an
+ * array.  The accumulators of the workers are combined in the order of
+ * their item ranges.
+ *
+ * The sums of integers wrap around in 64 bits.  The sums of floats, and
+ * all the sums for means, are computed in double by pairwise summation.
+ * NaN is propagated by min and max, and the first NaN is chosen by argmin
+ * and argmax. */
+
+typedef enum {
+  ndarray_reduce_sum,
+  ndarray_reduce_mean,
+  ndarray_reduce_min,
+  ndarray_reduce_max,
+  ndarray_reduce_argmin,
+  ndarray_reduce_argmax,
+  ndarray_reduce_sentinel
+} ndarray_reduce_op_t;
+
+static const char *const ndarray_reduce_op_names[] = {
+  "sum", "mean", "min", "max", "argmin", "argmax"
+};
+
+typedef struct {
+  /* i for signed integers, u for unsigned integers, and f for floats and means */
+  union {
+    int64_t i;
+    uint64_t u;
+    double f;
+  } value;
+  /* the number of the items accumulated */
+  ssize_t count;
+  /* the position of value in the items accumulated, for argmin and argmax */
+  ssize_t index;
+} ndarray_reduce_acc_t;
+
+typedef void (*ndarray_reduce_row_func_t)(ndarray_reduce_acc_t *acc, const uint8_t *p,
+                                          const ssize_t stride, const ssize_t n);
+
+#define REDUCE_PAIRWISE_BLOCK_SIZE 128
+
+#define REDUCE_MIN(a, b) (((b) < (a) || (b) != (b)) ? (b) : (a))
+#define REDUCE_MAX(a, b) (((b) > (a) || (b) != (b)) ? (b) : (a))
+#define REDUCE_ARGMIN_P(v, m) ((v) < (m) || ((v) != (v) && (m) == (m)))
+#define REDUCE_ARGMAX_P(v, m) ((v) > (m) || ((v) != (v) && (m) == (m)))
+
+#define ITEM_AT(type, p, stride, i) (*(const type *)((p) + (i) * (stride)))
+
+/* Pairwise summation in the same manner as numpy: the rows up to the block
+ * size are summed by 8 independent accumulators, and the longer rows are
+ * split in halves recursively. */
+#define DEFINE_PAIRWISE_SUM_FUNC(name, type) \
+static double \
+ndarray_pairwise_sum_##name(const uint8_t *p, const ssize_t stride, const ssize_t n) \
+{ \
+  ssize_t i, j; \
+  if (n < 8) { \
+    double res = 0.0; \
+    for (i = 0; i < n; ++i) res += (double)ITEM_AT(type, p, stride, i); \
+    return res; \
+  } \
+  else if (n <= REDUCE_PAIRWISE_BLOCK_SIZE) { \
+    double r[8]; \
+    for (j = 0; j < 8; ++j) r[j] = (double)ITEM_AT(type, p, stride, j); \
+    for (i = 8; i < n - (n % 8); i += 8) { \
+      for (j = 0; j < 8; ++j) r[j] += (double)ITEM_AT(type, p, stride, i + j); \
+    } \
+    double res = ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7])); \
+    for (; i < n; ++i) res += (double)ITEM_AT(type, p, stride, i); \
+    return res; \
+  } \
+  else { \
+    ssize_t n2 = n / 2; \
+    n2 -= n2 % 8; \
+    return ndarray_pairwise_sum_##name(p, stride, n2) + \
+           ndarray_pairwise_sum_##name(p + n2 * stride, stride, n - n2); \
+  } \
+}
+
+/* The loops for contiguous rows are written separately to be vectorized */
+#define REDUCE_ROW_LOOP(type, p, stride, n, i, body) do { \
+    if ((stride) == sizeof(type)) { \
+      const type *a = (const type *)(p); \
+      for (; i < (n); ++i) { const type v = a[i]; body; } \
+    } \
+    else { \
+      for (; i < (n); ++i) { const type v = ITEM_AT(type, p, stride, i); body; } \
+    } \
+  } while (0)
+
+#define DEFINE_REDUCE_ROW_FUNCS(name, type, member, integer_p) \
+DEFINE_PAIRWISE_SUM_FUNC(name, type) \
+static void \
+ndarray_reduce_sum_##name(ndarray_reduce_acc_t *acc, const uint8_t *p, const ssize_t stride, const ssize_t n) \
+{ \
+  if (integer_p) { \
+    uint64_t s = 0; \
+    ssize_t i = 0; \
+    REDUCE_ROW_LOOP(type, p, stride, n, i, s += (uint64_t)v); \
+    acc->value.u += s; \
+  } \
+  else { \
+    acc->value.f += ndarray_pairwise_sum_##name(p, stride, n); \
+  } \
+} \
+static void \
+ndarray_reduce_mean_##name(ndarray_reduce_acc_t *acc, const uint8_t *p, const ssize_t stride, const ssize_t n) \
+{ \
+  acc->value.f += ndarray_pairwise_sum_##name(p, stride, n); \
+} \
+static void \
+ndarray_reduce_min_##name(ndarray_reduce_acc_t *acc, const uint8_t *p, const ssize_t stride, const ssize_t n) \
+{ \
+  ssize_t i = 0; \
+  type m = acc->count == 0 ? ITEM_AT(type, p, stride, i++) : (type)acc->value.member; \
+  REDUCE_ROW_LOOP(type, p, stride, n, i, m = REDUCE_MIN(m, v)); \
+  acc->value.member = m; \
+} \
+static void \
+ndarray_reduce_max_##name(ndarray_reduce_acc_t *acc, const uint8_t *p, const ssize_t stride, const ssize_t n) \
+{ \
+  ssize_t i = 0; \
+  type m = acc->count == 0 ? ITEM_AT(type, p, stride, i++) : (type)acc->value.member; \
+  REDUCE_ROW_LOOP(type, p, stride, n, i, m = REDUCE_MAX(m, v)); \
+  acc->value.member = m; \
+} \
+static void \
+ndarray_reduce_argmin_##name(ndarray_reduce_acc_t *acc, const uint8_t *p, const ssize_t stride, const ssize_t n) \
+{ \
+  ssize_t i = 0, k = acc->index; \
+  type m = acc->count == 0 ? ITEM_AT(type, p, stride, i++) : (type)acc->value.member; \
+  if (acc->count == 0) k = 0; \
+  REDUCE_ROW_LOOP(type, p, stride, n, i, if (REDUCE_ARGMIN_P(v, m)) { m = v; k = acc->count + i; }); \
+  acc->value.member = m; \
+  acc->index = k; \
+} \
+static void \
+ndarray_reduce_argmax_##name(ndarray_reduce_acc_t *acc, const uint8_t *p, const ssize_t stride, const ssize_t n) \
+{ \
+  ssize_t i = 0, k = acc->index; \
+  type m = acc->count == 0 ? ITEM_AT(type, p, stride, i++) : (type)acc->value.member; \
+  if (acc->count == 0) k = 0; \
+  REDUCE_ROW_LOOP(type, p, stride, n, i, if (REDUCE_ARGMAX_P(v, m)) { m = v; k = acc->count + i; }); \
+  acc->value.member = m; \
+  acc->index = k; \
+}
+
+#define DEFINE_REDUCE_ROW_FUNCS_OF(name, type, kind, load, num2type, type2num) \
+  DEFINE_REDUCE_ROW_FUNCS(name, type, NDARRAY_SCALAR_MEMBER(kind), NDARRAY_SCALAR_KIND(kind) != ndarray_scalar_float)
+
+NDARRAY_FOR_EACH_REAL_DTYPE(DEFINE_REDUCE_ROW_FUNCS_OF)
+
+#undef DEFINE_REDUCE_ROW_FUNCS_OF
+#undef DEFINE_REDUCE_ROW_FUNCS
+#undef REDUCE_ROW_LOOP
+#undef DEFINE_PAIRWISE_SUM_FUNC
+#undef ITEM_AT
+
+#define REDUCE_ROW_FUNCS_OF(name, type, kind, load, num2type, type2num) { \
+    ndarray_reduce_sum_##name, \
+    ndarray_reduce_mean_##name, \
+    ndarray_reduce_min_##name, \
+    ndarray_reduce_max_##name, \
+    ndarray_reduce_argmin_##name, \
+    ndarray_reduce_argmax_##name, \
+  },
+
+/* indexed by [dtype][operation] */
+static const ndarray_reduce_row_func_t ndarray_reduce_row_funcs[][ndarray_reduce_sentinel] = {
+  { NULL, },
+  NDARRAY_FOR_EACH_REAL_DTYPE(REDUCE_ROW_FUNCS_OF)
+};
+
+#undef REDUCE_ROW_FUNCS_OF
+
+static ndarray_scalar_kind_t
+ndarray_dtype_scalar_kind(const ndarray_dtype_t dtype)
+{
+#define SCALAR_KIND_CASE(name, type, kind, load, num2type, type2num) \
+    case ndarray_dtype_##name: return NDARRAY_SCALAR_KIND(kind);
+
+  switch (dtype) {
+    NDARRAY_FOR_EACH_INTEGER_DTYPE(SCALAR_KIND_CASE)
+    default:
+      return ndarray_scalar_float;
+  }
+
+#undef SCALAR_KIND_CASE
+}
+
+static ndarray_dtype_t
+ndarray_reduce_result_dtype(const ndarray_reduce_op_t op, const ndarray_dtype_t dtype)
+{
+  switch (op) {
+    case ndarray_reduce_sum:
+      switch (ndarray_dtype_scalar_kind(dtype)) {
+        case ndarray_scalar_signed: return ndarray_dtype_int64;
+        case ndarray_scalar_unsigned: return ndarray_dtype_uint64;
+        default: return dtype;
+      }
+    case ndarray_reduce_mean:
+      return dtype == ndarray_dtype_float32 ? ndarray_dtype_float32 : ndarray_dtype_float64;
+    case ndarray_reduce_argmin:
+    case ndarray_reduce_argmax:
+      return ndarray_dtype_int64;
+    default:
+      return dtype;
+  }
+}
+
+/* Merge acc2, that follows acc1 in the items, into acc1 */
+static void
+ndarray_reduce_acc_merge(const ndarray_reduce_op_t op, const ndarray_dtype_t dtype,
+                         ndarray_reduce_acc_t *acc1, const ndarray_reduce_acc_t *acc2)
+{
+  const ndarray_scalar_kind_t kind = ndarray_dtype_scalar_kind(dtype);
+
+  if (acc2->count == 0)
+    return;
+  if (acc1->count == 0) {
+    *acc1 = *acc2;
+    return;
+  }
+
+#define MERGE_VALUE(member, combine) (acc1->value.member = combine(acc1->value.member, acc2->value.member))
+#define MERGE_INDEX(member, better_p) do { \
+    if (better_p(acc2->value.member, acc1->value.member)) { \
+      acc1->value.member = acc2->value.member; \
+      acc1->index = acc1->count + acc2->index; \
+    } \
+  } while (0)
+#define MERGE_BY_KIND(MERGE, arg) do { \
+    switch (kind) { \
+      case ndarray_scalar_signed: MERGE(i, arg); break; \
+      case ndarray_scalar_unsigned: MERGE(u, arg); break; \
+      default: MERGE(f, arg); break; \
+    } \
+  } while (0)
+
+  switch (op) {
+    case ndarray_reduce_sum:
+      if (kind == ndarray_scalar_float)
+        acc1->value.f += acc2->value.f;
+      else
+        acc1->value.u += acc2->value.u;
+      break;
+    case ndarray_reduce_mean:
+      acc1->value.f += acc2->value.f;
+      break;
+    case ndarray_reduce_min:
+      MERGE_BY_KIND(MERGE_VALUE, REDUCE_MIN);
+      break;
+    case ndarray_reduce_max:
+      MERGE_BY_KIND(MERGE_VALUE, REDUCE_MAX);
+      break;
+    case ndarray_reduce_argmin:
+      MERGE_BY_KIND(MERGE_INDEX, REDUCE_ARGMIN_P);
+      break;
+    case ndarray_reduce_argmax:
+      MERGE_BY_KIND(MERGE_INDEX, REDUCE_ARGMAX_P);
+      break;
+    default:
+      UNREACHABLE;
+  }
+
+#undef MERGE_BY_KIND
+#undef MERGE_INDEX
+#undef MERGE_VALUE
+
+  acc1->count += acc2->count;
+}
+
+/* Store the result of the reduction in the item of the result dtype */
+static void
+ndarray_reduce_acc_store(const ndarray_reduce_op_t op, const ndarray_dtype_t dtype,
+                         const ndarray_reduce_acc_t *acc, uint8_t *out)
+{
+  switch (op) {
+    case ndarray_reduce_mean: {
+      const double mean = acc->value.f / (double)acc->count;
+      if (dtype == ndarray_dtype_float32)
+        *(float *)out = (float)mean;
+      else
+        *(double *)out = mean;
+      return;
+    }
+    case ndarray_reduce_argmin:
+    case ndarray_reduce_argmax:
+      *(int64_t *)out = (int64_t)acc->index;
+      return;
+    case ndarray_reduce_sum:
+      switch (ndarray_dtype_scalar_kind(dtype)) {
+        case ndarray_scalar_signed: *(int64_t *)out = acc->value.i; return;
+        case ndarray_scalar_unsigned: *(uint64_t *)out = acc->value.u; return;
+        default: break;
+      }
+      break;
+    default:
+      break;
+  }
+
+  /* sum of floats, min, and max are stored as the source dtype */
+#define STORE_CASE(name, type, kind, load, num2type, type2num) \
+    case ndarray_dtype_##name: *(type *)out = (type)acc->value.NDARRAY_SCALAR_MEMBER(kind); break;
+
+  switch (dtype) {
+    NDARRAY_FOR_EACH_REAL_DTYPE(STORE_CASE)
+    default: UNREACHABLE;
+  }
+
+#undef STORE_CASE
+}
+
+typedef struct {
+  ndarray_reduce_row_func_t func;
+  ndarray_reduce_acc_t acc;
+} ndarray_reduce_all_arg_t;
+
+static int
+ndarray_reduce_all_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  ndarray_reduce_all_arg_t *reduce_arg = arg;
+  reduce_arg->func(&reduce_arg->acc, ptrs[0], strides[0], n);
+  reduce_arg->acc.count += n;
+  return 0;
+}
+
+typedef struct {
+  ndarray_reduce_op_t op;
+  ndarray_dtype_t dtype;
+  ndarray_reduce_row_func_t func;
+  ssize_t axis_size;
+  ssize_t axis_stride;
+} ndarray_reduce_axis_arg_t;
+
+/* ptrs[0] is the result, and ptrs[1] is the first item of the axis */
+static int
+ndarray_reduce_axis_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_reduce_axis_arg_t *reduce_arg = arg;
+  uint8_t *out = ptrs[0];
+  const uint8_t *p = ptrs[1];
+  ssize_t i;
+  for (i = 0; i < n; ++i, out += strides[0], p += strides[1]) {
+    ndarray_reduce_acc_t acc = { { 0 }, 0, 0 };  /* 0.0 for floats as well */
+    reduce_arg->func(&acc, p, reduce_arg->axis_stride, reduce_arg->axis_size);
+    acc.count = reduce_arg->axis_size;
+    ndarray_reduce_acc_store(reduce_arg->op, reduce_arg->dtype, &acc, out);
+  }
+  return 0;
+}
+
+static VALUE
+ndarray_reduce_all(const ndarray_t *nar, const ndarray_reduce_op_t op)
+{
+  ndarray_reduce_all_arg_t args[NDARRAY_MAX_THREADS];
+  const ndarray_reduce_acc_t zero_acc = { { 0 }, 0, 0 };
+  args[0].func = ndarray_reduce_row_funcs[nar->dtype][op];
+  args[0].acc = zero_acc;
+
+  /* argmin and argmax need the items in the logical order */
+  const int flags = (op == ndarray_reduce_argmin || op == ndarray_reduce_argmax) ? NDARRAY_ITER_KEEP_ORDER : 0;
+  uint8_t *data[1] = { nar->data };
+  const ssize_t *strides[1] = { nar->strides };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 1, data, strides, nar->ndim, nar->shape, flags);
+  const int n_tasks = ndarray_iter_run_parallel_private(&it, ndarray_reduce_all_kernel, args, sizeof(args[0]));
+  ndarray_iter_release(&it);
+
+  int t;
+  for (t = 1; t < n_tasks; ++t) {
+    ndarray_reduce_acc_merge(op, nar->dtype, &args[0].acc, &args[t].acc);
+  }
+
+  const ndarray_dtype_t result_dtype = ndarray_reduce_result_dtype(op, nar->dtype);
+  ndarray_item_buf_t result;
+  ndarray_reduce_acc_store(op, nar->dtype, &args[0].acc, result.bytes);
+  return ndarray_get_value(result.bytes, result_dtype);
+}
+
+static VALUE
+ndarray_reduce_axis(VALUE obj, const ndarray_t *nar, const ndarray_reduce_op_t op, const ssize_t axis)
+{
+  const ssize_t ndim = nar->ndim;
+
+  VALUE heap_buf = 0;
+  ssize_t *buf = RB_ALLOCV_N(ssize_t, heap_buf, 2 * ndim);
+  ssize_t *shape = buf, *strides = buf + ndim;
+  ssize_t i, j;
+  for (i = 0, j = 0; i < ndim; ++i) {
+    if (i == axis)
+      continue;
+    shape[j] = nar->shape[i];
+    strides[j] = nar->strides[i];
+    ++j;
+  }
+
+  const ndarray_dtype_t result_dtype = ndarray_reduce_result_dtype(op, nar->dtype);
+  VALUE result = ndarray_new_contiguous(rb_obj_class(obj), result_dtype, ndim - 1, shape, ndarray_order_row_major);
+
+  ndarray_t *nar_result;
+  TypedData_Get_Struct(result, ndarray_t, &ndarray_data_type, nar_result);
+
+  ndarray_reduce_axis_arg_t arg;
+  arg.op = op;
+  arg.dtype = nar->dtype;
+  arg.func = ndarray_reduce_row_funcs[nar->dtype][op];
+  arg.axis_size = nar->shape[axis];
+  arg.axis_stride = nar->strides[axis];
+
+  uint8_t *data[2] = { nar_result->data, nar->data };
+  const ssize_t *operand_strides[2] = { nar_result->strides, strides };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 2, data, operand_strides, ndim - 1, shape, 0);
+  ndarray_iter_run_parallel(&it, ndarray_reduce_axis_kernel, &arg);
+  ndarray_iter_release(&it);
+
+  RB_ALLOCV_END(heap_buf);
+  return result;
+}
+
+/* Convert val of src_dtype to dst_dtype in the unchecked mode */
+static VALUE
+ndarray_cast_value(VALUE val, const ndarray_dtype_t src_dtype, const ndarray_dtype_t dst_dtype)
+{
+  ndarray_item_buf_t src, dst;
+  ndarray_set_value(src.bytes, src_dtype, val);
+  ndarray_cast_row_funcs[src_dtype][dst_dtype](src.bytes, 0, dst.bytes, 0, 1, 0);
+  return ndarray_get_value(dst.bytes, dst_dtype);
+}
+
+/* float16 and bfloat16 are reduced as float32, and bool as uint8.  The
+ * results are converted back except the sums and the means of bool, and
+ * the indices. */
+static VALUE
+ndarray_reduce_converted(VALUE obj, const ndarray_t *nar, const ndarray_reduce_op_t op, const ssize_t axis)
+{
+  const int bool_p = nar->dtype == ndarray_dtype_bool;
+  const ndarray_dtype_t work_dtype = bool_p ? ndarray_dtype_uint8 : ndarray_dtype_float32;
+
+  VALUE work = ndarray_new_contiguous(rb_obj_class(obj), work_dtype, nar->ndim, nar->shape,
+                                      ndarray_resolve_order(nar, ndarray_order_auto));
+  ndarray_t *nar_work;
+  TypedData_Get_Struct(work, ndarray_t, &ndarray_data_type, nar_work);
+  ndarray_cast_items(nar_work, nar, 0);
+
+  VALUE result = axis < 0 ? ndarray_reduce_all(nar_work, op) : ndarray_reduce_axis(work, nar_work, op, axis);
+
+  const int restore_p = bool_p ? (op == ndarray_reduce_min || op == ndarray_reduce_max)
+                               : (op != ndarray_reduce_argmin && op != ndarray_reduce_argmax);
+  if (restore_p) {
+    const ndarray_dtype_t result_dtype = ndarray_reduce_result_dtype(op, work_dtype);
+    if (axis < 0) {
+      result = ndarray_cast_value(result, result_dtype, nar->dtype);
+    }
+    else {
+      ndarray_t *nar_result;
+      TypedData_Get_Struct(result, ndarray_t, &ndarray_data_type, nar_result);
+      VALUE restored = ndarray_new_contiguous(rb_obj_class(obj), nar->dtype, nar_result->ndim,
+                                              nar_result->shape, ndarray_order_row_major);
+      ndarray_t *nar_restored;
+      TypedData_Get_Struct(restored, ndarray_t, &ndarray_data_type, nar_restored);
+      ndarray_cast_items(nar_restored, nar_result, 0);
+      result = restored;
+    }
+  }
+
+  RB_GC_GUARD(work);
+  return result;
+}
+
+/* The sums and the means of complex numbers are reduced in the real and
+ * the imaginary parts separately, as the views of floats. */
+static VALUE
+ndarray_reduce_complex(VALUE obj, const ndarray_t *nar, const ndarray_reduce_op_t op, const ssize_t axis)
+{
+  if (op != ndarray_reduce_sum && op != ndarray_reduce_mean) {
+    rb_raise(rb_eTypeError, "%s is not supported for complex arrays", ndarray_reduce_op_names[op]);
+  }
+
+  const int complex64_p = nar->dtype == ndarray_dtype_complex64;
+  ndarray_t parts[2];
+  parts[0] = *nar;
+  parts[0].dtype = complex64_p ? ndarray_dtype_float32 : ndarray_dtype_float64;
+  parts[0].item_size = nar->item_size / 2;
+  parts[1] = parts[0];
+  parts[1].data = (uint8_t *)parts[0].data + parts[0].item_size;
+
+  if (axis < 0) {
+    VALUE re = ndarray_reduce_all(&parts[0], op);
+    VALUE im = ndarray_reduce_all(&parts[1], op);
+    return rb_dbl_complex_new(NUM2DBL(re), NUM2DBL(im));
+  }
+
+  VALUE re = ndarray_reduce_axis(obj, &parts[0], op, axis);
+  VALUE im = ndarray_reduce_axis(obj, &parts[1], op, axis);
+  ndarray_t *nar_re, *nar_im;
+  TypedData_Get_Struct(re, ndarray_t, &ndarray_data_type, nar_re);
+  TypedData_Get_Struct(im, ndarray_t, &ndarray_data_type, nar_im);
+
+  VALUE result = ndarray_new_contiguous(rb_obj_class(obj), nar->dtype, nar_re->ndim, nar_re->shape,
+                                        ndarray_order_row_major);
+  ndarray_t *nar_result;
+  TypedData_Get_Struct(result, ndarray_t, &ndarray_data_type, nar_result);
+
+  const ssize_t n = ndarray_n_items(nar_result);
+  ssize_t i;
+  if (complex64_p) {
+    ndarray_complex64_t *z = (ndarray_complex64_t *)nar_result->data;
+    for (i = 0; i < n; ++i) {
+      z[i].re = ((const float *)nar_re->data)[i];
+      z[i].im = ((const float *)nar_im->data)[i];
+    }
+  }
+  else {
+    ndarray_complex128_t *z = (ndarray_complex128_t *)nar_result->data;
+    for (i = 0; i < n; ++i) {
+      z[i].re = ((const double *)nar_re->data)[i];
+      z[i].im = ((const double *)nar_im->data)[i];
+    }
+  }
+
+  RB_GC_GUARD(re);
+  RB_GC_GUARD(im);
+  return result;
+}
+
+static VALUE
+ndarray_reduce_impl(VALUE obj, VALUE op_v, VALUE axis_v)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  ndarray_reduce_op_t op;
+  ID op_id = SYM2ID(op_v);
+  for (op = 0; op < ndarray_reduce_sentinel; ++op) {
+    if (op_id == rb_intern(ndarray_reduce_op_names[op]))
+      break;
+  }
+  if (op == ndarray_reduce_sentinel) {
+    rb_raise(rb_eArgError, "unknown reduction (%"PRIsVALUE")", op_v);
+  }
+  ndarray_check_not_record(nar, ndarray_reduce_op_names[op]);
+
+  ssize_t axis = -1;
+  ssize_t n_reduced = ndarray_n_items(nar);
+  if (!NIL_P(axis_v) && nar->ndim > 1) {
+    axis = ndarray_normalize_axis(axis_v, nar->ndim);
+    n_reduced = nar->shape[axis];
+  }
+  else if (!NIL_P(axis_v)) {
+    ndarray_normalize_axis(axis_v, nar->ndim);
+  }
+
+  if (n_reduced == 0 && op != ndarray_reduce_sum && op != ndarray_reduce_mean) {
+    rb_raise(rb_eArgError, "zero-size array to reduction operation %s which has no identity",
+             ndarray_reduce_op_names[op]);
+  }
+
+  obj = ndarray_to_native(obj);
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  VALUE result;
+  switch (nar->dtype) {
+    case ndarray_dtype_float16:
+    case ndarray_dtype_bfloat16:
+    case ndarray_dtype_bool:
+      result = ndarray_reduce_converted(obj, nar, op, axis);
+      break;
+    case ndarray_dtype_complex64:
+    case ndarray_dtype_complex128:
+      result = ndarray_reduce_complex(obj, nar, op, axis);
+      break;
+    default:
+      result = axis < 0 ? ndarray_reduce_all(nar, op) : ndarray_reduce_axis(obj, nar, op, axis);
+      break;
+  }
+
+  RB_GC_GUARD(obj);
+  return result;
+}
+
+#undef REDUCE_MIN
+#undef REDUCE_MAX
+#undef REDUCE_ARGMIN_P
+#undef REDUCE_ARGMAX_P
+
+/* Arithmetic
+ *
+ * The binary operations take an NDArray, an Array, or a Ruby numeric as
+ * the other operand.  The operands are broadcast in the same manner as
+ * numpy: the shapes are aligned at the last axes, and the axes of size 1
+ * and the missing axes are repeated by zero strides.
+ *
+ * The operands are converted to their common dtype by ndarray_promote_dtype
+ * before the operation.  A Ruby Integer takes the dtype of the array, and a
+ * Ruby Float takes the dtype of a float array or float64.  A Ruby Complex
+ * takes the dtype of a complex array, complex64 for float32, float16, and
+ * bfloat16 arrays, or complex128.  Integer operations wrap around, and the
+ * division of integers is the floor division as Integer#/.  Comparisons
+ * make bool arrays.
+ *
+ * float16 and bfloat16 are computed in float32 and rounded back, and bool
+ * is compared as uint8.  The arithmetic of bool, the comparisons of complex
+ * numbers, and any operation of records are not supported. */
+
+typedef enum {
+  ndarray_binary_add,
+  ndarray_binary_sub,
+  ndarray_binary_mul,
+  ndarray_binary_div,
+  ndarray_binary_lt,
+  ndarray_binary_le,
+  ndarray_binary_gt,
+  ndarray_binary_ge,
+  ndarray_binary_sentinel
+} ndarray_binary_op_t;
+
+#define NDARRAY_BINARY_COMPARISON_P(op) ((op) >= ndarray_binary_lt)
+
+static const char *const ndarray_binary_op_names[] = {
+  "+", "-", "*", "/", "<", "<=", ">", ">="
+};
+
+/* Returns non-zero for the division by zero */
+typedef int (*ndarray_binary_row_func_t)(uint8_t *d, const ssize_t ds,
+                                         const uint8_t *a, const ssize_t as,
+                                         const uint8_t *b, const ssize_t bs,
+                                         const ssize_t n);
+
+/* The integer operations are computed in utype, that is an unsigned type
+ * not narrower than type, to wrap around without undefined behavior. */
+#define BINARY_ADD(type, utype, x, y) ((type)((utype)(x) + (utype)(y)))
+#define BINARY_SUB(type, utype, x, y) ((type)((utype)(x) - (utype)(y)))
+#define BINARY_MUL(type, utype, x, y) ((type)((utype)(x) * (utype)(y)))
+#define BINARY_DIV(type, utype, x, y) ((x) / (y))
+#define BINARY_LT(type, utype, x, y) ((x) < (y))
+#define BINARY_LE(type, utype, x, y) ((x) <= (y))
+#define BINARY_GT(type, utype, x, y) ((x) > (y))
+#define BINARY_GE(type, utype, x, y) ((x) >= (y))
+
+/* The loops for contiguous operands and for a broadcast second operand
+ * are written separately so that they are vectorized. */
+#define DEFINE_BINARY_ROW_FUNC(opname, name, otype, type, utype, expr) \
+static int \
+ndarray_binary_##opname##_##name(uint8_t *d, const ssize_t ds, const uint8_t *a, const ssize_t as, \
+                                 const uint8_t *b, const ssize_t bs, const ssize_t n) \
+{ \
+  ssize_t i; \
+  if (ds == sizeof(otype) && as == sizeof(type) && bs == sizeof(type)) { \
+    otype *z = (otype *)d; \
+    const type *x = (const type *)a, *y = (const type *)b; \
+    for (i = 0; i < n; ++i) z[i] = expr(type, utype, x[i], y[i]); \
+  } \
+  else if (ds == sizeof(otype) && as == sizeof(type) && bs == 0) { \
+    otype *z = (otype *)d; \
+    const type *x = (const type *)a, y = *(const type *)b; \
+    for (i = 0; i < n; ++i) z[i] = expr(type, utype, x[i], y); \
+  } \
+  else { \
+    for (i = 0; i < n; ++i, d += ds, a += as, b += bs) \
+      *(otype *)d = expr(type, utype, *(const type *)a, *(const type *)b); \
+  } \
+  return 0; \
+}
+
+/* The floor division as Integer#/ */
+#define DEFINE_SIGNED_DIV_ROW_FUNC(name, type, utype) \
+static int \
+ndarray_binary_div_##name(uint8_t *d, const ssize_t ds, const uint8_t *a, const ssize_t as, \
+                          const uint8_t *b, const ssize_t bs, const ssize_t n) \
+{ \
+  ssize_t i; \
+  for (i = 0; i < n; ++i, d += ds, a += as, b += bs) { \
+    const type x = *(const type *)a, y = *(const type *)b; \
+    if (y == 0) \
+      return 1; \
+    if (y == -1) { \
+      /* the minimum divided by -1 wraps around to the minimum */ \
+      *(type *)d = (type)((utype)0 - (utype)x); \
+      continue; \
+    } \
+    type q = x / y; \
+    if (x % y != 0 && (x < 0) != (y < 0)) --q; \
+    *(type *)d = q; \
+  } \
+  return 0; \
+}
+
+#define DEFINE_UNSIGNED_DIV_ROW_FUNC(name, type) \
+static int \
+ndarray_binary_div_##name(uint8_t *d, const ssize_t ds, const uint8_t *a, const ssize_t as, \
+                          const uint8_t *b, const ssize_t bs, const ssize_t n) \
+{ \
+  ssize_t i; \
+  for (i = 0; i < n; ++i, d += ds, a += as, b += bs) { \
+    const type y = *(const type *)b; \
+    if (y == 0) \
+      return 1; \
+    *(type *)d = *(const type *)a / y; \
+  } \
+  return 0; \
+}
+
+#define DEFINE_BINARY_ROW_FUNCS(name, type, utype) \
+  DEFINE_BINARY_ROW_FUNC(add, name, type, type, utype, BINARY_ADD) \
+  DEFINE_BINARY_ROW_FUNC(sub, name, type, type, utype, BINARY_SUB) \
+  DEFINE_BINARY_ROW_FUNC(mul, name, type, type, utype, BINARY_MUL) \
+  DEFINE_BINARY_ROW_FUNC(lt, name, uint8_t, type, utype, BINARY_LT) \
+  DEFINE_BINARY_ROW_FUNC(le, name, uint8_t, type, utype, BINARY_LE) \
+  DEFINE_BINARY_ROW_FUNC(gt, name, uint8_t, type, utype, BINARY_GT) \
+  DEFINE_BINARY_ROW_FUNC(ge, name, uint8_t, type, utype, BINARY_GE)
+
+DEFINE_BINARY_ROW_FUNCS(int8, int8_t, unsigned int)
+DEFINE_BINARY_ROW_FUNCS(uint8, uint8_t, unsigned int)
+DEFINE_BINARY_ROW_FUNCS(int16, int16_t, unsigned int)
+DEFINE_BINARY_ROW_FUNCS(uint16, uint16_t, unsigned int)
+DEFINE_BINARY_ROW_FUNCS(int32, int32_t, uint32_t)
+DEFINE_BINARY_ROW_FUNCS(uint32, uint32_t, uint32_t)
+DEFINE_BINARY_ROW_FUNCS(int64, int64_t, uint64_t)
+DEFINE_BINARY_ROW_FUNCS(uint64, uint64_t, uint64_t)
+DEFINE_BINARY_ROW_FUNCS(float32, float, float)
+DEFINE_BINARY_ROW_FUNCS(float64, double, double)
+
+DEFINE_SIGNED_DIV_ROW_FUNC(int8, int8_t, unsigned int)
+DEFINE_UNSIGNED_DIV_ROW_FUNC(uint8, uint8_t)
+DEFINE_SIGNED_DIV_ROW_FUNC(int16, int16_t, unsigned int)
+DEFINE_UNSIGNED_DIV_ROW_FUNC(uint16, uint16_t)
+DEFINE_SIGNED_DIV_ROW_FUNC(int32, int32_t, uint32_t)
+DEFINE_UNSIGNED_DIV_ROW_FUNC(uint32, uint32_t)
+DEFINE_SIGNED_DIV_ROW_FUNC(int64, int64_t, uint64_t)
+DEFINE_UNSIGNED_DIV_ROW_FUNC(uint64, uint64_t)
+DEFINE_BINARY_ROW_FUNC(div, float32, float, float, float, BINARY_DIV)
+DEFINE_BINARY_ROW_FUNC(div, float64, double, double, double, BINARY_DIV)
+
+/* The complex numbers are divided by Smith's algorithm to avoid the
+ * overflow of the intermediate values */
+#define DEFINE_COMPLEX_BINARY_FUNCS(name, type, rtype) \
+static inline type \
+ndarray_complex_add_##name(const type x, const type y) \
+{ \
+  return (type){ x.re + y.re, x.im + y.im }; \
+} \
+static inline type \
+ndarray_complex_sub_##name(const type x, const type y) \
+{ \
+  return (type){ x.re - y.re, x.im - y.im }; \
+} \
+static inline type \
+ndarray_complex_mul_##name(const type x, const type y) \
+{ \
+  return (type){ x.re * y.re - x.im * y.im, x.re * y.im + x.im * y.re }; \
+} \
+static inline type \
+ndarray_complex_div_##name(const type x, const type y) \
+{ \
+  if (fabs(y.re) >= fabs(y.im)) { \
+    if (y.re == 0 && y.im == 0) { \
+      return (type){ x.re / (rtype)fabs(y.re), x.im / (rtype)fabs(y.re) }; \
+    } \
+    const rtype r = y.im / y.re, den = y.re + y.im * r; \
+    return (type){ (x.re + x.im * r) / den, (x.im - x.re * r) / den }; \
+  } \
+  else { \
+    const rtype r = y.re / y.im, den = y.re * r + y.im; \
+    return (type){ (x.re * r + x.im) / den, (x.im * r - x.re) / den }; \
+  } \
+}
+
+#define BINARY_COMPLEX(name, opname) ndarray_complex_##opname##_##name
+#define DEFINE_COMPLEX_BINARY_ROW_FUNC(opname, name, type) \
+static int \
+ndarray_binary_##opname##_##name(uint8_t *d, const ssize_t ds, const uint8_t *a, const ssize_t as, \
+                                 const uint8_t *b, const ssize_t bs, const ssize_t n) \
+{ \
+  ssize_t i; \
+  for (i = 0; i < n; ++i, d += ds, a += as, b += bs) \
+    *(type *)d = BINARY_COMPLEX(name, opname)(*(const type *)a, *(const type *)b); \
+  return 0; \
+}
+
+#define DEFINE_COMPLEX_BINARY_ROW_FUNCS(name, type, rtype) \
+  DEFINE_COMPLEX_BINARY_FUNCS(name, type, rtype) \
+  DEFINE_COMPLEX_BINARY_ROW_FUNC(add, name, type) \
+  DEFINE_COMPLEX_BINARY_ROW_FUNC(sub, name, type) \
+  DEFINE_COMPLEX_BINARY_ROW_FUNC(mul, name, type) \
+  DEFINE_COMPLEX_BINARY_ROW_FUNC(div, name, type)
+
+DEFINE_COMPLEX_BINARY_ROW_FUNCS(complex64, ndarray_complex64_t, float)
+DEFINE_COMPLEX_BINARY_ROW_FUNCS(complex128, ndarray_complex128_t, double)
+
+#undef DEFINE_COMPLEX_BINARY_ROW_FUNCS
+#undef DEFINE_COMPLEX_BINARY_ROW_FUNC
+#undef DEFINE_COMPLEX_BINARY_FUNCS
+#undef BINARY_COMPLEX
+
+#undef DEFINE_BINARY_ROW_FUNCS
+#undef DEFINE_SIGNED_DIV_ROW_FUNC
+#undef DEFINE_UNSIGNED_DIV_ROW_FUNC
+#undef DEFINE_BINARY_ROW_FUNC
+#undef BINARY_ADD
+#undef BINARY_SUB
+#undef BINARY_MUL
+#undef BINARY_DIV
+#undef BINARY_LT
+#undef BINARY_LE
+#undef BINARY_GT
+#undef BINARY_GE
+
+#define BINARY_ROW_FUNCS_OF(name) { \
+    ndarray_binary_add_##name, \
+    ndarray_binary_sub_##name, \
+    ndarray_binary_mul_##name, \
+    ndarray_binary_div_##name, \
+    ndarray_binary_lt_##name, \
+    ndarray_binary_le_##name, \
+    ndarray_binary_gt_##name, \
+    ndarray_binary_ge_##name, \
+  }
+#define COMPLEX_BINARY_ROW_FUNCS_OF(name) { \
+    ndarray_binary_add_##name, \
+    ndarray_binary_sub_##name, \
+    ndarray_binary_mul_##name, \
+    ndarray_binary_div_##name, \
+  }
+
+/* indexed by [dtype][operation] */
+static const ndarray_binary_row_func_t ndarray_binary_row_funcs[][ndarray_binary_sentinel] = {
+  { NULL, },
+  BINARY_ROW_FUNCS_OF(int8),
+  BINARY_ROW_FUNCS_OF(uint8),
+  BINARY_ROW_FUNCS_OF(int16),
+  BINARY_ROW_FUNCS_OF(uint16),
+  BINARY_ROW_FUNCS_OF(int32),
+  BINARY_ROW_FUNCS_OF(uint32),
+  BINARY_ROW_FUNCS_OF(int64),
+  BINARY_ROW_FUNCS_OF(uint64),
+  BINARY_ROW_FUNCS_OF(float32),
+  BINARY_ROW_FUNCS_OF(float64),
+  { NULL, }, /* float16 is computed in float32 */
+  { NULL, }, /* bfloat16 is computed in float32 */
+  COMPLEX_BINARY_ROW_FUNCS_OF(complex64),
+  COMPLEX_BINARY_ROW_FUNCS_OF(complex128),
+  { NULL, }, /* bool is compared as uint8 */
+  { NULL, }, /* record */
+};
+
+#undef COMPLEX_BINARY_ROW_FUNCS_OF
+#undef BINARY_ROW_FUNCS_OF
+
+/* The dtype in which the operation of dtype is computed */
+static ndarray_dtype_t
+ndarray_binary_work_dtype(const ndarray_binary_op_t op, const ndarray_dtype_t dtype)
+{
+  switch (dtype) {
+    case ndarray_dtype_float16:
+    case ndarray_dtype_bfloat16:
+      return ndarray_dtype_float32;
+    case ndarray_dtype_bool:
+      if (!NDARRAY_BINARY_COMPARISON_P(op)) {
+        rb_raise(rb_eTypeError, "%s is not supported for bool arrays", ndarray_binary_op_names[op]);
+      }
+      return ndarray_dtype_uint8;
+    case ndarray_dtype_complex64:
+    case ndarray_dtype_complex128:
+      if (NDARRAY_BINARY_COMPARISON_P(op)) {
+        rb_raise(rb_eTypeError, "%s is not supported for complex arrays", ndarray_binary_op_names[op]);
+      }
+      return dtype;
+    case ndarray_dtype_record:
+      rb_raise(rb_eTypeError, "%s is not supported for record arrays", ndarray_binary_op_names[op]);
+    default:
+      return dtype;
+  }
+}
+
+/* ptrs[0] is the result, ptrs[1] and ptrs[2] are the operands */
+static int
+ndarray_binary_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_binary_row_func_t func = *(const ndarray_binary_row_func_t *)arg;
+  return func(ptrs[0], strides[0], ptrs[1], strides[1], ptrs[2], strides[2], n);
+}
+
+/* An operand of a binary operation.  A scalar is held in the buffer as an
+ * array of no dimensions. */
+typedef struct {
+  VALUE obj;
+  ndarray_dtype_t dtype;
+  ssize_t ndim;
+  const ssize_t *shape;
+  const ssize_t *strides;
+  uint8_t *data;
+  uint8_t scalar[16];
+} ndarray_operand_t;
+
+static void
+ndarray_operand_set_array(ndarray_operand_t *opnd, VALUE obj)
+{
+  obj = ndarray_to_native(obj);
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+  opnd->obj = obj;
+  opnd->dtype = nar->dtype;
+  opnd->ndim = nar->ndim;
+  opnd->shape = nar->shape;
+  opnd->strides = nar->strides;
+  opnd->data = nar->data;
+}
+
+/* Convert the array operand to dtype by a contiguous copy */
+static void
+ndarray_operand_cast(ndarray_operand_t *opnd, const ndarray_dtype_t dtype)
+{
+  if (opnd->dtype == dtype)
+    return;
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(opnd->obj, ndarray_t, &ndarray_data_type, nar);
+
+  VALUE tmp = ndarray_new_contiguous(cNDArray, dtype, nar->ndim, nar->shape, ndarray_order_row_major);
+  ndarray_t *nar_tmp;
+  TypedData_Get_Struct(tmp, ndarray_t, &ndarray_data_type, nar_tmp);
+  ndarray_cast_items(nar_tmp, nar, 0);
+
+  ndarray_operand_set_array(opnd, tmp);
+}
+
+/* Returns the item address range [*lo, *hi) of the array */
+static void
+ndarray_operand_extent(const ndarray_operand_t *opnd, const uint8_t **lo, const uint8_t **hi)
+{
+  const uint8_t *p = opnd->data, *q = opnd->data;
+  ssize_t i;
+  for (i = 0; i < opnd->ndim; ++i) {
+    if (opnd->shape[i] == 0) {
+      *lo = *hi = opnd->data;
+      return;
+    }
+    const ssize_t d = (opnd->shape[i] - 1) * opnd->strides[i];
+    if (d < 0) p += d; else q += d;
+  }
+  *lo = p;
+  *hi = q + SIZEOF_DTYPE(opnd->dtype);
+}
+
+static VALUE
+ndarray_shape_to_ary(const ssize_t ndim, const ssize_t *shape)
+{
+  VALUE ary = rb_ary_new_capa(ndim);
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) rb_ary_push(ary, SSIZET2NUM(shape[i]));
+  return ary;
+}
+
+/* Compute the broadcast shape of the operands and the strides of them for
+ * it.  shape and strides1, strides2 must have the room of ndim items,
+ * where ndim is the larger ndim of the operands. */
+static void
+ndarray_broadcast(const ndarray_operand_t *opnd1, const ndarray_operand_t *opnd2, const ssize_t ndim,
+                  ssize_t *shape, ssize_t *strides1, ssize_t *strides2)
+{
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) {
+    const ssize_t i1 = i - (ndim - opnd1->ndim), i2 = i - (ndim - opnd2->ndim);
+    const ssize_t n1 = i1 >= 0 ? opnd1->shape[i1] : 1;
+    const ssize_t n2 = i2 >= 0 ? opnd2->shape[i2] : 1;
+    if (n1 != n2 && n1 != 1 && n2 != 1) {
+      rb_raise(rb_eArgError, "operands could not be broadcast together with shapes %"PRIsVALUE" %"PRIsVALUE,
+               ndarray_shape_to_ary(opnd1->ndim, opnd1->shape), ndarray_shape_to_ary(opnd2->ndim, opnd2->shape));
+    }
+    shape[i] = n1 != 1 ? n1 : n2;
+    strides1[i] = n1 != 1 ? opnd1->strides[i1] : 0;
+    strides2[i] = n2 != 1 ? opnd2->strides[i2] : 0;
+  }
+}
+
+/* Whether the Integer num can be stored in the integer dtype.  The sign
+ * of num is stored in *sign_p. */
+static int
+ndarray_integer_fits_p(VALUE num, const ndarray_dtype_t dtype, int *sign_p)
+{
+  uint64_t abs;
+  const int sign = rb_integer_pack(num, &abs, 1, sizeof(abs), 0,
+                                   INTEGER_PACK_LSWORD_FIRST | INTEGER_PACK_NATIVE_BYTE_ORDER);
+  *sign_p = sign < 0 ? -1 : (sign > 0);
+  if (sign < -1 || 1 < sign) {
+    /* overflowed 64 bits */
+    return 0;
+  }
+
+  const int bits = 8 * SIZEOF_DTYPE(dtype);
+  if (ndarray_dtype_scalar_kind(dtype) == ndarray_scalar_signed) {
+    const uint64_t half = (uint64_t)1 << (bits - 1);
+    return sign < 0 ? abs <= half : abs < half;
+  }
+  return sign >= 0 && (bits == 64 || (abs >> bits) == 0);
+}
+
+/* The dtype of the Integer scalar that does not fit in the array: int64,
+ * uint64, or float64 for the larger magnitudes */
+static ndarray_dtype_t
+ndarray_integer_scalar_dtype(VALUE num)
+{
+  int sign;
+  if (ndarray_integer_fits_p(num, ndarray_dtype_int64, &sign))
+    return ndarray_dtype_int64;
+  if (ndarray_integer_fits_p(num, ndarray_dtype_uint64, &sign))
+    return ndarray_dtype_uint64;
+  return ndarray_dtype_float64;
+}
+
+/* The result of the comparison of the integer array with the Integer out
+ * of its range, where all items are on the same side of it */
+static VALUE
+ndarray_binary_compare_out_of_range(VALUE obj, const ndarray_t *nar, const ndarray_binary_op_t op, const int sign)
+{
+  const int lt_p = sign > 0; /* whether the items are less than the scalar */
+  int res;
+  switch (op) {
+    case ndarray_binary_lt:
+    case ndarray_binary_le:
+      res = lt_p;
+      break;
+    default:
+      res = !lt_p;
+      break;
+  }
+
+  VALUE result = ndarray_new_contiguous(rb_obj_class(obj), ndarray_dtype_bool, nar->ndim, nar->shape,
+                                        ndarray_order_row_major);
+  ndarray_t *nar_result;
+  TypedData_Get_Struct(result, ndarray_t, &ndarray_data_type, nar_result);
+  memset(nar_result->data, res, nar_result->byte_size);
+  return result;
+}
+
+static VALUE
+ndarray_binary_op(VALUE obj, VALUE other, const ndarray_binary_op_t op, const int inplace_p)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (inplace_p) {
+    rb_check_frozen(obj);
+  }
+
+  ndarray_operand_t opnd1, opnd2;
+  ndarray_operand_set_array(&opnd1, obj);
+
+  ndarray_dtype_t dtype;
+  VALUE scalar = Qundef;
+  if (RB_INTEGER_TYPE_P(other)) {
+    /* The dtype of the array is kept when the Integer fits in it, or the
+     * Integer is promoted as int64 as the items of an Array are */
+    int sign;
+    scalar = other;
+    dtype = nar->dtype;
+    if (ndarray_dtype_is_integer(nar->dtype) && !ndarray_integer_fits_p(other, nar->dtype, &sign)) {
+      if (NDARRAY_BINARY_COMPARISON_P(op)) {
+        return ndarray_binary_compare_out_of_range(obj, nar, op, sign);
+      }
+      dtype = ndarray_promote_dtype(nar->dtype, ndarray_integer_scalar_dtype(other));
+    }
+  }
+  else if (RB_TYPE_P(other, T_COMPLEX)) {
+    scalar = other;
+    switch (nar->dtype) {
+      case ndarray_dtype_complex64:
+      case ndarray_dtype_float32:
+      case ndarray_dtype_float16:
+      case ndarray_dtype_bfloat16:
+        dtype = ndarray_dtype_complex64;
+        break;
+      default:
+        dtype = ndarray_promote_dtype(nar->dtype, ndarray_dtype_complex128);
+        break;
+    }
+  }
+  else if (RB_FLOAT_TYPE_P(other) || rb_obj_is_kind_of(other, rb_cNumeric)) {
+    scalar = other;
+    if (nar->dtype == ndarray_dtype_bool) {
+      /* raises TypeError */
+      dtype = ndarray_promote_dtype(nar->dtype, ndarray_dtype_float64);
+    }
+    else {
+      dtype = ndarray_dtype_is_integer(nar->dtype) ? ndarray_dtype_float64 : nar->dtype;
+    }
+  }
+  else {
+    if (!rb_typeddata_is_kind_of(other, &ndarray_data_type)) {
+      other = rb_funcall(cNDArray, rb_intern("try_convert"), 1, other);
+    }
+    ndarray_operand_set_array(&opnd2, other);
+    dtype = ndarray_promote_dtype(nar->dtype, opnd2.dtype);
+  }
+
+  if (inplace_p && dtype != nar->dtype) {
+    rb_raise(rb_eTypeError, "the result of %"PRIsVALUE" cannot be stored in %"PRIsVALUE" in place",
+             rb_sym2str(ID2SYM(DTYPE_ID(dtype))), rb_sym2str(ID2SYM(DTYPE_ID(nar->dtype))));
+  }
+
+  ndarray_dtype_t work_dtype = ndarray_binary_work_dtype(op, dtype);
+  if (scalar != Qundef && NDARRAY_BINARY_COMPARISON_P(op) && work_dtype == ndarray_dtype_float32) {
+    /* the real scalars beyond float are compared in double */
+    const double dbl = NUM2DBL(scalar);
+    if (dbl < -FLT_MAX || FLT_MAX < dbl) {
+      work_dtype = ndarray_dtype_float64;
+    }
+  }
+  if (scalar != Qundef) {
+    opnd2.obj = Qnil;
+    opnd2.dtype = work_dtype;
+    opnd2.ndim = 0;
+    opnd2.shape = NULL;
+    opnd2.strides = NULL;
+    opnd2.data = opnd2.scalar;
+    ndarray_set_value(opnd2.scalar, work_dtype, scalar);
+  }
+  else {
+    ndarray_operand_cast(&opnd2, work_dtype);
+  }
+  ndarray_operand_cast(&opnd1, work_dtype);
+
+  const ssize_t ndim = opnd1.ndim > opnd2.ndim ? opnd1.ndim : opnd2.ndim;
+  VALUE heap_buf = 0;
+  ssize_t *buf = RB_ALLOCV_N(ssize_t, heap_buf, 3 * (ndim > 0 ? ndim : 1));
+  ssize_t *shape = buf, *strides1 = buf + ndim, *strides2 = buf + 2 * ndim;
+  ndarray_broadcast(&opnd1, &opnd2, ndim, shape, strides1, strides2);
+
+  VALUE result, tmp = Qnil;
+  uint8_t *result_data;
+  const ssize_t *result_strides;
+  if (inplace_p) {
+    ssize_t i;
+    int same_p = ndim == nar->ndim;
+    for (i = 0; same_p && i < ndim; ++i) same_p = shape[i] == nar->shape[i];
+    if (!same_p) {
+      rb_raise(rb_eArgError, "non-broadcastable output operand with shape %"PRIsVALUE
+               " doesn't match the broadcast shape %"PRIsVALUE,
+               ndarray_shape_to_ary(nar->ndim, nar->shape), ndarray_shape_to_ary(ndim, shape));
+    }
+
+    /* The other operand must be copied if it overlaps with the receiver
+     * in a different layout, or it can be changed while it is read. */
+    if (opnd2.obj != Qnil && !(opnd2.data == nar->data && MEMCMP(strides2, nar->strides, ssize_t, ndim) == 0)) {
+      const uint8_t *lo1, *hi1, *lo2, *hi2;
+      ndarray_operand_extent(&opnd1, &lo1, &hi1);
+      ndarray_operand_extent(&opnd2, &lo2, &hi2);
+      if (lo1 < hi2 && lo2 < hi1) {
+        ndarray_t *nar2;
+        TypedData_Get_Struct(opnd2.obj, ndarray_t, &ndarray_data_type, nar2);
+        ndarray_operand_set_array(&opnd2, ndarray_copy_contiguous(cNDArray, nar2, ndarray_order_row_major));
+        ndarray_broadcast(&opnd1, &opnd2, ndim, shape, strides1, strides2);
+      }
+    }
+
+    result = obj;
+    result_data = nar->data;
+    result_strides = nar->strides;
+  }
+  else {
+    const ndarray_dtype_t result_dtype = NDARRAY_BINARY_COMPARISON_P(op) ? ndarray_dtype_bool : dtype;
+    result = ndarray_new_contiguous(rb_obj_class(obj), result_dtype, ndim, shape, ndarray_order_row_major);
+
+    ndarray_t *nar_result;
+    TypedData_Get_Struct(result, ndarray_t, &ndarray_data_type, nar_result);
+    result_data = nar_result->data;
+    result_strides = nar_result->strides;
+  }
+
+  /* The results computed in the other dtype, or stored in the other byte
+   * order, are stored through a temporary */
+  const int swap_result_p = inplace_p && nar->swapped_p;
+  if ((!NDARRAY_BINARY_COMPARISON_P(op) && work_dtype != dtype) || swap_result_p) {
+    tmp = ndarray_new_contiguous(cNDArray, work_dtype, ndim, shape, ndarray_order_row_major);
+    ndarray_t *nar_tmp;
+    TypedData_Get_Struct(tmp, ndarray_t, &ndarray_data_type, nar_tmp);
+    result_data = nar_tmp->data;
+    result_strides = nar_tmp->strides;
+  }
+
+  ndarray_binary_row_func_t func = ndarray_binary_row_funcs[work_dtype][op];
+  uint8_t *data[3] = { result_data, opnd1.data, opnd2.data };
+  const ssize_t *strides[3] = { result_strides, strides1, strides2 };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 3, data, strides, ndim, shape, 0);
+  const int stop = ndarray_iter_run_parallel(&it, ndarray_binary_kernel, &func);
+  ndarray_iter_release(&it);
+
+  RB_ALLOCV_END(heap_buf);
+  RB_GC_GUARD(opnd1.obj);
+  RB_GC_GUARD(opnd2.obj);
+
+  if (stop) {
+    rb_raise(rb_eZeroDivError, "divided by 0");
+  }
+
+  if (!NIL_P(tmp)) {
+    ndarray_t *nar_tmp, *nar_result;
+    TypedData_Get_Struct(tmp, ndarray_t, &ndarray_data_type, nar_tmp);
+    TypedData_Get_Struct(result, ndarray_t, &ndarray_data_type, nar_result);
+    ndarray_cast_items(nar_result, nar_tmp, 0);
+    if (swap_result_p) {
+      ndarray_byteswap_copy(nar_result->data, nar_result->strides, nar_result->data, nar_result->strides,
+                            nar_result->ndim, nar_result->shape, nar_result->dtype);
+    }
+  }
+
+  return result;
+}
+
+static VALUE
+ndarray_add(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_add, 0);
+}
+
+static VALUE
+ndarray_sub(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_sub, 0);
+}
+
+static VALUE
+ndarray_mul(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_mul, 0);
+}
+
+static VALUE
+ndarray_div(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_div, 0);
+}
+
+static VALUE
+ndarray_lt(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_lt, 0);
+}
+
+static VALUE
+ndarray_le(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_le, 0);
+}
+
+static VALUE
+ndarray_gt(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_gt, 0);
+}
+
+static VALUE
+ndarray_ge(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_ge, 0);
+}
+
+static VALUE
+ndarray_add_bang(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_add, 1);
+}
+
+static VALUE
+ndarray_sub_bang(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_sub, 1);
+}
+
+static VALUE
+ndarray_mul_bang(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_mul, 1);
+}
+
+static VALUE
+ndarray_div_bang(VALUE obj, VALUE other)
+{
+  return ndarray_binary_op(obj, other, ndarray_binary_div, 1);
+}
+
+/* Matrix product
+ *
+ * dot multiplies 1-D and 2-D arrays as numpy.dot: the product of two
+ * matrices, of a matrix and a vector, or the inner product of two vectors.
+ * The operands are converted to their common dtype.  float16 and bfloat16
+ * are computed in float32, and the integers in 64 bits wrapping around and
+ * truncated to their dtype.  bool, complex, and record are not supported.
+ *
+ * The product is computed in the way of GotoBLAS.  A KC x NC panel of the
+ * right operand and an MC x KC block of the left operand are packed into
+ * the buffer of the worker in the order that the micro kernel reads them,
+ * and the micro kernel keeps an MR x NR block of the result in registers.
+ * As the operands are read through their strides only by the packing, the
+ * row-major and the column-major operands are multiplied at the same
+ * speed.  The result is computed in parallel when it has at least
+ * parallel_threshold items, and the workers compute the ranges of the
+ * items of the row-major result each. */
+
+#define NDARRAY_MATMUL_MC 64
+#define NDARRAY_MATMUL_KC 256
+#define NDARRAY_MATMUL_NC 1024
+
+typedef struct ndarray_matmul_arg ndarray_matmul_arg_t;
+
+/* Compute the items of the result in [i0, i1) x [j0, j1) */
+typedef void (*ndarray_matmul_block_func_t)(const ndarray_matmul_arg_t *arg, uint8_t *pack,
+                                            const ssize_t i0, const ssize_t i1,
+                                            const ssize_t j0, const ssize_t j1);
+
+struct ndarray_matmul_arg {
+  ndarray_matmul_block_func_t func;
+  const uint8_t *a, *b;  /* the m x k and the k x n operands */
+  ssize_t a_strides[2], b_strides[2];
+  uint8_t *c;            /* the row-major m x n result */
+  ssize_t item_size;
+  ssize_t m, n, k;
+  uint8_t *packs;        /* the buffers of the workers */
+  ssize_t pack_size;
+  ssize_t pack_b_offset; /* the offset of the panel of b in a buffer */
+  const ndarray_matmul_arg_t *args;
+};
+
+#define MATMUL_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define DEFINE_MATMUL_FUNCS(name, type, MR, NR) \
+static const ssize_t ndarray_matmul_mr_##name = MR, ndarray_matmul_nr_##name = NR; \
+static void \
+ndarray_matmul_pack_a_##name(type *dst, const uint8_t *a, const ssize_t s0, const ssize_t s1, \
+                             const ssize_t mc, const ssize_t kc) \
+{ \
+  ssize_t ir, i, p; \
+  for (ir = 0; ir < mc; ir += MR) { \
+    const ssize_t mr = MATMUL_MIN(mc - ir, MR); \
+    for (p = 0; p < kc; ++p, dst += MR) { \
+      const uint8_t *q = a + ir * s0 + p * s1; \
+      for (i = 0; i < mr; ++i) dst[i] = *(const type *)(q + i * s0); \
+      for (; i < MR; ++i) dst[i] = 0; \
+    } \
+  } \
+} \
+static void \
+ndarray_matmul_pack_b_##name(type *dst, const uint8_t *b, const ssize_t s0, const ssize_t s1, \
+                             const ssize_t kc, const ssize_t nc) \
+{ \
+  ssize_t jr, j, p; \
+  for (jr = 0; jr < nc; jr += NR) { \
+    const ssize_t nr = MATMUL_MIN(nc - jr, NR); \
+    for (p = 0; p < kc; ++p, dst += NR) { \
+      const uint8_t *q = b + p * s0 + jr * s1; \
+      for (j = 0; j < nr; ++j) dst[j] = *(const type *)(q + j * s1); \
+      for (; j < NR; ++j) dst[j] = 0; \
+    } \
+  } \
+} \
+static inline void \
+ndarray_matmul_micro_##name(const ssize_t kc, const type *ap, const type *bp, uint8_t *c, const ssize_t cs, \
+                            const ssize_t mr, const ssize_t nr, const int first) \
+{ \
+  type acc[MR][NR] = {{ 0 }}; \
+  ssize_t i, j, p; \
+  for (p = 0; p < kc; ++p, ap += MR, bp += NR) { \
+    for (i = 0; i < MR; ++i) { \
+      for (j = 0; j < NR; ++j) acc[i][j] += ap[i] * bp[j]; \
+    } \
+  } \
+  for (i = 0; i < mr; ++i) { \
+    type *ci = (type *)(c + i * cs); \
+    for (j = 0; j < nr; ++j) ci[j] = first ? acc[i][j] : ci[j] + acc[i][j]; \
+  } \
+} \
+static void \
+ndarray_matmul_block_##name(const ndarray_matmul_arg_t *arg, uint8_t *pack, \
+                            const ssize_t i0, const ssize_t i1, const ssize_t j0, const ssize_t j1) \
+{ \
+  type *ap = (type *)pack, *bp = (type *)(pack + arg->pack_b_offset); \
+  const ssize_t cs = arg->n * (ssize_t)sizeof(type); \
+  ssize_t ic, jc, pc, ir, jr; \
+  for (jc = j0; jc < j1; jc += NDARRAY_MATMUL_NC) { \
+    const ssize_t nc = MATMUL_MIN(j1 - jc, NDARRAY_MATMUL_NC); \
+    for (pc = 0; pc < arg->k; pc += NDARRAY_MATMUL_KC) { \
+      const ssize_t kc = MATMUL_MIN(arg->k - pc, NDARRAY_MATMUL_KC); \
+      ndarray_matmul_pack_b_##name(bp, arg->b + pc * arg->b_strides[0] + jc * arg->b_strides[1], \
+                                   arg->b_strides[0], arg->b_strides[1], kc, nc); \
+      for (ic = i0; ic < i1; ic += NDARRAY_MATMUL_MC) { \
+        const ssize_t mc = MATMUL_MIN(i1 - ic, NDARRAY_MATMUL_MC); \
+        ndarray_matmul_pack_a_##name(ap, arg->a + ic * arg->a_strides[0] + pc * arg->a_strides[1], \
+                                     arg->a_strides[0], arg->a_strides[1], mc, kc); \
+        for (jr = 0; jr < nc; jr += NR) { \
+          for (ir = 0; ir < mc; ir += MR) { \
+            ndarray_matmul_micro_##name(kc, ap + ir * kc, bp + jr * kc, \
+                                        arg->c + (ic + ir) * cs + (jc + jr) * (ssize_t)sizeof(type), cs, \
+                                        MATMUL_MIN(mc - ir, MR), MATMUL_MIN(nc - jr, NR), pc == 0); \
+          } \
+        } \
+      } \
+    } \
+  } \
+}
+
+DEFINE_MATMUL_FUNCS(float32, float, 4, 8)
+DEFINE_MATMUL_FUNCS(float64, double, 4, 8)
+/* int64 is computed as uint64 not to overflow */
+DEFINE_MATMUL_FUNCS(uint64, uint64_t, 4, 4)
+
+#undef DEFINE_MATMUL_FUNCS
+
+/* ptrs[0] is the result.  The ranges of the workers can start and end in
+ * the middle of rows. */
+static int
+ndarray_matmul_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t len, void *ptr)
+{
+  const ndarray_matmul_arg_t *arg = ptr;
+  uint8_t *pack = arg->packs + (arg - arg->args) * arg->pack_size;
+  const ssize_t n = arg->n;
+  const ssize_t begin = (ptrs[0] - arg->c) / arg->item_size, end = begin + len;
+
+  ssize_t i = begin / n;
+  if (begin % n > 0) {
+    arg->func(arg, pack, i, i + 1, begin % n, MATMUL_MIN(end - i * n, n));
+    ++i;
+  }
+  if (i < end / n) {
+    arg->func(arg, pack, i, end / n, 0, n);
+  }
+  if (end % n > 0 && i <= end / n) {
+    arg->func(arg, pack, end / n, end / n + 1, 0, end % n);
+  }
+  return 0;
+}
+
+/* The dtype in which the product of dtype is computed */
+static ndarray_dtype_t
+ndarray_matmul_work_dtype(const ndarray_dtype_t dtype)
+{
+  switch (dtype) {
+    case ndarray_dtype_float16:
+    case ndarray_dtype_bfloat16:
+    case ndarray_dtype_float32:
+      return ndarray_dtype_float32;
+    case ndarray_dtype_float64:
+      return ndarray_dtype_float64;
     case ndarray_dtype_int8:
-      return INT2NUM(*(int8_t *)value_ptr);
+    case ndarray_dtype_int16:
+    case ndarray_dtype_int32:
+    case ndarray_dtype_int64:
+      return ndarray_dtype_int64;
     case ndarray_dtype_uint8:
-      return UINT2NUM(*(uint8_t *)value_ptr);
+    case ndarray_dtype_uint16:
+    case ndarray_dtype_uint32:
+    case ndarray_dtype_uint64:
+      return ndarray_dtype_uint64;
+    default:
+      rb_raise(rb_eTypeError, "dot is not supported for %"PRIsVALUE" arrays",
+               rb_sym2str(ID2SYM(DTYPE_ID(dtype))));
+  }
+}
+
+/* Compute the product of the m x k matrix a and the k x n matrix b in the
+ * row-major c of work_dtype */
+static void
+ndarray_matmul(const ndarray_t *nar_c, const ndarray_dtype_t work_dtype,
+               const uint8_t *a, const ssize_t *a_strides, const uint8_t *b, const ssize_t *b_strides,
+               const ssize_t m, const ssize_t n, const ssize_t k)
+{
+  ndarray_matmul_arg_t args[NDARRAY_MAX_THREADS];
+  ndarray_matmul_arg_t *arg = &args[0];
+  ssize_t mr, nr;
+  switch (work_dtype) {
+    case ndarray_dtype_float32:
+      arg->func = ndarray_matmul_block_float32;
+      mr = ndarray_matmul_mr_float32, nr = ndarray_matmul_nr_float32;
+      break;
+    case ndarray_dtype_float64:
+      arg->func = ndarray_matmul_block_float64;
+      mr = ndarray_matmul_mr_float64, nr = ndarray_matmul_nr_float64;
+      break;
+    default:
+      arg->func = ndarray_matmul_block_uint64;
+      mr = ndarray_matmul_mr_uint64, nr = ndarray_matmul_nr_uint64;
+      break;
+  }
+
+  if (m == 0 || n == 0)
+    return;
+  if (k == 0) {
+    memset(nar_c->data, 0, nar_c->byte_size);
+    return;
+  }
+
+  arg->a = a;
+  arg->a_strides[0] = a_strides[0];
+  arg->a_strides[1] = a_strides[1];
+  arg->b = b;
+  arg->b_strides[0] = b_strides[0];
+  arg->b_strides[1] = b_strides[1];
+  arg->c = nar_c->data;
+  arg->item_size = nar_c->item_size;
+  arg->m = m;
+  arg->n = n;
+  arg->k = k;
+  arg->args = args;
+
+  /* the buffers are as large as the blocks of these operands, aligned
+   * to 64 bytes */
+  const ssize_t mc = MATMUL_MIN((m + mr - 1) / mr * mr, NDARRAY_MATMUL_MC);
+  const ssize_t nc = MATMUL_MIN((n + nr - 1) / nr * nr, NDARRAY_MATMUL_NC);
+  const ssize_t kc = MATMUL_MIN(k, NDARRAY_MATMUL_KC);
+  arg->pack_b_offset = (mc * kc * arg->item_size + 63) & ~(ssize_t)63;
+  arg->pack_size = arg->pack_b_offset + ((kc * nc * arg->item_size + 63) & ~(ssize_t)63);
+
+  VALUE packs_buf = 0;
+  uint8_t *packs = RB_ALLOCV_N(uint8_t, packs_buf, arg->pack_size * ndarray_num_threads + 63);
+  arg->packs = (uint8_t *)(((uintptr_t)packs + 63) & ~(uintptr_t)63);
+
+  const ssize_t shape = m * n, stride = arg->item_size;
+  uint8_t *data[1] = { nar_c->data };
+  const ssize_t *strides[1] = { &stride };
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 1, data, strides, 1, &shape, NDARRAY_ITER_KEEP_ORDER);
+  ndarray_iter_run_parallel_private(&it, ndarray_matmul_kernel, args, sizeof(ndarray_matmul_arg_t));
+  ndarray_iter_release(&it);
+
+  RB_ALLOCV_END(packs_buf);
+}
+
+#undef MATMUL_MIN
+
+static VALUE
+ndarray_dot(VALUE obj, VALUE other)
+{
+  if (!rb_typeddata_is_kind_of(other, &ndarray_data_type)) {
+    other = rb_funcall(cNDArray, rb_intern("try_convert"), 1, other);
+  }
+
+  ndarray_operand_t opnd1, opnd2;
+  ndarray_operand_set_array(&opnd1, obj);
+  ndarray_operand_set_array(&opnd2, other);
+  if (opnd1.ndim < 1 || 2 < opnd1.ndim || opnd2.ndim < 1 || 2 < opnd2.ndim) {
+    rb_raise(rb_eArgError, "dot is supported only for 1-D and 2-D arrays (%"PRIdSIZE"-D and %"PRIdSIZE"-D given)",
+             opnd1.ndim, opnd2.ndim);
+  }
+
+  /* a vector is multiplied as a row on the left and as a column on the
+   * right */
+  const ssize_t m = opnd1.ndim == 2 ? opnd1.shape[0] : 1;
+  const ssize_t k = opnd1.shape[opnd1.ndim - 1];
+  const ssize_t n = opnd2.ndim == 2 ? opnd2.shape[1] : 1;
+  if (opnd2.shape[0] != k) {
+    rb_raise(rb_eArgError, "shapes %"PRIsVALUE" and %"PRIsVALUE" not aligned: %"PRIdSIZE" (dim %"PRIdSIZE") != %"PRIdSIZE" (dim 0)",
+             ndarray_shape_to_ary(opnd1.ndim, opnd1.shape), ndarray_shape_to_ary(opnd2.ndim, opnd2.shape),
+             k, opnd1.ndim - 1, opnd2.shape[0]);
+  }
+
+  const ndarray_dtype_t dtype = ndarray_promote_dtype(opnd1.dtype, opnd2.dtype);
+  const ndarray_dtype_t work_dtype = ndarray_matmul_work_dtype(dtype);
+  ndarray_operand_cast(&opnd1, work_dtype);
+  ndarray_operand_cast(&opnd2, work_dtype);
+
+  const ssize_t a_strides[2] = { opnd1.ndim == 2 ? opnd1.strides[0] : 0, opnd1.strides[opnd1.ndim - 1] };
+  const ssize_t b_strides[2] = { opnd2.strides[0], opnd2.ndim == 2 ? opnd2.strides[1] : 0 };
+
+  ssize_t shape[2], ndim = 0;
+  if (opnd1.ndim == 2) shape[ndim++] = m;
+  if (opnd2.ndim == 2) shape[ndim++] = n;
+
+  VALUE result = ndarray_new_contiguous(rb_obj_class(obj), work_dtype, ndim, shape, ndarray_order_row_major);
+  ndarray_t *nar_result;
+  TypedData_Get_Struct(result, ndarray_t, &ndarray_data_type, nar_result);
+  ndarray_matmul(nar_result, work_dtype, opnd1.data, a_strides, opnd2.data, b_strides, m, n, k);
+  RB_GC_GUARD(opnd1.obj);
+  RB_GC_GUARD(opnd2.obj);
+
+  if (dtype != work_dtype) {
+    VALUE tmp = result;
+    const ndarray_t *nar_tmp = nar_result;
+    result = ndarray_new_contiguous(rb_obj_class(obj), dtype, ndim, shape, ndarray_order_row_major);
+    TypedData_Get_Struct(result, ndarray_t, &ndarray_data_type, nar_result);
+    ndarray_cast_items(nar_result, nar_tmp, 0);
+    RB_GC_GUARD(tmp);
+  }
+
+  if (ndim == 0) {
+    return ndarray_get_value(nar_result->data, dtype);
+  }
+  return result;
+}
+
+/* Generators
+ *
+ * The generators compute the items of a new row-major array from their
+ * positions into a chunk of int64_t, uint64_t, double, or
+ * ndarray_complex128_t values, and store the chunk to the items by the
+ * cast row function of the dtype.  As the items depend only on their
+ * positions, the results don't depend on the number of the workers.
+ *
+ * The random numbers are drawn from PCG32 (XSH RR 64/32).  Its state is
+ * advanced to any position in O(log n) steps, so each worker starts the
+ * stream at the position of its first item.  An item takes one 64-bit
+ * word of two outputs for a uniform value, two words for a normal value
+ * by Box-Muller transform, and twice as many words for a complex. */
+
+#define NDARRAY_GENERATE_CHUNK_SIZE 256
+
+#define PCG32_MULTIPLIER UINT64_C(6364136223846793005)
+#define PCG32_INCREMENT UINT64_C(1442695040888963407)
+
+static inline uint32_t
+ndarray_pcg32_next(uint64_t *state)
+{
+  const uint64_t old = *state;
+  *state = old * PCG32_MULTIPLIER + PCG32_INCREMENT;
+  const uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+  const uint32_t rot = (uint32_t)(old >> 59);
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+static inline uint64_t
+ndarray_pcg32_next64(uint64_t *state)
+{
+  const uint64_t hi = ndarray_pcg32_next(state);
+  return (hi << 32) | ndarray_pcg32_next(state);
+}
+
+/* The state after delta steps, by the method of F. Brown, "Random Number
+ * Generation with Arbitrary Strides" */
+static uint64_t
+ndarray_pcg32_advance(uint64_t state, uint64_t delta)
+{
+  uint64_t cur_mult = PCG32_MULTIPLIER, cur_plus = PCG32_INCREMENT;
+  uint64_t acc_mult = 1, acc_plus = 0;
+  while (delta > 0) {
+    if (delta & 1) {
+      acc_mult *= cur_mult;
+      acc_plus = acc_plus * cur_mult + cur_plus;
+    }
+    cur_plus = (cur_mult + 1) * cur_plus;
+    cur_mult *= cur_mult;
+    delta >>= 1;
+  }
+  return acc_mult * state + acc_plus;
+}
+
+static uint64_t
+ndarray_pcg32_seed(const uint64_t seed)
+{
+  uint64_t state = 0;
+  ndarray_pcg32_next(&state);
+  state += seed;
+  ndarray_pcg32_next(&state);
+  return state;
+}
+
+/* A double in [0, 1) of the upper 53 bits of w */
+static inline double
+ndarray_word_to_unit(const uint64_t w)
+{
+  return (double)(w >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* The upper 64 bits of x * y */
+static inline uint64_t
+ndarray_mulhi64(const uint64_t x, const uint64_t y)
+{
+  const uint64_t x_lo = x & 0xffffffff, x_hi = x >> 32;
+  const uint64_t y_lo = y & 0xffffffff, y_hi = y >> 32;
+  const uint64_t hi_lo = x_hi * y_lo;
+  const uint64_t cross = ((x_lo * y_lo) >> 32) + (hi_lo & 0xffffffff) + x_lo * y_hi;
+  return x_hi * y_hi + (hi_lo >> 32) + (cross >> 32);
+}
+
+/* A standard normal value from two words */
+static inline double
+ndarray_words_to_normal(const uint64_t w1, const uint64_t w2)
+{
+  /* u1 is in (0, 1] not to take the log of 0 */
+  const double u1 = ((double)(w1 >> 11) + 1.0) * (1.0 / 9007199254740992.0);
+  const double u2 = ndarray_word_to_unit(w2);
+  return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+}
+
+typedef struct ndarray_generate_arg ndarray_generate_arg_t;
+
+/* Write the values of n items from the index-th item to out */
+typedef void (*ndarray_generate_row_func_t)(const ndarray_generate_arg_t *arg, const ssize_t index,
+                                            const ssize_t n, void *out);
+
+struct ndarray_generate_arg {
+  ndarray_generate_row_func_t func;
+  ndarray_cast_row_func_t cast;
+  ssize_t value_size;
+
+  /* the head of the items and the item size to know the positions */
+  const uint8_t *data;
+  ssize_t item_size;
+
+  /* start + i * step for the sequences, where the last-th item is stop if
+   * last is not negative.  start is the lowest value, and step is the
+   * width of the interval for the uniform values; the width 0 means 2**64
+   * for integers. */
+  union {
+    uint64_t u;
+    double f;
+  } start, step;
+  double stop;
+  ssize_t last;
+
+  /* the PCG32 state at the head */
+  uint64_t state;
+};
+
+static void
+ndarray_generate_arange_integer(const ndarray_generate_arg_t *arg, const ssize_t index,
+                                const ssize_t n, void *out)
+{
+  uint64_t *o = out;
+  ssize_t i;
+  /* computed in uint64_t to wrap around in two's complement */
+  for (i = 0; i < n; ++i) {
+    o[i] = arg->start.u + (uint64_t)(index + i) * arg->step.u;
+  }
+}
+
+static void
+ndarray_generate_arange_float(const ndarray_generate_arg_t *arg, const ssize_t index,
+                              const ssize_t n, void *out)
+{
+  double *o = out;
+  ssize_t i;
+  for (i = 0; i < n; ++i) {
+    o[i] = arg->start.f + (double)(index + i) * arg->step.f;
+  }
+  if (index <= arg->last && arg->last < index + n) {
+    o[arg->last - index] = arg->stop;
+  }
+}
+
+static void
+ndarray_generate_uniform_integer(const ndarray_generate_arg_t *arg, const ssize_t index,
+                                 const ssize_t n, void *out)
+{
+  uint64_t *o = out;
+  uint64_t state = ndarray_pcg32_advance(arg->state, 2 * (uint64_t)index);
+  ssize_t i;
+  for (i = 0; i < n; ++i) {
+    const uint64_t w = ndarray_pcg32_next64(&state);
+    o[i] = arg->start.u + (arg->step.u == 0 ? w : ndarray_mulhi64(w, arg->step.u));
+  }
+}
+
+static void
+ndarray_generate_uniform_float(const ndarray_generate_arg_t *arg, const ssize_t index,
+                               const ssize_t n, void *out)
+{
+  double *o = out;
+  uint64_t state = ndarray_pcg32_advance(arg->state, 2 * (uint64_t)index);
+  ssize_t i;
+  for (i = 0; i < n; ++i) {
+    o[i] = arg->start.f + arg->step.f * ndarray_word_to_unit(ndarray_pcg32_next64(&state));
+  }
+}
+
+static void
+ndarray_generate_uniform_complex(const ndarray_generate_arg_t *arg, const ssize_t index,
+                                 const ssize_t n, void *out)
+{
+  ndarray_complex128_t *o = out;
+  uint64_t state = ndarray_pcg32_advance(arg->state, 4 * (uint64_t)index);
+  ssize_t i;
+  for (i = 0; i < n; ++i) {
+    o[i].re = arg->start.f + arg->step.f * ndarray_word_to_unit(ndarray_pcg32_next64(&state));
+    o[i].im = arg->start.f + arg->step.f * ndarray_word_to_unit(ndarray_pcg32_next64(&state));
+  }
+}
+
+static void
+ndarray_generate_normal_float(const ndarray_generate_arg_t *arg, const ssize_t index,
+                              const ssize_t n, void *out)
+{
+  double *o = out;
+  uint64_t state = ndarray_pcg32_advance(arg->state, 4 * (uint64_t)index);
+  ssize_t i;
+  for (i = 0; i < n; ++i) {
+    const uint64_t w1 = ndarray_pcg32_next64(&state);
+    o[i] = ndarray_words_to_normal(w1, ndarray_pcg32_next64(&state));
+  }
+}
+
+static void
+ndarray_generate_normal_complex(const ndarray_generate_arg_t *arg, const ssize_t index,
+                                const ssize_t n, void *out)
+{
+  ndarray_complex128_t *o = out;
+  uint64_t state = ndarray_pcg32_advance(arg->state, 8 * (uint64_t)index);
+  ssize_t i;
+  for (i = 0; i < n; ++i) {
+    uint64_t w1 = ndarray_pcg32_next64(&state);
+    o[i].re = ndarray_words_to_normal(w1, ndarray_pcg32_next64(&state));
+    w1 = ndarray_pcg32_next64(&state);
+    o[i].im = ndarray_words_to_normal(w1, ndarray_pcg32_next64(&state));
+  }
+}
+
+static int
+ndarray_generate_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *arg)
+{
+  const ndarray_generate_arg_t *gen_arg = arg;
+  ndarray_complex128_t chunk[NDARRAY_GENERATE_CHUNK_SIZE];
+  /* the items are in the row-major order from data */
+  const ssize_t index = (ptrs[0] - gen_arg->data) / gen_arg->item_size;
+  ssize_t i;
+  for (i = 0; i < n; i += NDARRAY_GENERATE_CHUNK_SIZE) {
+    const ssize_t len = n - i < NDARRAY_GENERATE_CHUNK_SIZE ? n - i : NDARRAY_GENERATE_CHUNK_SIZE;
+    gen_arg->func(gen_arg, index + i, len, chunk);
+    gen_arg->cast((const uint8_t *)chunk, gen_arg->value_size, ptrs[0] + i * strides[0], strides[0], len, 0);
+  }
+  return 0;
+}
+
+/* Write the items of the row-major array nar by arg, where src_dtype is
+ * the dtype of the values written by arg->func */
+static void
+ndarray_generate(const ndarray_t *nar, ndarray_generate_arg_t *arg, const ndarray_dtype_t src_dtype)
+{
+  arg->cast = ndarray_cast_row_funcs[src_dtype][nar->dtype];
+  arg->value_size = src_dtype == ndarray_dtype_complex128 ? sizeof(ndarray_complex128_t) : sizeof(uint64_t);
+  arg->data = nar->data;
+  arg->item_size = nar->item_size;
+
+  uint8_t *data[1] = { nar->data };
+  const ssize_t *strides[1] = { nar->strides };
+
+  ndarray_iter_t it;
+  ndarray_iter_init(&it, 1, data, strides, nar->ndim, nar->shape, 0);
+  ndarray_iter_run_parallel(&it, ndarray_generate_kernel, arg);
+  ndarray_iter_release(&it);
+}
+
+/* Make a new array of the given shape for the generator of the name */
+static VALUE
+ndarray_new_for_generator(VALUE klass, VALUE shape_ary, const ndarray_dtype_t dtype,
+                          const ndarray_order_t order, const char *name)
+{
+  ndarray_check_shape(shape_ary);
+  if (dtype == ndarray_dtype_record) {
+    rb_raise(rb_eTypeError, "%s is not supported for record arrays", name);
+  }
 
-    case ndarray_dtype_int16:
-      return INT2NUM(*(int16_t *)value_ptr);
-    case ndarray_dtype_uint16:
-      return UINT2NUM(*(uint16_t *)value_ptr);
+  VALUE obj = ndarray_s_allocate(klass);
 
-    case ndarray_dtype_int32:
-      return LONG2NUM(*(int32_t *)value_ptr);
-    case ndarray_dtype_uint32:
-      return ULONG2NUM(*(uint32_t *)value_ptr);
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
 
-    case ndarray_dtype_int64:
-      return LL2NUM(*(int64_t *)value_ptr);
-    case ndarray_dtype_uint64:
-      return ULL2NUM(*(uint64_t *)value_ptr);
+  const ssize_t byte_size = ndarray_init_layout(nar, shape_ary, dtype, Qnil, order);
+  ndarray_alloc_data(nar, byte_size, NDARRAY_DEFAULT_ALIGNMENT);
 
-    case ndarray_dtype_float32:
-      return DBL2NUM(*(float *)value_ptr);
-    case ndarray_dtype_float64:
-      return DBL2NUM(*(double *)value_ptr);
+  return obj;
+}
+
+/* Raise RangeError if the value of src_dtype at value_ptr cannot be an
+ * item of dtype */
+static void
+ndarray_generate_check_value(const uint8_t *value_ptr, const ndarray_dtype_t src_dtype,
+                             const ndarray_dtype_t dtype)
+{
+  ndarray_item_buf_t tmp;
+  if (ndarray_cast_row_funcs[src_dtype][dtype](value_ptr, 0, tmp.bytes, 0, 1, 1)) {
+    rb_raise(rb_eRangeError, "%"PRIsVALUE" is out of the range of %"PRIsVALUE,
+             ndarray_get_value(value_ptr, src_dtype), rb_sym2str(ID2SYM(DTYPE_ID(dtype))));
+  }
+}
+
+/* Convert an end of the range of the integer dtype to the value in two's
+ * complement, or return dflt for nil */
+static uint64_t
+ndarray_range_end_to_integer(VALUE v, const ndarray_dtype_t dtype, const uint64_t dflt)
+{
+  if (NIL_P(v)) {
+    return dflt;
+  }
+  if (!RB_INTEGER_TYPE_P(v)) {
+    rb_raise(rb_eTypeError, "the range of %"PRIsVALUE" must be of integers (%"PRIsVALUE" given)",
+             rb_sym2str(ID2SYM(DTYPE_ID(dtype))), rb_obj_class(v));
+  }
+
+  uint64_t u;
+  if (FIXNUM_P(v) ? FIX2LONG(v) < 0 : RBIGNUM_NEGATIVE_P(v)) {
+    const int64_t i = NUM2LL(v);
+    ndarray_generate_check_value((const uint8_t *)&i, ndarray_dtype_int64, dtype);
+    u = (uint64_t)i;
+  }
+  else {
+    u = NUM2ULL(v);
+    ndarray_generate_check_value((const uint8_t *)&u, ndarray_dtype_uint64, dtype);
+  }
+  return u;
+}
+
+/* Set the lowest value and the width of the interval of the uniform
+ * integers to arg.  The range is the whole range of dtype for nil. */
+static void
+ndarray_set_uniform_integer_range(ndarray_generate_arg_t *arg, VALUE range, const ndarray_t *nar)
+{
+  const ndarray_dtype_t dtype = nar->dtype;
+  const int bits = (int)nar->item_size * CHAR_BIT;
+  const int signed_p = ndarray_dtype_scalar_kind(dtype) == ndarray_scalar_signed;
+  const uint64_t min = signed_p ? (uint64_t)0 - ((uint64_t)1 << (bits - 1)) : 0;
+  const uint64_t max = signed_p ? ((uint64_t)1 << (bits - 1)) - 1 :
+                       bits == 64 ? UINT64_MAX : ((uint64_t)1 << bits) - 1;
+
+  uint64_t lo = min, hi = max;
+  if (!NIL_P(range)) {
+    VALUE beg, end;
+    int excl;
+    if (!rb_range_values(range, &beg, &end, &excl)) {
+      rb_raise(rb_eTypeError, "range must be a Range (%"PRIsVALUE" given)", rb_obj_class(range));
+    }
+    if (excl && !NIL_P(end)) {
+      end = rb_funcall(end, '-', 1, INT2FIX(1));
+    }
+    lo = ndarray_range_end_to_integer(beg, dtype, min);
+    hi = ndarray_range_end_to_integer(end, dtype, max);
+    if (signed_p ? (int64_t)hi < (int64_t)lo : hi < lo) {
+      rb_raise(rb_eArgError, "empty range (%+"PRIsVALUE")", range);
+    }
+  }
+
+  arg->start.u = lo;
+  arg->step.u = hi - lo + 1;
+}
+
+/* Set the lower end and the width of the interval of the uniform floats
+ * to arg.  The interval is [0, 1) for nil. */
+static void
+ndarray_set_uniform_float_range(ndarray_generate_arg_t *arg, VALUE range, const ndarray_dtype_t dtype)
+{
+  arg->start.f = 0.0;
+  arg->step.f = 1.0;
+  if (NIL_P(range)) {
+    return;
+  }
+
+  VALUE beg, end;
+  int excl;
+  if (!rb_range_values(range, &beg, &end, &excl)) {
+    rb_raise(rb_eTypeError, "range must be a Range (%"PRIsVALUE" given)", rb_obj_class(range));
+  }
+  if (NIL_P(beg) || NIL_P(end)) {
+    rb_raise(rb_eArgError, "range must have both ends for %"PRIsVALUE" (%+"PRIsVALUE" given)",
+             rb_sym2str(ID2SYM(DTYPE_ID(dtype))), range);
+  }
+
+  const double lo = NUM2DBL(beg), hi = NUM2DBL(end);
+  if (!isfinite(lo) || !isfinite(hi) || hi < lo || (excl && hi == lo)) {
+    rb_raise(rb_eArgError, "empty or infinite range (%+"PRIsVALUE")", range);
+  }
+  arg->start.f = lo;
+  arg->step.f = hi - lo;
+}
+
+static VALUE
+ndarray_s_random_impl(VALUE klass, VALUE shape_ary, VALUE dtype_name, VALUE order_name,
+                      VALUE seed, VALUE distribution, VALUE range)
+{
+  const ndarray_dtype_t dtype = ndarray_obj_to_dtype_t(dtype_name);
+  const ndarray_order_t order = ndarray_obj_to_order_t(order_name);
+  const VALUE dist = param_to_symbol(distribution, "distribution");
+  const bool normal_p = dist == sym_normal;
+  if (!normal_p && dist != sym_uniform) {
+    rb_raise(rb_eArgError, "unknown distribution (%+"PRIsVALUE")", distribution);
+  }
+
+  VALUE obj = ndarray_new_for_generator(klass, shape_ary, dtype, ndarray_order_row_major, "random");
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  ndarray_generate_arg_t arg = { 0 };
+  arg.last = -1;
+  arg.state = ndarray_pcg32_seed(NUM2ULL(seed));
+
+  ndarray_dtype_t src_dtype;
+  const bool complex_p = ndarray_dtype_is_complex(dtype);
+  if (normal_p) {
+    if (ndarray_dtype_is_integer(dtype) || dtype == ndarray_dtype_bool) {
+      rb_raise(rb_eArgError, "the normal distribution is not available for %"PRIsVALUE,
+               rb_sym2str(ID2SYM(DTYPE_ID(dtype))));
+    }
+    if (!NIL_P(range)) {
+      rb_raise(rb_eArgError, "range is not available for the normal distribution");
+    }
+    arg.func = complex_p ? ndarray_generate_normal_complex : ndarray_generate_normal_float;
+    src_dtype = complex_p ? ndarray_dtype_complex128 : ndarray_dtype_float64;
+  }
+  else if (dtype == ndarray_dtype_bool) {
+    if (!NIL_P(range)) {
+      rb_raise(rb_eArgError, "range is not available for bool");
+    }
+    arg.start.u = 0;
+    arg.step.u = 2;
+    arg.func = ndarray_generate_uniform_integer;
+    src_dtype = ndarray_dtype_uint64;
+  }
+  else if (ndarray_dtype_is_integer(dtype)) {
+    ndarray_set_uniform_integer_range(&arg, range, nar);
+    arg.func = ndarray_generate_uniform_integer;
+    src_dtype = ndarray_dtype_uint64;
+  }
+  else {
+    ndarray_set_uniform_float_range(&arg, range, dtype);
+    arg.func = complex_p ? ndarray_generate_uniform_complex : ndarray_generate_uniform_float;
+    src_dtype = complex_p ? ndarray_dtype_complex128 : ndarray_dtype_float64;
+  }
+
+  ndarray_generate(nar, &arg, src_dtype);
+
+  if (order == ndarray_order_column_major) {
+    obj = ndarray_copy_contiguous(klass, nar, order);
+  }
+  return obj;
+}
+
+static VALUE
+ndarray_s_arange_impl(VALUE klass, VALUE start, VALUE stop, VALUE step, VALUE dtype_name)
+{
+  const bool integer_p = RB_INTEGER_TYPE_P(start) && RB_INTEGER_TYPE_P(stop) && RB_INTEGER_TYPE_P(step);
+  const ndarray_dtype_t dtype = NIL_P(dtype_name) ?
+    (integer_p ? ndarray_dtype_int64 : ndarray_dtype_float64) : ndarray_obj_to_dtype_t(dtype_name);
+
+  ndarray_generate_arg_t arg = { 0 };
+  arg.last = -1;
+
+  ssize_t n;
+  ndarray_dtype_t src_dtype;
+  if (integer_p) {
+    const int64_t s = NUM2LL(start), e = NUM2LL(stop), d = NUM2LL(step);
+    if (d == 0) {
+      rb_raise(rb_eArgError, "step must not be zero");
+    }
+    /* the differences are taken in uint64_t not to overflow */
+    uint64_t count = 0;
+    if (d > 0 && s < e) {
+      count = ((uint64_t)e - (uint64_t)s - 1) / (uint64_t)d + 1;
+    }
+    else if (d < 0 && e < s) {
+      count = ((uint64_t)s - (uint64_t)e - 1) / ((uint64_t)0 - (uint64_t)d) + 1;
+    }
+    if (count > (uint64_t)SSIZE_MAX) {
+      rb_raise(rb_eArgError, "too many items (%"PRIu64")", count);
+    }
+    n = (ssize_t)count;
+    arg.start.u = (uint64_t)s;
+    arg.step.u = (uint64_t)d;
+    arg.func = ndarray_generate_arange_integer;
+    src_dtype = ndarray_dtype_int64;
+  }
+  else {
+    const double s = NUM2DBL(start), e = NUM2DBL(stop), d = NUM2DBL(step);
+    if (d == 0.0) {
+      rb_raise(rb_eArgError, "step must not be zero");
+    }
+    const double count = ceil((e - s) / d);
+    if (isnan(count) || count >= (double)SSIZE_MAX) {
+      rb_raise(rb_eArgError, "invalid number of items (%"PRIsVALUE")", DBL2NUM(count));
+    }
+    n = count > 0 ? (ssize_t)count : 0;
+    arg.start.f = s;
+    arg.step.f = d;
+    arg.func = ndarray_generate_arange_float;
+    src_dtype = ndarray_dtype_float64;
+  }
+
+  VALUE obj = ndarray_new_for_generator(klass, rb_ary_new_from_args(1, SSIZET2NUM(n)), dtype,
+                                        ndarray_order_row_major, "arange");
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  /* the first and the last items are the extremes */
+  if (n > 0 && ndarray_dtype_is_integer(dtype)) {
+    uint64_t ends[2];
+    arg.func(&arg, 0, 1, &ends[0]);
+    arg.func(&arg, n - 1, 1, &ends[1]);
+    ndarray_generate_check_value((const uint8_t *)&ends[0], src_dtype, dtype);
+    ndarray_generate_check_value((const uint8_t *)&ends[1], src_dtype, dtype);
+  }
+
+  ndarray_generate(nar, &arg, src_dtype);
+  return obj;
+}
+
+static VALUE
+ndarray_s_linspace_impl(VALUE klass, VALUE start, VALUE stop, VALUE num, VALUE dtype_name, VALUE endpoint)
+{
+  const ndarray_dtype_t dtype = ndarray_obj_to_dtype_t(dtype_name);
+  const ssize_t n = NUM2SSIZET(num);
+  if (n < 0) {
+    rb_raise(rb_eArgError, "the number of items must not be negative (%"PRIdSIZE" given)", n);
+  }
+
+  const double s = NUM2DBL(start), e = NUM2DBL(stop);
+  const ssize_t div = RTEST(endpoint) ? n - 1 : n;
+
+  ndarray_generate_arg_t arg = { 0 };
+  arg.func = ndarray_generate_arange_float;
+  arg.start.f = s;
+  arg.step.f = div > 0 ? (e - s) / (double)div : 0.0;
+  arg.stop = e;
+  arg.last = RTEST(endpoint) && n > 1 ? n - 1 : -1;
+
+  VALUE obj = ndarray_new_for_generator(klass, rb_ary_new_from_args(1, SSIZET2NUM(n)), dtype,
+                                        ndarray_order_row_major, "linspace");
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  if (n > 0 && ndarray_dtype_is_integer(dtype)) {
+    double ends[2];
+    arg.func(&arg, 0, 1, &ends[0]);
+    arg.func(&arg, n - 1, 1, &ends[1]);
+    ndarray_generate_check_value((const uint8_t *)&ends[0], ndarray_dtype_float64, dtype);
+    ndarray_generate_check_value((const uint8_t *)&ends[1], ndarray_dtype_float64, dtype);
+  }
+
+  ndarray_generate(nar, &arg, ndarray_dtype_float64);
+  return obj;
+}
+
+/* Convert val to the item of dtype at value_ptr.  Integers are converted
+ * to bool as casting, so that zeros and ones can make bool arrays. */
+static void
+ndarray_set_fill_value(uint8_t *value_ptr, const ndarray_dtype_t dtype, VALUE val)
+{
+  if (dtype == ndarray_dtype_bool && RB_INTEGER_TYPE_P(val)) {
+    val = (FIXNUM_P(val) && FIX2LONG(val) == 0) ? Qfalse : Qtrue;
+  }
+  ndarray_set_value(value_ptr, dtype, val);
+}
+
+static VALUE
+ndarray_s_full_impl(VALUE klass, VALUE shape_ary, VALUE val, VALUE dtype_name, VALUE order_name)
+{
+  const ndarray_dtype_t dtype = ndarray_obj_to_dtype_t(dtype_name);
+  const ndarray_order_t order = ndarray_obj_to_order_t(order_name);
+
+  VALUE obj = ndarray_new_for_generator(klass, shape_ary, dtype, order, "full");
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  ndarray_item_buf_t value = { .bytes = { 0 } };
+  ndarray_set_fill_value(value.bytes, dtype, val);
+  ndarray_fill_items(nar, value.bytes);
+
+  return obj;
+}
+
+static VALUE
+ndarray_s_eye_impl(VALUE klass, VALUE n_v, VALUE m_v, VALUE k_v, VALUE dtype_name, VALUE order_name)
+{
+  const ndarray_dtype_t dtype = ndarray_obj_to_dtype_t(dtype_name);
+  const ndarray_order_t order = ndarray_obj_to_order_t(order_name);
+  const ssize_t n = NUM2SSIZET(n_v), m = NUM2SSIZET(m_v), k = NUM2SSIZET(k_v);
+  if (n < 0 || m < 0) {
+    rb_raise(rb_eArgError, "negative dimension size (%"PRIdSIZE"x%"PRIdSIZE")", n, m);
+  }
+
+  VALUE obj = ndarray_new_for_generator(klass, rb_ary_new_from_args(2, n_v, m_v), dtype, order, "eye");
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  ndarray_item_buf_t value = { .bytes = { 0 } };
+  ndarray_fill_items(nar, value.bytes);
+
+  /* the k-th diagonal (i, i + k) */
+  ndarray_set_fill_value(value.bytes, dtype, INT2FIX(1));
+  const ssize_t i_begin = k < 0 ? -k : 0;
+  const ssize_t i_end = m - k < n ? m - k : n;
+  uint8_t *data = nar->data;
+  ssize_t i;
+  for (i = i_begin; i < i_end; ++i) {
+    memcpy(data + i * nar->strides[0] + (i + k) * nar->strides[1], value.bytes, nar->item_size);
+  }
+
+  return obj;
+}
+
+#undef PCG32_INCREMENT
+#undef PCG32_MULTIPLIER
+
+/* Chunked IO
+ *
+ * read_from and write_to move the items between an IO-like object and the
+ * array by chunks through IO#read and IO#write.  A chunk is read into a
+ * String reused over the calls, or written from a new String as IO#write
+ * may keep it, and it is scattered to, or gathered from, the runs of the
+ * items in the given order without GVL.  So the memory in use is the array
+ * and a chunk in any layout.  The bytes are moved as they are in the byte
+ * order of the array. */
+
+#define NDARRAY_IO_CHUNK_SIZE (1 << 20)
+
+/* Read len bytes by IO#read into buf, or raise EOFError.  Returns the
+ * String of the bytes, that is buf unless io returns another one. */
+static VALUE
+ndarray_io_read_chunk(VALUE io, VALUE buf, const long len)
+{
+  VALUE str = rb_funcall(io, rb_intern("read"), 2, LONG2NUM(len), buf);
+  if (NIL_P(str)) {
+    rb_raise(rb_eEOFError, "end of file reached (%ld more bytes are required)", len);
+  }
+  StringValue(str);
+
+  /* an IO-like object may return less than requested before the end */
+  while (RSTRING_LEN(str) < len) {
+    if (str != buf) {
+      rb_str_replace(buf, str);
+      str = buf;
+    }
+    VALUE rest = rb_funcall(io, rb_intern("read"), 1, LONG2NUM(len - RSTRING_LEN(str)));
+    if (NIL_P(rest) || RSTRING_LEN(StringValue(rest)) == 0) {
+      rb_raise(rb_eEOFError, "end of file reached (%ld more bytes are required)", len - RSTRING_LEN(str));
+    }
+    rb_str_append(str, rest);
+  }
+  return str;
+}
+
+/* Read size bytes to dst, or raise EOFError */
+static void
+ndarray_io_read_bytes(VALUE io, uint8_t *dst, const long size)
+{
+  VALUE buf = rb_str_buf_new(size);
+  VALUE str = ndarray_io_read_chunk(io, buf, size);
+  memcpy(dst, RSTRING_PTR(str), size);
+  RB_GC_GUARD(buf);
+}
+
+typedef struct {
+  const ndarray_iter_t *it;
+  ssize_t item_begin;
+  ssize_t item_end;
+  ssize_t item_size;
+  uint8_t *buf;
+  int to_array_p;
+} ndarray_io_copy_arg_t;
+
+/* ptrs[0] is the array, and the chunk is consumed in the order of the
+ * calls */
+static int
+ndarray_io_copy_kernel(uint8_t **ptrs, const ssize_t *strides, const ssize_t n, void *ptr)
+{
+  ndarray_io_copy_arg_t *arg = ptr;
+  uint8_t *copy_ptrs[2];
+  ssize_t copy_strides[2];
+  const int a = arg->to_array_p ? 0 : 1;
+
+  copy_ptrs[a] = ptrs[0];
+  copy_strides[a] = strides[0];
+  copy_ptrs[1 - a] = arg->buf;
+  copy_strides[1 - a] = arg->item_size;
+  ndarray_copy_kernel(copy_ptrs, copy_strides, n, &arg->item_size);
+
+  arg->buf += n * arg->item_size;
+  return 0;
+}
+
+static void *
+ndarray_io_copy_without_gvl(void *ptr)
+{
+  ndarray_io_copy_arg_t *arg = ptr;
+  ndarray_iter_run_range(arg->it, arg->item_begin, arg->item_end, arg->it->indices,
+                         ndarray_io_copy_kernel, arg);
+  return NULL;
+}
+
+/* Initialize the iteration over the items of nar in the given order, that
+ * is row-major or column-major */
+static void
+ndarray_io_iter_init(ndarray_iter_t *it, const ndarray_t *nar, const ndarray_order_t order)
+{
+  uint8_t *data[1] = { nar->data };
+
+  if (order != ndarray_order_column_major) {
+    const ssize_t *strides[1] = { nar->strides };
+    ndarray_iter_init(it, 1, data, strides, nar->ndim, nar->shape, NDARRAY_ITER_KEEP_ORDER);
+    return;
+  }
+
+  /* the column-major order is the row-major order of the reversed axes */
+  const ssize_t ndim = nar->ndim;
+  VALUE heap_buf = 0;
+  ssize_t *shape = RB_ALLOCV_N(ssize_t, heap_buf, 2 * (ndim > 0 ? ndim : 1));
+  ssize_t *rev_strides = shape + ndim;
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) {
+    shape[i] = nar->shape[ndim - 1 - i];
+    rev_strides[i] = nar->strides[ndim - 1 - i];
+  }
+  const ssize_t *strides[1] = { rev_strides };
+  ndarray_iter_init(it, 1, data, strides, ndim, shape, NDARRAY_ITER_KEEP_ORDER);
+  RB_ALLOCV_END(heap_buf);
+}
+
+static ssize_t
+ndarray_io_chunk_items(const ndarray_t *nar, VALUE chunk_bytes_v)
+{
+  ssize_t chunk_bytes = NDARRAY_IO_CHUNK_SIZE;
+  if (!NIL_P(chunk_bytes_v)) {
+    chunk_bytes = NUM2SSIZET(chunk_bytes_v);
+    if (chunk_bytes <= 0) {
+      rb_raise(rb_eArgError, "chunk_bytes must be positive (%"PRIdSIZE" given)", chunk_bytes);
+    }
+  }
+  /* a chunk has at least an item */
+  return chunk_bytes >= nar->item_size ? chunk_bytes / nar->item_size : 1;
+}
+
+static void
+ndarray_read_items(VALUE io, const ndarray_t *nar, const ndarray_order_t order, const ssize_t chunk_items)
+{
+  const ssize_t n_items = ndarray_n_items(nar), item_size = nar->item_size;
+
+  ndarray_iter_t it;
+  ndarray_io_iter_init(&it, nar, order);
+
+  VALUE buf = rb_str_buf_new((chunk_items < n_items ? chunk_items : n_items) * item_size);
+  ndarray_io_copy_arg_t arg = { &it, 0, 0, item_size, NULL, 1 };
+  while (arg.item_end < n_items) {
+    const ssize_t n = chunk_items < n_items - arg.item_end ? chunk_items : n_items - arg.item_end;
+    VALUE str = ndarray_io_read_chunk(io, buf, (long)(n * item_size));
+    arg.item_begin = arg.item_end;
+    arg.item_end += n;
+    arg.buf = (uint8_t *)RSTRING_PTR(str);
+    rb_thread_call_without_gvl(ndarray_io_copy_without_gvl, &arg, NULL, NULL);
+    RB_GC_GUARD(str);
+  }
+
+  ndarray_iter_release(&it);
+  RB_GC_GUARD(buf);
+}
+
+static void
+ndarray_write_items(VALUE io, const ndarray_t *nar, const ndarray_order_t order, const ssize_t chunk_items)
+{
+  const ssize_t n_items = ndarray_n_items(nar), item_size = nar->item_size;
+
+  ndarray_iter_t it;
+  ndarray_io_iter_init(&it, nar, order);
+
+  /* Each chunk is written as a new String, as the IO can keep it */
+  ndarray_io_copy_arg_t arg = { &it, 0, 0, item_size, NULL, 0 };
+  while (arg.item_end < n_items) {
+    const ssize_t n = chunk_items < n_items - arg.item_end ? chunk_items : n_items - arg.item_end;
+    VALUE str = rb_str_new(NULL, (long)(n * item_size));
+    arg.item_begin = arg.item_end;
+    arg.item_end += n;
+    arg.buf = (uint8_t *)RSTRING_PTR(str);
+    rb_thread_call_without_gvl(ndarray_io_copy_without_gvl, &arg, NULL, NULL);
+    rb_funcall(io, rb_intern("write"), 1, str);
+  }
+
+  ndarray_iter_release(&it);
+}
+
+static VALUE
+ndarray_read_from_impl(VALUE obj, VALUE io, VALUE chunk_bytes, VALUE order_v)
+{
+  rb_check_frozen(obj);
+
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  const ndarray_order_t order = ndarray_resolve_order(nar, ndarray_obj_to_order_t(order_v));
+  ndarray_read_items(io, nar, order, ndarray_io_chunk_items(nar, chunk_bytes));
+
+  return obj;
+}
+
+static VALUE
+ndarray_write_to_impl(VALUE obj, VALUE io, VALUE chunk_bytes, VALUE order_v)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  const ndarray_order_t order = ndarray_resolve_order(nar, ndarray_obj_to_order_t(order_v));
+  ndarray_write_items(io, nar, order, ndarray_io_chunk_items(nar, chunk_bytes));
+
+  return obj;
+}
+
+/* NPY files
+ *
+ * load_npy and save_npy read and write the NPY format of numpy in the
+ * versions 1.0, 2.0, and 3.0:
+ *
+ *   "\x93NUMPY" major minor header_len header payload
+ *
+ * header_len is a little-endian uint16 in 1.0, or uint32 in the others.
+ * The header is a Python dict literal of 'descr', 'fortran_order', and
+ * 'shape', padded by spaces and a newline so that the payload starts at a
+ * multiple of 64 bytes.  The simple descriptors, such as '<f8', '>i4',
+ * and '|b1', are mapped to the dtypes and the byte orders, and the
+ * structured ones are not supported.  bfloat16 and records have no simple
+ * descriptor, so they cannot be saved.
+ *
+ * The payload is moved by the chunked IO, so that any IO-like object can be
+ * read and written without the whole payload in a String. */
+
+#define NPY_MAGIC "\x93NUMPY"
+#define NPY_MAGIC_SIZE 6
+#define NPY_ALIGNMENT 64
+#define NPY_MAX_HEADER_SIZE (1 << 20)
+
+typedef struct {
+  ndarray_dtype_t dtype;
+  VALUE byte_order;
+  ndarray_order_t order;
+  VALUE shape;
+  ssize_t payload_offset;
+} ndarray_npy_header_t;
+
+NORETURN(static void ndarray_npy_invalid_header(VALUE header, const char *reason));
+
+static void
+ndarray_npy_invalid_header(VALUE header, const char *reason)
+{
+  rb_raise(rb_eArgError, "invalid NPY header (%s): %+"PRIsVALUE, reason, header);
+}
+
+static const char *
+ndarray_npy_skip_spaces(const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+  return p;
+}
+
+/* Parse a quoted Python string without escapes, and return the position
+ * next to it */
+static const char *
+ndarray_npy_parse_string(VALUE header, const char *p, const char *end, const char **str, long *len)
+{
+  if (p >= end || (*p != '\'' && *p != '"')) {
+    ndarray_npy_invalid_header(header, "string expected");
+  }
+  const char quote = *p++;
+  const char *q = memchr(p, quote, end - p);
+  if (q == NULL) {
+    ndarray_npy_invalid_header(header, "unterminated string");
+  }
+  *str = p;
+  *len = q - p;
+  return q + 1;
+}
+
+static void
+ndarray_npy_parse_descr(ndarray_npy_header_t *hdr, const char *descr, const long len)
+{
+  long i;
+  int size = 0;
+  for (i = 2; i < len && '0' <= descr[i] && descr[i] <= '9' && size < 100; ++i) {
+    size = size * 10 + (descr[i] - '0');
+  }
+
+  ndarray_dtype_t dtype = ndarray_dtype_none;
+  if (len >= 3 && i == len) {
+    switch (descr[1]) {
+      case 'b':
+        if (size == 1) dtype = ndarray_dtype_bool;
+        break;
+      case 'i':
+        switch (size) {
+          case 1: dtype = ndarray_dtype_int8; break;
+          case 2: dtype = ndarray_dtype_int16; break;
+          case 4: dtype = ndarray_dtype_int32; break;
+          case 8: dtype = ndarray_dtype_int64; break;
+        }
+        break;
+      case 'u':
+        switch (size) {
+          case 1: dtype = ndarray_dtype_uint8; break;
+          case 2: dtype = ndarray_dtype_uint16; break;
+          case 4: dtype = ndarray_dtype_uint32; break;
+          case 8: dtype = ndarray_dtype_uint64; break;
+        }
+        break;
+      case 'f':
+        switch (size) {
+          case 2: dtype = ndarray_dtype_float16; break;
+          case 4: dtype = ndarray_dtype_float32; break;
+          case 8: dtype = ndarray_dtype_float64; break;
+        }
+        break;
+      case 'c':
+        switch (size) {
+          case 8: dtype = ndarray_dtype_complex64; break;
+          case 16: dtype = ndarray_dtype_complex128; break;
+        }
+        break;
+    }
+  }
+
+  VALUE byte_order = Qundef;
+  if (len >= 1) {
+    switch (descr[0]) {
+      case '<': byte_order = sym_little; break;
+      case '>': byte_order = sym_big; break;
+      case '|':
+      case '=': byte_order = sym_native; break;
+    }
+  }
+
+  if (dtype == ndarray_dtype_none || byte_order == Qundef) {
+    rb_raise(rb_eTypeError, "unsupported NPY dtype descriptor: %+"PRIsVALUE, rb_str_new(descr, len));
+  }
+  hdr->dtype = dtype;
+  hdr->byte_order = byte_order;
+}
+
+static void
+ndarray_npy_parse_header(VALUE header, ndarray_npy_header_t *hdr)
+{
+  const char *p = RSTRING_PTR(header), *end = p + RSTRING_LEN(header);
+  int found = 0;  /* the bits of descr, fortran_order, and shape */
+
+  p = ndarray_npy_skip_spaces(p, end);
+  if (p >= end || *p++ != '{') {
+    ndarray_npy_invalid_header(header, "dict expected");
+  }
+  while (1) {
+    p = ndarray_npy_skip_spaces(p, end);
+    if (p < end && *p == '}')
+      break;
+
+    const char *key;
+    long key_len;
+    p = ndarray_npy_parse_string(header, p, end, &key, &key_len);
+    p = ndarray_npy_skip_spaces(p, end);
+    if (p >= end || *p++ != ':') {
+      ndarray_npy_invalid_header(header, "':' expected");
+    }
+    p = ndarray_npy_skip_spaces(p, end);
+
+    if (key_len == 5 && memcmp(key, "descr", 5) == 0) {
+      if (p < end && *p == '[') {
+        rb_raise(rb_eTypeError, "structured NPY dtypes are not supported");
+      }
+      const char *descr;
+      long descr_len;
+      p = ndarray_npy_parse_string(header, p, end, &descr, &descr_len);
+      ndarray_npy_parse_descr(hdr, descr, descr_len);
+      found |= 1;
+    }
+    else if (key_len == 13 && memcmp(key, "fortran_order", 13) == 0) {
+      if (end - p >= 4 && memcmp(p, "True", 4) == 0) {
+        hdr->order = ndarray_order_column_major;
+        p += 4;
+      }
+      else if (end - p >= 5 && memcmp(p, "False", 5) == 0) {
+        hdr->order = ndarray_order_row_major;
+        p += 5;
+      }
+      else {
+        ndarray_npy_invalid_header(header, "bool expected");
+      }
+      found |= 2;
+    }
+    else if (key_len == 5 && memcmp(key, "shape", 5) == 0) {
+      if (p >= end || *p++ != '(') {
+        ndarray_npy_invalid_header(header, "tuple expected");
+      }
+      hdr->shape = rb_ary_new();
+      while (1) {
+        p = ndarray_npy_skip_spaces(p, end);
+        if (p < end && *p == ')')
+          break;
+        if (p >= end || *p < '0' || '9' < *p) {
+          ndarray_npy_invalid_header(header, "integer expected");
+        }
+        ssize_t n = 0;
+        for (; p < end && '0' <= *p && *p <= '9'; ++p) {
+          if (n > (SSIZE_MAX - 9) / 10) {
+            ndarray_npy_invalid_header(header, "too large dimension");
+          }
+          n = n * 10 + (*p - '0');
+        }
+        rb_ary_push(hdr->shape, SSIZET2NUM(n));
+        p = ndarray_npy_skip_spaces(p, end);
+        if (p < end && *p == ',') ++p;
+        else if (p >= end || *p != ')') {
+          ndarray_npy_invalid_header(header, "',' or ')' expected");
+        }
+      }
+      ++p;
+      found |= 4;
+    }
+    else {
+      ndarray_npy_invalid_header(header, "unknown key");
+    }
 
-    default:
-      return Qnil;
+    p = ndarray_npy_skip_spaces(p, end);
+    if (p < end && *p == ',') ++p;
+    else if (p >= end || *p != '}') {
+      ndarray_npy_invalid_header(header, "',' or '}' expected");
+    }
+  }
+  if (found != 7) {
+    ndarray_npy_invalid_header(header, "missing keys");
   }
 }
 
-static VALUE
-ndarray_1d_aref(const ndarray_t *nar, ssize_t i)
-{
-  assert(nar != NULL);
-  assert(nar->ndim == 1);
-  assert(0 <= i);
-  assert(i < nar->shape[0]);
-
-  uint8_t *p = ((uint8_t *)nar->data) + i * nar->strides[0];
-  return ndarray_get_value(p, nar->dtype);
-}
-
-static VALUE
-ndarray_md_aref(const ndarray_t *nar, ssize_t *indices)
+static void
+ndarray_npy_read_header(VALUE io, ndarray_npy_header_t *hdr)
 {
-  assert(nar != NULL);
-  assert(indices != NULL);
-
-  /* assume the size of indices equals to nar->ndim */
-  const ssize_t ndim = nar->ndim;
+  uint8_t prefix[NPY_MAGIC_SIZE + 6];
+  ndarray_io_read_bytes(io, prefix, NPY_MAGIC_SIZE + 2);
+  if (memcmp(prefix, NPY_MAGIC, NPY_MAGIC_SIZE) != 0) {
+    rb_raise(rb_eArgError, "not an NPY file");
+  }
 
-  uint8_t *value_ptr = nar->data;
-  ssize_t i;
-  for (i = 0; i < ndim; ++i) {
-    value_ptr += indices[i] * nar->strides[i];
+  const int major = prefix[NPY_MAGIC_SIZE];
+  ssize_t header_size;
+  switch (major) {
+    case 1:
+      ndarray_io_read_bytes(io, prefix + NPY_MAGIC_SIZE + 2, 2);
+      header_size = prefix[8] | (prefix[9] << 8);
+      hdr->payload_offset = 10 + header_size;
+      break;
+    case 2:
+    case 3:
+      ndarray_io_read_bytes(io, prefix + NPY_MAGIC_SIZE + 2, 4);
+      header_size = (ssize_t)(prefix[8] | (prefix[9] << 8) | (prefix[10] << 16) | ((uint32_t)prefix[11] << 24));
+      hdr->payload_offset = 12 + header_size;
+      break;
+    default:
+      rb_raise(rb_eArgError, "unsupported NPY version %d.%d", major, prefix[NPY_MAGIC_SIZE + 1]);
+  }
+  if (header_size > NPY_MAX_HEADER_SIZE) {
+    rb_raise(rb_eArgError, "too large NPY header (%"PRIdSIZE" bytes)", header_size);
   }
 
-  return ndarray_get_value(value_ptr, nar->dtype);
+  VALUE header = rb_str_new(NULL, header_size);
+  ndarray_io_read_bytes(io, (uint8_t *)RSTRING_PTR(header), header_size);
+  ndarray_npy_parse_header(header, hdr);
 }
 
+/* Load the array from io, or map the file of path at the payload if path
+ * is not nil */
 static VALUE
-ndarray_aref(int argc, VALUE *argv, VALUE obj)
+ndarray_s_load_npy_impl(VALUE klass, VALUE io, VALUE path)
 {
-  ndarray_t *nar;
-  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
-
-  if (nar->ndim != argc) {
-    rb_raise(rb_eIndexError, "index dimension mismatched (%d for %"PRIdSIZE")", argc, nar->ndim);
-  }
-
-  const ssize_t ndim = nar->ndim;
-  if (ndim == 1) {
-    const ssize_t i = NUM2SSIZET(argv[0]);
-    return ndarray_1d_aref(nar, i);
+  ndarray_npy_header_t hdr = { ndarray_dtype_none, Qnil, ndarray_order_row_major, Qnil, 0 };
+  ndarray_npy_read_header(io, &hdr);
+
+  if (!NIL_P(path)) {
+#ifdef NDARRAY_USE_MMAP
+    return ndarray_s_mmap_impl(klass, path, hdr.shape, ID2SYM(DTYPE_ID(hdr.dtype)),
+                               hdr.order == ndarray_order_column_major ? sym_column_major : sym_row_major,
+                               SSIZET2NUM(hdr.payload_offset), sym_r, hdr.byte_order);
+#else
+    rb_notimplement();
+#endif
   }
-  else {
-    ssize_t inline_indices_buf[MAX_INLINE_DIM] = { 0, };
-    ssize_t *indices = inline_indices_buf;
 
-    VALUE heap_indices_buf = 0;
-    if (ndim > MAX_INLINE_DIM) {
-      indices = RB_ALLOCV_N(ssize_t, heap_indices_buf, ndim);
-    }
+  VALUE obj = ndarray_s_allocate(klass);
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
 
-    ssize_t i;
-    for (i = 0; i < ndim; ++i) {
-      indices[i] = NUM2SSIZET(argv[i]);
-    }
+  const ssize_t byte_size = ndarray_init_layout(nar, hdr.shape, hdr.dtype, Qnil, hdr.order);
+  ndarray_set_byte_order(nar, hdr.byte_order, false);
+  ndarray_alloc_data(nar, byte_size, NDARRAY_DEFAULT_ALIGNMENT);
+  ndarray_read_items(io, nar, hdr.order, ndarray_io_chunk_items(nar, Qnil));
 
-    VALUE res = ndarray_md_aref(nar, indices);
-    RB_ALLOCV_END(heap_indices_buf);
-    return res;
-  }
+  return obj;
 }
 
 static VALUE
-ndarray_set_value(uint8_t *value_ptr, const ndarray_dtype_t dtype, const VALUE val)
+ndarray_npy_header(const ndarray_t *nar, const int fortran_p)
 {
-  assert(value_ptr != NULL);
-  switch (dtype) {
+  char kind;
+  switch (nar->dtype) {
     case ndarray_dtype_int8:
-      *(int8_t *)value_ptr = NUM2INT8(val);
-      break;
-    case ndarray_dtype_uint8:
-      *(uint8_t *)value_ptr = NUM2UINT8(val);
-      break;
-
     case ndarray_dtype_int16:
-      *(int16_t *)value_ptr = NUM2INT16(val);
-      break;
-    case ndarray_dtype_uint16:
-      *(uint16_t *)value_ptr = NUM2UINT16(val);
-      break;
-
     case ndarray_dtype_int32:
-      *(int32_t *)value_ptr = NUM2INT32(val);
-    case ndarray_dtype_uint32:
-      *(uint32_t *)value_ptr = NUM2UINT32(val);
-
     case ndarray_dtype_int64:
-      *(int64_t *)value_ptr = NUM2INT64(val);
+      kind = 'i';
       break;
+    case ndarray_dtype_uint8:
+    case ndarray_dtype_uint16:
+    case ndarray_dtype_uint32:
     case ndarray_dtype_uint64:
-      *(uint64_t *)value_ptr = NUM2UINT64(val);
+      kind = 'u';
       break;
-
+    case ndarray_dtype_float16:
     case ndarray_dtype_float32:
-      *(float *)value_ptr = NUM2FLT(val);
-      break;
     case ndarray_dtype_float64:
-      *(double *)value_ptr = NUM2DBL(val);
+      kind = 'f';
+      break;
+    case ndarray_dtype_complex64:
+    case ndarray_dtype_complex128:
+      kind = 'c';
+      break;
+    case ndarray_dtype_bool:
+      kind = 'b';
       break;
-
     default:
-      return Qnil;
+      rb_raise(rb_eTypeError, "%"PRIsVALUE" has no NPY dtype descriptor",
+               rb_sym2str(ID2SYM(DTYPE_ID(nar->dtype))));
   }
 
-  return val;
-}
-
-static VALUE
-ndarray_md_aset(ndarray_t *nar, ssize_t *indices, VALUE val)
-{
-  assert(nar != NULL);
-  assert(indices != NULL);
-
-  /* assume the size of indices equals to nar->ndim */
-  const ssize_t ndim = nar->ndim;
+  char byte_order = '|';
+  if (nar->item_size > 1) {
+#ifdef WORDS_BIGENDIAN
+    byte_order = nar->swapped_p ? '<' : '>';
+#else
+    byte_order = nar->swapped_p ? '>' : '<';
+#endif
+  }
 
-  uint8_t *value_ptr = nar->data;
+  VALUE header = rb_sprintf("{'descr': '%c%c%"PRIdSIZE"', 'fortran_order': %s, 'shape': (",
+                            byte_order, kind, nar->item_size, fortran_p ? "True" : "False");
   ssize_t i;
-  for (i = 0; i < ndim; ++i) {
-    value_ptr += indices[i] * nar->strides[i];
+  for (i = 0; i < nar->ndim; ++i) {
+    rb_str_catf(header, i > 0 ? ", %"PRIdSIZE : "%"PRIdSIZE, nar->shape[i]);
   }
+  rb_str_cat_cstr(header, nar->ndim == 1 ? ",), }" : "), }");
 
-  return ndarray_set_value(value_ptr, nar->dtype, val);
+  /* the payload starts at a multiple of NPY_ALIGNMENT */
+  long prefix_size = NPY_MAGIC_SIZE + 4;
+  if (prefix_size + RSTRING_LEN(header) + 1 > 65535) {
+    prefix_size = NPY_MAGIC_SIZE + 6;
+  }
+  const long total = (prefix_size + RSTRING_LEN(header) + 1 + NPY_ALIGNMENT - 1) / NPY_ALIGNMENT * NPY_ALIGNMENT;
+  const long header_size = total - prefix_size;
+
+  VALUE str = rb_str_buf_new(total);
+  rb_str_cat(str, NPY_MAGIC, NPY_MAGIC_SIZE);
+  if (prefix_size == NPY_MAGIC_SIZE + 4) {
+    const char version_len[4] = { 1, 0, (char)(header_size & 0xff), (char)(header_size >> 8) };
+    rb_str_cat(str, version_len, 4);
+  }
+  else {
+    const char version_len[6] = { 2, 0, (char)(header_size & 0xff), (char)((header_size >> 8) & 0xff),
+                                   (char)((header_size >> 16) & 0xff), (char)(header_size >> 24) };
+    rb_str_cat(str, version_len, 6);
+  }
+  rb_str_append(str, header);
+  while (RSTRING_LEN(str) < total - 1) rb_str_cat(str, " ", 1);
+  rb_str_cat(str, "\n", 1);
+
+  return str;
 }
 
+/* The items are written in column-major order if the layout is only
+ * column-major contiguous, or in row-major order */
 static VALUE
-ndarray_aset(int argc, VALUE *argv, VALUE obj)
+ndarray_save_npy_impl(VALUE obj, VALUE io)
 {
   ndarray_t *nar;
   TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
 
-  rb_check_frozen(obj);
+  const ndarray_order_t order = ndarray_resolve_order(nar, ndarray_order_auto);
+  rb_funcall(io, rb_intern("write"), 1, ndarray_npy_header(nar, order == ndarray_order_column_major));
+  ndarray_write_items(io, nar, order, ndarray_io_chunk_items(nar, Qnil));
 
-  if (nar->ndim != argc - 1) {
-    rb_raise(rb_eIndexError, "index dimension mismatched (%d for %"PRIdSIZE")", argc - 1, nar->ndim);
-  }
+  return obj;
+}
 
-  const VALUE val = argv[argc-1];
-  const int item_size = SIZEOF_DTYPE(nar->dtype);
+#undef NPY_MAGIC
+#undef NPY_MAGIC_SIZE
+#undef NPY_ALIGNMENT
+#undef NPY_MAX_HEADER_SIZE
 
-  const ssize_t ndim = nar->ndim;
-  if (ndim == 1) {
-    /* special case for 1-D array */
-    ssize_t i = NUM2SSIZET(argv[0]);
-    uint8_t *p = ((uint8_t *)nar->data) + i * item_size;
-    return ndarray_set_value(p, nar->dtype, val);
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+static void
+ndarray_update_n_exports(VALUE obj, ssize_t diff)
+{
+  /* Views borrow the buffer of their base, so the base chain is counted too */
+  while (rb_typeddata_is_kind_of(obj, &ndarray_data_type)) {
+    ndarray_t *nar = RTYPEDDATA_DATA(obj);
+    nar->n_exports += diff;
+    if (!nar->base)
+      break;
+    obj = nar->base;
   }
-  else {
-    ssize_t inline_indices_buf[MAX_INLINE_DIM] = { 0, };
-    ssize_t *indices = inline_indices_buf;
+}
 
-    VALUE heap_indices_buf = 0;
-    if (ndim > MAX_INLINE_DIM) {
-      indices = RB_ALLOCV_N(ssize_t, heap_indices_buf, ndim);
-    }
+static bool
+ndarray_memory_view_get(VALUE obj, rb_memory_view_t *view, int flags)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
 
-    ssize_t i;
-    for (i = 0; i < ndim; ++i) {
-      indices[i] = NUM2SSIZET(argv[i]);
-    }
+  if (nar->dtype == ndarray_dtype_none || nar->data == NULL) {
+    return false;
+  }
 
-    VALUE res = ndarray_md_aset(nar, indices, val);
-    RB_ALLOCV_END(heap_indices_buf);
-    return res;
+  const bool readonly = OBJ_FROZEN(obj);
+  if ((flags & RUBY_MEMORY_VIEW_WRITABLE) && readonly) {
+    return false;
   }
-}
 
-static int
-increment_indices(const ndarray_t *nar, ssize_t *indices)
-{
-  assert(nar != NULL);
-  assert(indices != NULL);
+  const int row_major_p = (flags & RUBY_MEMORY_VIEW_ROW_MAJOR) == RUBY_MEMORY_VIEW_ROW_MAJOR;
+  const int column_major_p = (flags & RUBY_MEMORY_VIEW_COLUMN_MAJOR) == RUBY_MEMORY_VIEW_COLUMN_MAJOR;
+  if (row_major_p && column_major_p) {
+    if (!ndarray_is_row_major_contiguous(nar) && !ndarray_is_column_major_contiguous(nar))
+      return false;
+  }
+  else if (row_major_p) {
+    if (!ndarray_is_row_major_contiguous(nar))
+      return false;
+  }
+  else if (column_major_p) {
+    if (!ndarray_is_column_major_contiguous(nar))
+      return false;
+  }
 
-  ssize_t i = nar->ndim - 1;
-  if (indices[i] + 1 < nar->shape[i]) {
-    ++indices[i];
-    return 0;
+  view->obj = obj;
+  view->data = nar->data;
+  view->byte_size = nar->byte_size;
+  view->readonly = readonly;
+  if (nar->dtype == ndarray_dtype_record) {
+    view->format = RSTRING_PTR(nar->format);
   }
   else {
-    indices[i] = 0;
-    for (--i; i >= 0; --i) {
-      if (indices[i] + 1 == nar->shape[i]) {
-        indices[i] = 0;
-      }
-      else {
-        ++indices[i];
-        return 0;
-      }
-    }
-    return 1; /* overflow */
+    view->format = nar->swapped_p ? DTYPE_SWAPPED_FORMAT(nar->dtype) : DTYPE_FORMAT(nar->dtype);
   }
+  view->item_size = nar->item_size;
+  view->item_desc.components = NULL;
+  view->item_desc.length = 0;
+  view->ndim = nar->ndim;
+  view->shape = nar->shape;
+  view->strides = nar->strides;
+  view->sub_offsets = NULL;
+  view->private_data = NULL;
+
+  ndarray_update_n_exports(obj, 1);
+
+  return true;
 }
 
-static VALUE
-ndarray_md_eq(const ndarray_t *nar1, const ndarray_t *nar2)
+static bool
+ndarray_memory_view_release(VALUE obj, rb_memory_view_t *view)
 {
-  assert(nar1 != NULL);
-  assert(nar2 != NULL);
-  assert(nar1->ndim == nar2->ndim);
-
-  const ssize_t ndim = nar1->ndim;
-  ssize_t n_items = 1;
-  ssize_t i;
-  for (i = 0; i < ndim; ++i) {
-    if (nar1->shape[i] != nar2->shape[i])
-      return Qfalse;
+  ndarray_update_n_exports(obj, -1);
+  return true;
+}
 
-    n_items *= nar1->shape[i];
-  }
+static bool
+ndarray_memory_view_available_p(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
 
-  ssize_t inline_indices_buf[MAX_INLINE_DIM] = { 0, };
-  ssize_t *indices = inline_indices_buf;
+  return nar->dtype != ndarray_dtype_none && nar->data != NULL;
+}
 
-  VALUE heap_indices_buf = 0;
-  if (ndim > MAX_INLINE_DIM) {
-    indices = RB_ALLOCV_N(ssize_t, heap_indices_buf, ndim);
-    MEMZERO(indices, ssize_t, ndim);
-  }
+static const rb_memory_view_entry_t ndarray_memory_view_entry = {
+  ndarray_memory_view_get,
+  ndarray_memory_view_release,
+  ndarray_memory_view_available_p
+};
 
-  ssize_t n = 0;
-  VALUE res = Qtrue;
-  for (; n < n_items; ++n) {
-    VALUE v1 = ndarray_md_aref(nar1, indices);
-    VALUE v2 = ndarray_md_aref(nar2, indices);
-    if (!rb_equal(v1, v2)) {
-      res = Qfalse;
-      break;
+/* Set the dtype of the items of view to nar.  A pair of floats is taken as
+ * a complex number, the items in the non-native byte order are swapped on
+ * access, and the other structures are taken as records.  The items can be
+ * reinterpreted as the given dtype of the same size. */
+static void
+ndarray_set_dtype_from_memory_view(ndarray_t *nar, rb_memory_view_t *view, VALUE dtype_name)
+{
+  if (!NIL_P(dtype_name)) {
+    const ndarray_dtype_t dtype = ndarray_obj_to_dtype_t(dtype_name);
+    if (dtype == ndarray_dtype_record) {
+      ndarray_set_dtype(nar, dtype, view->format ? rb_str_new_cstr(view->format) : rb_str_new_cstr("C"));
     }
-
-    increment_indices(nar1, indices);
+    else {
+      ndarray_set_dtype(nar, dtype, Qnil);
+    }
+    if (nar->item_size != view->item_size) {
+      rb_raise(rb_eArgError, "item size mismatch (%"PRIdSIZE" for %"PRIdSIZE")", view->item_size, nar->item_size);
+    }
+    return;
   }
 
-  RB_ALLOCV_END(heap_indices_buf);
-  return res;
-}
-
-static VALUE
-ndarray_eq(VALUE obj, VALUE other)
-{
-  if (obj == other)
-    return Qtrue;
-  else if (!rb_typeddata_is_kind_of(other, &ndarray_data_type)) {
-    return Qfalse;
+  if (view->format == NULL) {
+    /* unsigned bytes */
+    ndarray_set_dtype(nar, ndarray_dtype_uint8, Qnil);
+    return;
   }
 
-  ndarray_t *nar1, *nar2;
-  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar1);
-  TypedData_Get_Struct(other, ndarray_t, &ndarray_data_type, nar2);
-
-  const ssize_t ndim = nar1->ndim;
-  if (ndim != nar2->ndim)
-    return Qfalse;
-
-  if (ndim == 1) {
-    const ssize_t n = nar1->shape[0];
-    if (n != nar2->shape[0])
-      return Qfalse;
+  VALUE format = ndarray_normalize_format(view->format);
+  const char *err = NULL;
+  rb_memory_view_item_component_t *members = NULL;
+  size_t n_members = 0;
+  ssize_t item_size = rb_memory_view_parse_item_format(RSTRING_PTR(format), &members, &n_members, &err);
+  if (item_size < 0) {
+    rb_raise(rb_eArgError, "unable to parse the item format (%s)", view->format);
+  }
 
-    ssize_t i;
-    for (i = 0; i < n; ++i) {
-      VALUE v1 = ndarray_1d_aref(nar1, i);
-      VALUE v2 = ndarray_1d_aref(nar2, i);
-      if (!rb_equal(v1, v2))
-        return Qfalse;
+  ndarray_dtype_t dtype = ndarray_dtype_none;
+  bool swapped_p = false;
+  if (n_members == 1 && members[0].offset == 0) {
+    swapped_p = ndarray_component_swap_p(&members[0]);
+    const ndarray_dtype_t item_dtype = ndarray_dtype_of_format_char(members[0].format, members[0].size);
+    if (members[0].repeat == 1) {
+      dtype = item_dtype;
+    }
+    else if (members[0].repeat == 2 && item_dtype == ndarray_dtype_float32) {
+      dtype = ndarray_dtype_complex64;
+    }
+    else if (members[0].repeat == 2 && item_dtype == ndarray_dtype_float64) {
+      dtype = ndarray_dtype_complex128;
+    }
+    else if (item_dtype != ndarray_dtype_none) {
+      dtype = ndarray_dtype_record;
     }
-
-    return Qtrue;
   }
-  else {
-    return ndarray_md_eq(nar1, nar2);
+  else if (n_members > 1) {
+    dtype = ndarray_dtype_record;
   }
-}
+  xfree(members);
 
-static void
-check_order(VALUE order)
-{
-  if (order != sym_row_major && order != sym_column_major && order != sym_auto) {
-    rb_raise(rb_eArgError,
-             "order must be either :row_major, :column_major, or :auto (%"PRIsVALUE" given)",
-             order);
+  if (dtype == ndarray_dtype_none || item_size != view->item_size) {
+    rb_raise(rb_eArgError, "unsupported item format (%s)", view->format);
+  }
+  if (dtype == ndarray_dtype_record) {
+    ndarray_set_dtype(nar, dtype, format);
+  }
+  else {
+    ndarray_set_dtype(nar, dtype, Qnil);
+    nar->swapped_p = swapped_p && nar->item_size > 1;
   }
 }
 
 static VALUE
-ndarray_reshape_impl(VALUE base, VALUE new_shape_v, VALUE order)
+ndarray_s_from_memory_view_impl(VALUE klass, VALUE src, VALUE copy, VALUE dtype_name)
 {
-  enum {
-    nothing,
-    zero_or_negative_size_in_shape,
-    incompatible_new_shape,
-  } failure_reason = nothing;
-
-  ndarray_t *nar_base;
-  TypedData_Get_Struct(base, ndarray_t, &ndarray_data_type, nar_base);
+  VALUE obj = ndarray_s_allocate(klass);
 
-  Check_Type(new_shape_v, T_ARRAY);
-  check_order(order);
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
 
-  if (order == sym_auto) {
-    rb_raise(rb_eNotImpError, ":auto order is not implemented");
-  }
-  else if (order == sym_column_major) {
-    rb_raise(rb_eNotImpError, ":column_major order is not implemented");
+  /* The view is owned by obj as soon as it is got, so it is released by
+   * ndarray_free even when the following conversion fails. */
+  rb_memory_view_t *view = ALLOC(rb_memory_view_t);
+  const int flags = RUBY_MEMORY_VIEW_FORMAT | RUBY_MEMORY_VIEW_STRIDES;
+  if (!(!RTEST(copy) && rb_memory_view_get(src, view, flags | RUBY_MEMORY_VIEW_WRITABLE)) &&
+      !rb_memory_view_get(src, view, flags)) {
+    xfree(view);
+    rb_raise(rb_eArgError, "unable to get a memory view from %+"PRIsVALUE, src);
   }
+  nar->source_view = view;
 
-  const ssize_t new_ndim = RARRAY_LEN(new_shape_v);
-
-  /* preparing the buffer for new_shape */
-
-  ssize_t inline_new_shape_buf[MAX_INLINE_DIM] = { 0, };
-  ssize_t *new_shape = inline_new_shape_buf;
-
-  if (new_ndim > MAX_INLINE_DIM) {
-    new_shape = ALLOC_N(ssize_t, new_ndim);
+  ndarray_set_dtype_from_memory_view(nar, view, dtype_name);
+  const ssize_t item_size = nar->item_size;
+  const ssize_t ndim = view->ndim;
+  if (ndim < 1 || view->sub_offsets != NULL) {
+    rb_raise(rb_eArgError, "unsupported memory view layout");
   }
 
-  /* extracting new_shape */
+  ndarray_alloc_dims(nar, ndim);
 
-  ssize_t byte_size = SIZEOF_DTYPE(nar_base->dtype);
-  ssize_t i;
-  for (i = 0; i < new_ndim; ++i) {
-    ssize_t dim_size = NUM2SSIZET(RARRAY_AREF(new_shape_v, i));
-    if (dim_size <= 0) {
-      failure_reason = zero_or_negative_size_in_shape;
-      goto finish;
-    }
-    new_shape[i] = dim_size;
-    byte_size *= dim_size;
+  if (view->shape) {
+    MEMCPY(nar->shape, view->shape, ssize_t, ndim);
   }
-
-  if (byte_size != nar_base->byte_size) {
-    failure_reason = incompatible_new_shape;
-    goto finish;
+  else {
+    /* shape can be NULL only for 1-D view */
+    nar->shape[0] = view->byte_size / item_size;
   }
 
-  /* preparing view array */
-
-  VALUE view = ndarray_s_allocate(CLASS_OF(base));
-
-  ndarray_t *nar;
-  TypedData_Get_Struct(view, ndarray_t, &ndarray_data_type, nar);
-
-  nar->data = nar_base->data;
-  nar->byte_size = nar_base->byte_size;
-  nar->dtype = nar_base->dtype;
-  nar->base = base;
-  nar->ndim = new_ndim;
-
-  if (new_shape == inline_new_shape_buf) {
-    nar->shape = ALLOC_N(ssize_t, new_ndim);
-    MEMCPY(nar->shape, new_shape, ssize_t, new_ndim);
+  if (view->strides) {
+    MEMCPY(nar->strides, view->strides, ssize_t, ndim);
   }
   else {
-    nar->shape = new_shape;
+    ndarray_init_row_major_strides(item_size, ndim, nar->shape, nar->strides);
   }
 
-  nar->strides = ALLOC_N(ssize_t, new_ndim);
-
-  if (order == sym_row_major) {
-    ndarray_init_row_major_strides(nar->dtype, new_ndim, nar->shape, nar->strides);
+  if (!RTEST(copy)) {
+    nar->data = view->data;
+    nar->byte_size = view->byte_size;
+    nar->base = src;
+    if (view->readonly) {
+      rb_obj_freeze(obj);
+    }
+    return obj;
   }
 
-finish:
-  if (failure_reason != nothing) {
-    if (new_shape && new_shape != inline_new_shape_buf) {
-      xfree(new_shape);
-    }
+  ssize_t byte_size = item_size;
+  ssize_t i;
+  for (i = 0; i < ndim; ++i) {
+    byte_size *= nar->shape[i];
   }
 
-  switch (failure_reason) {
-    case zero_or_negative_size_in_shape:
-      rb_raise(rb_eArgError, "zero or negative size is given in new_shape");
+  VALUE heap_buf = 0;
+  ssize_t *src_strides = RB_ALLOCV_N(ssize_t, heap_buf, ndim);
+  MEMCPY(src_strides, nar->strides, ssize_t, ndim);
 
-    case incompatible_new_shape:
-      rb_raise(rb_eArgError,
-               "new_shape is incompatible with the base shape (%"PRIsVALUE" for %"PRIsVALUE")",
-               new_shape_v, ndarray_get_shape(base));
+  ndarray_init_row_major_strides(item_size, ndim, nar->shape, nar->strides);
+  ndarray_alloc_data(nar, byte_size, NDARRAY_DEFAULT_ALIGNMENT);
 
-    default:
-      break;
-  }
+  ndarray_strided_copy(nar->data, nar->strides, view->data, src_strides,
+                       ndim, nar->shape, item_size);
+  RB_ALLOCV_END(heap_buf);
 
-  return view;
+  nar->source_view = NULL;
+  rb_memory_view_release(view);
+  xfree(view);
+
+  return obj;
+}
+#endif
+
+static VALUE
+ndarray_is_exported(VALUE obj)
+{
+  ndarray_t *nar;
+  TypedData_Get_Struct(obj, ndarray_t, &ndarray_data_type, nar);
+
+  return nar->n_exports > 0 ? Qtrue : Qfalse;
 }
 
 void
@@ -863,32 +7451,113 @@ Init_memory_view_test_helper(void)
   cNDArray = rb_define_class_under(mMemoryViewTestHelper, "NDArray", rb_cObject);
 
   rb_define_alloc_func(cNDArray, ndarray_s_allocate);
-  rb_define_method(cNDArray, "initialize", ndarray_initialize, 3);
+  rb_define_singleton_method(cNDArray, "num_threads", ndarray_s_get_num_threads, 0);
+  rb_define_singleton_method(cNDArray, "num_threads=", ndarray_s_set_num_threads, 1);
+  rb_define_singleton_method(cNDArray, "parallel_threshold", ndarray_s_get_parallel_threshold, 0);
+  rb_define_singleton_method(cNDArray, "parallel_threshold=", ndarray_s_set_parallel_threshold, 1);
+
+  rb_define_method(cNDArray, "initialize", ndarray_initialize, -1);
   rb_define_method(cNDArray, "byte_size", ndarray_get_byte_size, 0);
+  rb_define_method(cNDArray, "alignment", ndarray_get_alignment, 0);
   rb_define_method(cNDArray, "dtype", ndarray_get_dtype, 0);
+  rb_define_method(cNDArray, "item_size", ndarray_get_item_size, 0);
+  rb_define_method(cNDArray, "item_format", ndarray_get_item_format, 0);
+  rb_define_method(cNDArray, "byte_order", ndarray_get_byte_order, 0);
+  rb_define_method(cNDArray, "byteswap!", ndarray_byteswap_bang, 0);
+  rb_define_method(cNDArray, "newbyteorder", ndarray_newbyteorder, -1);
   rb_define_method(cNDArray, "ndim", ndarray_get_ndim, 0);
   rb_define_method(cNDArray, "shape", ndarray_get_shape, 0);
   rb_define_method(cNDArray, "strides", ndarray_get_strides, 0);
   rb_define_method(cNDArray, "[]", ndarray_aref, -1);
   rb_define_method(cNDArray, "[]=", ndarray_aset, -1);
   rb_define_method(cNDArray, "==", ndarray_eq, 1);
+  rb_define_method(cNDArray, "+", ndarray_add, 1);
+  rb_define_method(cNDArray, "-", ndarray_sub, 1);
+  rb_define_method(cNDArray, "*", ndarray_mul, 1);
+  rb_define_method(cNDArray, "/", ndarray_div, 1);
+  rb_define_method(cNDArray, "<", ndarray_lt, 1);
+  rb_define_method(cNDArray, "<=", ndarray_le, 1);
+  rb_define_method(cNDArray, ">", ndarray_gt, 1);
+  rb_define_method(cNDArray, ">=", ndarray_ge, 1);
+  rb_define_method(cNDArray, "add!", ndarray_add_bang, 1);
+  rb_define_method(cNDArray, "sub!", ndarray_sub_bang, 1);
+  rb_define_method(cNDArray, "mul!", ndarray_mul_bang, 1);
+  rb_define_method(cNDArray, "div!", ndarray_div_bang, 1);
+
+  rb_define_method(cNDArray, "dot", ndarray_dot, 1);
+  rb_define_method(cNDArray, "matmul", ndarray_dot, 1);
+  rb_define_method(cNDArray, "exported?", ndarray_is_exported, 0);
+  rb_define_method(cNDArray, "fill", ndarray_fill, 1);
+  rb_define_method(cNDArray, "to_a", ndarray_to_a, 0);
+  rb_define_method(cNDArray, "initialize_copy", ndarray_initialize_copy, 1);
+  rb_define_method(cNDArray, "contiguous?", ndarray_is_contiguous, -1);
+  rb_define_method(cNDArray, "to_row_major", ndarray_to_row_major, 0);
+  rb_define_method(cNDArray, "to_column_major", ndarray_to_column_major, 0);
+  rb_define_method(cNDArray, "transpose", ndarray_transpose, -1);
+  rb_define_method(cNDArray, "swapaxes", ndarray_swapaxes, 2);
 
   rb_define_private_method(cNDArray, "reshape_impl", ndarray_reshape_impl, 2);
 
-  ndarray_dtype_ids[ndarray_dtype_int8] = rb_intern("int8");
-  ndarray_dtype_ids[ndarray_dtype_uint8] = rb_intern("uint8");
-  ndarray_dtype_ids[ndarray_dtype_int16] = rb_intern("int16");
-  ndarray_dtype_ids[ndarray_dtype_uint16] = rb_intern("uint16");
-  ndarray_dtype_ids[ndarray_dtype_int32] = rb_intern("int32");
-  ndarray_dtype_ids[ndarray_dtype_uint32] = rb_intern("uint32");
-  ndarray_dtype_ids[ndarray_dtype_int64] = rb_intern("int64");
-  ndarray_dtype_ids[ndarray_dtype_uint64] = rb_intern("uint64");
-  ndarray_dtype_ids[ndarray_dtype_float32] = rb_intern("float32");
-  ndarray_dtype_ids[ndarray_dtype_float64] = rb_intern("float64");
+  rb_define_private_method(cNDArray, "astype_impl", ndarray_astype_impl, 4);
+  rb_define_private_method(cNDArray, "reduce_impl", ndarray_reduce_impl, 2);
+  rb_define_private_method(cNDArray, "allclose_impl", ndarray_allclose_impl, 4);
+  rb_define_private_method(cNDArray, "mismatch_impl", ndarray_mismatch_impl, 5);
+  rb_define_private_method(cNDArray, "save_npy_impl", ndarray_save_npy_impl, 1);
+  rb_define_private_method(cNDArray, "read_from_impl", ndarray_read_from_impl, 3);
+  rb_define_private_method(cNDArray, "write_to_impl", ndarray_write_to_impl, 3);
+  rb_define_private_method(cNDArray, "to_binary_impl", ndarray_to_binary_impl, 1);
+  rb_define_private_method(cNDArray, "copy_impl", ndarray_copy_impl, 1);
+
+  rb_define_private_method(rb_singleton_class(cNDArray), "try_convert_impl", ndarray_s_try_convert_impl, 4);
+  rb_define_private_method(rb_singleton_class(cNDArray), "from_binary_impl", ndarray_s_from_binary_impl, 7);
+  rb_define_private_method(rb_singleton_class(cNDArray), "load_npy_impl", ndarray_s_load_npy_impl, 2);
+  rb_define_private_method(rb_singleton_class(cNDArray), "random_impl", ndarray_s_random_impl, 6);
+  rb_define_private_method(rb_singleton_class(cNDArray), "arange_impl", ndarray_s_arange_impl, 4);
+  rb_define_private_method(rb_singleton_class(cNDArray), "linspace_impl", ndarray_s_linspace_impl, 5);
+  rb_define_private_method(rb_singleton_class(cNDArray), "full_impl", ndarray_s_full_impl, 4);
+  rb_define_private_method(rb_singleton_class(cNDArray), "eye_impl", ndarray_s_eye_impl, 5);
+
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  rb_define_private_method(rb_singleton_class(cNDArray), "from_memory_view_impl", ndarray_s_from_memory_view_impl, 3);
+#else
+  rb_define_private_method(rb_singleton_class(cNDArray), "from_memory_view_impl", rb_f_notimplement, -1);
+#endif
+
+#ifdef NDARRAY_USE_MMAP
+  rb_define_private_method(rb_singleton_class(cNDArray), "mmap_impl", ndarray_s_mmap_impl, 7);
+#else
+  rb_define_private_method(rb_singleton_class(cNDArray), "mmap_impl", rb_f_notimplement, -1);
+#endif
+
+#if defined(NDARRAY_USE_MMAP) && defined(MAP_ANONYMOUS) && defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+  /* the alignment of the buffers of NDARRAY_HUGE_PAGE_THRESHOLD bytes or more */
+  rb_define_const(cNDArray, "HUGE_PAGE_SIZE", INT2FIX(NDARRAY_HUGE_PAGE_SIZE));
+#endif
+
+#define DTYPE_ID_INIT(name, type, kind, load, num2type, type2num) \
+  ndarray_dtype_ids[ndarray_dtype_##name] = rb_intern(#name);
+  NDARRAY_FOR_EACH_DTYPE(DTYPE_ID_INIT)
+#undef DTYPE_ID_INIT
+  ndarray_dtype_ids[ndarray_dtype_record] = rb_intern("record");
+
+  if (rb_const_defined(rb_cEnumerator, rb_intern("ArithmeticSequence"))) {
+    cArithmeticSequence = rb_const_get(rb_cEnumerator, rb_intern("ArithmeticSequence"));
+    rb_gc_register_mark_object(cArithmeticSequence);
+  }
 
   sym_row_major = ID2SYM(rb_intern("row_major"));
   sym_column_major = ID2SYM(rb_intern("column_major"));
   sym_auto = ID2SYM(rb_intern("auto"));
-
-  (void)ndarray_dtype_sizes; /* TODO: to be deleted */
+  sym_r = ID2SYM(rb_intern("r"));
+  sym_rw = ID2SYM(rb_intern("rw"));
+  sym_little = ID2SYM(rb_intern("little"));
+  sym_big = ID2SYM(rb_intern("big"));
+  sym_native = ID2SYM(rb_intern("native"));
+  sym_swap = ID2SYM(rb_intern("swap"));
+  sym_uniform = ID2SYM(rb_intern("uniform"));
+  sym_normal = ID2SYM(rb_intern("normal"));
+
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  rb_memory_view_register(cNDArray, &ndarray_memory_view_entry);
+#endif
 }
@@ -1,5 +1,6 @@
 require "memory_view_test_helper.so"
 require "memory-view-test-helper/version"
+require "memory-view-test-helper/npz"
 require "set"
 
 module MemoryViewTestHelper
@@ -8,23 +9,96 @@ module MemoryViewTestHelper
       alias __new__ new
     end
 
-    def self.new(shape, dtype, order: :row_major)
-      __new__(shape, dtype, order)
+    def self.new(shape, dtype, order: :row_major, alignment: nil, format: nil, byte_order: :native)
+      __new__(shape, dtype, order, alignment, format, byte_order)
     end
 
-    def self.try_convert(obj, dtype: nil, order: :row_major)
+    def self.try_convert(obj, dtype: nil, order: :row_major, alignment: nil)
       begin
         ary = obj.to_ary
       rescue TypeError
         raise ArgumentError, "the argument must be converted to an Array by to_ary (#{obj.class} given)"
       end
 
+      nar = try_convert_impl(ary, dtype, order, alignment)
+      return nar if nar
+
+      # Fallback for the arrays including array-like objects other than Array
       dtype, shape, cache = detect_dtype_and_shape(ary, dtype)
-      nar = __new__(shape, dtype, order)
+      nar = __new__(shape, dtype, order, alignment)
       assign_cache(nar, cache)
       return nar
     end
 
+    def self.from_binary(str, shape, dtype, order: :row_major, alignment: nil, format: nil, byte_order: :native)
+      from_binary_impl(str, shape, dtype, order, alignment, format, byte_order)
+    end
+
+    def self.from_memory_view(obj, copy: false, dtype: nil)
+      from_memory_view_impl(obj, copy, dtype)
+    end
+
+    def self.mmap(path, shape, dtype, order: :row_major, offset: 0, mode: :r, byte_order: :native)
+      mmap_impl(path, shape, dtype, order, offset, mode, byte_order)
+    end
+
+    def self.load_npy(path_or_io, mmap: false)
+      if path_or_io.respond_to?(:read)
+        raise ArgumentError, "mmap is available only for a path" if mmap
+        load_npy_impl(path_or_io, nil)
+      else
+        File.open(path_or_io, "rb") {|io| load_npy_impl(io, mmap ? path_or_io : nil) }
+      end
+    end
+
+    # Returns a Hash of the names and the arrays of the NPY members
+    def self.load_npz(path_or_io)
+      if path_or_io.respond_to?(:read)
+        NPZ.load(path_or_io)
+      else
+        File.open(path_or_io, "rb") {|io| NPZ.load(io) }
+      end
+    end
+
+    def self.save_npz(path_or_io, arrays)
+      if path_or_io.respond_to?(:write)
+        NPZ.save(path_or_io, arrays)
+      else
+        File.open(path_or_io, "wb") {|io| NPZ.save(io, arrays) }
+      end
+      nil
+    end
+
+    def self.random(shape, dtype, seed: nil, distribution: :uniform, range: nil, order: :row_major)
+      seed ||= Random.new_seed
+      random_impl(shape, dtype, order, seed & 0xFFFF_FFFF_FFFF_FFFF, distribution, range)
+    end
+
+    def self.arange(start, stop = nil, step = 1, dtype: nil)
+      start, stop = 0, start if stop.nil?
+      arange_impl(start, stop, step, dtype)
+    end
+
+    def self.linspace(start, stop, num = 50, dtype: :float64, endpoint: true)
+      linspace_impl(start, stop, num, dtype, endpoint)
+    end
+
+    def self.zeros(shape, dtype, order: :row_major)
+      full_impl(shape, 0, dtype, order)
+    end
+
+    def self.ones(shape, dtype, order: :row_major)
+      full_impl(shape, 1, dtype, order)
+    end
+
+    def self.full(shape, value, dtype, order: :row_major)
+      full_impl(shape, value, dtype, order)
+    end
+
+    def self.eye(n, dtype, m: n, k: 0, order: :row_major)
+      eye_impl(n, m, k, dtype, order)
+    end
+
     private_class_method def self.assign_cache(nar, cache)
       if nar.ndim == 1
         src = cache[0][:ary]
@@ -99,7 +173,11 @@ module MemoryViewTestHelper
       when Float, Rational
         :float64
       when ->(x) { x.is_a?(Complex) && x.imag == 0 }
-        detect_dtype(x.real)
+        detect_dtype(obj.real)
+      when Complex
+        :complex128
+      when true, false
+        :bool
       when Enumerable, proc { obj.respond_to?(:to_ary) }
         nil
       else
@@ -108,14 +186,19 @@ module MemoryViewTestHelper
     end
 
     INTEGER_TYPES = Set[:int8, :uint8, :int16, :uint16, :int32, :uint32, :int64, :uint64].freeze
+    COMPLEX_TYPES = Set[:complex64, :complex128].freeze
 
     SIZEOF_DTYPE = {
       int8:    1,  uint8:  1,
       int16:   2,  uint16: 2,
       int32:   4,  uint32: 4,
       int64:   8,  uint64: 8,
+      float16: 2,  bfloat16: 2,
       float32: 4,
-      float64: 8
+      float64: 8,
+      complex64: 8,
+      complex128: 16,
+      bool: 1
     }.freeze
 
     private_class_method def self.promote_dtype(dtype_a, dtype_b)
@@ -124,6 +207,18 @@ module MemoryViewTestHelper
         dtype_a
       elsif dtype_a.nil? || dtype_b.nil?
         dtype_a || dtype_b
+      elsif dtype_a == :record || dtype_b == :record
+        raise TypeError, "auto promotion of record is not supported"
+      elsif dtype_a == :bool || dtype_b == :bool
+        raise TypeError, "auto promotion between bool and numeric is not supported"
+      elsif COMPLEX_TYPES.include?(dtype_a) || COMPLEX_TYPES.include?(dtype_b)
+        if [dtype_a, dtype_b].any? {|t| t == :float64 || t == :complex128 }
+          :complex128
+        else
+          COMPLEX_TYPES.include?(dtype_a) ? dtype_a : dtype_b
+        end
+      elsif [dtype_a, dtype_b].sort == [:bfloat16, :float16]
+        :float32
       else
         sizeof_a = SIZEOF_DTYPE[dtype_a]
         sizeof_b = SIZEOF_DTYPE[dtype_b]
@@ -163,8 +258,66 @@ module MemoryViewTestHelper
       end
     end
 
-    def item_size
-      SIZEOF_DTYPE[dtype]
+    def astype(dtype, order: :auto, copy: true, checked: false)
+      astype_impl(dtype, order, copy, checked)
+    end
+
+    def allclose?(other, rtol: 1e-05, atol: 1e-08, equal_nan: false)
+      other = NDArray.try_convert(other) unless other.is_a?(NDArray)
+      allclose_impl(other, rtol, atol, equal_nan)
+    end
+
+    def mismatch(other, limit: 10, rtol: nil, atol: nil, equal_nan: false)
+      other = NDArray.try_convert(other) unless other.is_a?(NDArray)
+      mismatch_impl(other, limit, rtol, atol, equal_nan)
+    end
+
+    def sum(axis: nil)
+      reduce_impl(:sum, axis)
+    end
+
+    def mean(axis: nil)
+      reduce_impl(:mean, axis)
+    end
+
+    def min(axis: nil)
+      reduce_impl(:min, axis)
+    end
+
+    def max(axis: nil)
+      reduce_impl(:max, axis)
+    end
+
+    def argmin(axis: nil)
+      reduce_impl(:argmin, axis)
+    end
+
+    def argmax(axis: nil)
+      reduce_impl(:argmax, axis)
+    end
+
+    def dup(order: :auto)
+      copy_impl(order)
+    end
+
+    def save_npy(path_or_io)
+      if path_or_io.respond_to?(:write)
+        save_npy_impl(path_or_io)
+      else
+        File.open(path_or_io, "wb") {|io| save_npy_impl(io) }
+      end
+    end
+
+    def read_from(io, chunk_bytes: nil, order: :row_major)
+      read_from_impl(io, chunk_bytes, order)
+    end
+
+    def write_to(io, chunk_bytes: nil, order: :row_major)
+      write_to_impl(io, chunk_bytes, order)
+    end
+
+    def to_binary(order: :row_major)
+      to_binary_impl(order)
     end
 
     def reshape(new_shape, order: :row_major)
@@ -0,0 +1,205 @@
+require "zlib"
+
+module MemoryViewTestHelper
+  # A minimal ZIP reader and writer for the NPZ files of numpy.savez and
+  # numpy.savez_compressed.  The NPY members are streamed from and to the
+  # IO by NDArray.load_npy and NDArray#save_npy, so the IO must be seekable
+  # but the members are never held in a String as a whole.
+  module NPZ
+    LOCAL_HEADER = 0x04034b50
+    CENTRAL_HEADER = 0x02014b50
+    END_OF_CENTRAL_DIRECTORY = 0x06054b50
+    ZIP64_END_OF_CENTRAL_DIRECTORY = 0x06064b50
+    ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR = 0x07064b50
+    ZIP64_EXTRA = 0x0001
+    ZIP64_LIMIT = 0xFFFF_FFFF
+
+    STORED = 0
+    DEFLATED = 8
+
+    Member = Struct.new(:name, :method, :crc, :compressed_size, :size, :offset)
+
+    module_function
+
+    def load(io)
+      members(io).each_with_object({}) do |member, arrays|
+        next unless member.name.end_with?(".npy")
+        arrays[member.name.delete_suffix(".npy")] = load_member(io, member)
+      end
+    end
+
+    def save(io, arrays)
+      members = arrays.map do |name, array|
+        array = NDArray.try_convert(array) unless array.is_a?(NDArray)
+        save_member(io, "#{name}.npy", array)
+      end
+      write_central_directory(io, members)
+    end
+
+    # Returns the members listed in the central directory
+    def members(io)
+      io.seek(0, IO::SEEK_END)
+      file_size = io.pos
+      tail_size = [file_size, 22 + 0xFFFF].min
+      io.seek(file_size - tail_size)
+      tail = io.read(tail_size)
+      eocd = tail.rindex([END_OF_CENTRAL_DIRECTORY].pack("V"))
+      raise ArgumentError, "not a ZIP file" unless eocd
+
+      count, cd_size, cd_offset = tail.unpack("@#{eocd + 10}vVV")
+      if count == 0xFFFF || cd_offset == ZIP64_LIMIT
+        signature, _, eocd64_offset = tail.unpack("@#{eocd - 20}VVQ<")
+        raise ArgumentError, "broken ZIP64 end of central directory" unless signature == ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR
+        io.seek(eocd64_offset)
+        signature, count, cd_size, cd_offset = io.read(56).unpack("V@32Q<Q<Q<")
+        raise ArgumentError, "broken ZIP64 end of central directory" unless signature == ZIP64_END_OF_CENTRAL_DIRECTORY
+      end
+
+      io.seek(cd_offset)
+      cd = io.read(cd_size)
+      pos = 0
+      Array.new(count) do
+        signature, method, crc, compressed_size, size, name_size, extra_size, comment_size, offset =
+          cd.unpack("@#{pos}V@#{pos + 10}v@#{pos + 16}VVVvvv@#{pos + 42}V")
+        raise ArgumentError, "broken central directory" unless signature == CENTRAL_HEADER
+        name = cd.byteslice(pos + 46, name_size)
+        extra = cd.byteslice(pos + 46 + name_size, extra_size)
+        pos += 46 + name_size + extra_size + comment_size
+
+        member = Member.new(name, method, crc, compressed_size, size, offset)
+        read_zip64_extra(extra, member)
+        member
+      end
+    end
+
+    # The ZIP64 extra field has the 64-bit values of the fields that are
+    # 0xFFFFFFFF in the header in this order
+    def read_zip64_extra(extra, member)
+      pos = 0
+      while pos + 4 <= extra.bytesize
+        id, size = extra.unpack("@#{pos}vv")
+        if id == ZIP64_EXTRA
+          values = extra.byteslice(pos + 4, size).unpack("Q<*")
+          member.size = values.shift if member.size == ZIP64_LIMIT
+          member.compressed_size = values.shift if member.compressed_size == ZIP64_LIMIT
+          member.offset = values.shift if member.offset == ZIP64_LIMIT
+        end
+        pos += 4 + size
+      end
+    end
+
+    def load_member(io, member)
+      io.seek(member.offset)
+      signature, name_size, extra_size = io.read(30).unpack("V@26vv")
+      raise ArgumentError, "broken local header of #{member.name}" unless signature == LOCAL_HEADER
+      io.seek(member.offset + 30 + name_size + extra_size)
+
+      case member.method
+      when STORED
+        NDArray.load_npy(io)
+      when DEFLATED
+        NDArray.load_npy(Inflater.new(io, member.compressed_size))
+      else
+        raise NotImplementedError, "unsupported compression method #{member.method} of #{member.name}"
+      end
+    end
+
+    # The member is stored with the ZIP64 extra field as numpy does, and the
+    # CRC and the sizes are written after the payload is streamed.
+    def save_member(io, name, array)
+      name = name.b
+      offset = io.pos
+      time, date = dos_time(Time.now)
+      io.write([LOCAL_HEADER, 45, 0, STORED, time, date, 0, ZIP64_LIMIT, ZIP64_LIMIT,
+                name.bytesize, 20].pack("VvvvvvVVVvv"))
+      io.write(name)
+      io.write([ZIP64_EXTRA, 16, 0, 0].pack("vvQ<Q<"))
+
+      writer = CRCWriter.new(io)
+      array.save_npy(writer)
+
+      end_pos = io.pos
+      io.seek(offset + 14)
+      io.write([writer.crc].pack("V"))
+      io.seek(offset + 30 + name.bytesize + 4)
+      io.write([writer.size, writer.size].pack("Q<Q<"))
+      io.seek(end_pos)
+
+      Member.new(name, STORED, writer.crc, writer.size, writer.size, offset)
+    end
+
+    def write_central_directory(io, members)
+      cd_offset = io.pos
+      time, date = dos_time(Time.now)
+      members.each do |member|
+        zip64 = [member.size, member.compressed_size, member.offset].select {|v| v >= ZIP64_LIMIT }
+        extra = zip64.empty? ? "".b : [ZIP64_EXTRA, 8 * zip64.size, *zip64].pack("vvQ<*")
+        io.write([CENTRAL_HEADER, 45, 45, 0, member.method, time, date, member.crc,
+                  [member.compressed_size, ZIP64_LIMIT].min, [member.size, ZIP64_LIMIT].min,
+                  member.name.bytesize, extra.bytesize, 0, 0, 0, 0,
+                  [member.offset, ZIP64_LIMIT].min].pack("VvvvvvvVVVvvvvvVV"))
+        io.write(member.name)
+        io.write(extra)
+      end
+      cd_size = io.pos - cd_offset
+
+      if members.size >= 0xFFFF || cd_offset >= ZIP64_LIMIT || cd_size >= ZIP64_LIMIT
+        eocd64_offset = io.pos
+        io.write([ZIP64_END_OF_CENTRAL_DIRECTORY, 44, 45, 45, 0, 0,
+                  members.size, members.size, cd_size, cd_offset].pack("VQ<vvVVQ<Q<Q<Q<"))
+        io.write([ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR, 0, eocd64_offset, 1].pack("VVQ<V"))
+      end
+      io.write([END_OF_CENTRAL_DIRECTORY, 0, 0,
+                [members.size, 0xFFFF].min, [members.size, 0xFFFF].min,
+                [cd_size, ZIP64_LIMIT].min, [cd_offset, ZIP64_LIMIT].min, 0].pack("VvvvvVVv"))
+    end
+
+    def dos_time(t)
+      [(t.hour << 11) | (t.min << 5) | (t.sec / 2),
+       ((t.year - 1980) << 9) | (t.month << 5) | t.day]
+    end
+
+    # Counts the bytes and the CRC-32 of the data written through it
+    class CRCWriter
+      attr_reader :crc, :size
+
+      def initialize(io)
+        @io = io
+        @crc = 0
+        @size = 0
+      end
+
+      def write(str)
+        @crc = Zlib.crc32(str, @crc)
+        @size += str.bytesize
+        @io.write(str)
+      end
+    end
+
+    # Reads a deflated member by IO#read(length, outbuf) with the compressed
+    # data pulled by small chunks
+    class Inflater
+      CHUNK_SIZE = 1 << 16
+
+      def initialize(io, compressed_size)
+        @io = io
+        @remaining = compressed_size
+        @zstream = Zlib::Inflate.new(-Zlib::MAX_WBITS)
+        @buffer = "".b
+      end
+
+      def read(length, outbuf = nil)
+        while @buffer.bytesize < length && @remaining > 0
+          chunk = @io.read([@remaining, CHUNK_SIZE].min)
+          raise EOFError, "end of file reached" unless chunk
+          @remaining -= chunk.bytesize
+          @buffer << @zstream.inflate(chunk)
+        end
+        return nil if @buffer.empty?
+
+        data = @buffer.slice!(0, length)
+        outbuf ? outbuf.replace(data) : data
+      end
+    end
+  end
+end
@@ -1,2 +1,4 @@
 require "memory-view-test-helper"
 require "test-unit"
+require "stringio"
+require "tempfile"
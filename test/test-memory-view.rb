@@ -0,0 +1,160 @@
+begin
+  require "fiddle"
+rescue LoadError
+end
+
+class MemoryViewTest < Test::Unit::TestCase
+  def setup
+    omit("MemoryView is unavailable") unless defined?(Fiddle::MemoryView)
+  end
+
+  sub_test_case("export") do
+    data do
+      {
+        "int8"    => [:int8,    "c", 1],
+        "uint8"   => [:uint8,   "C", 1],
+        "int16"   => [:int16,   "s", 2],
+        "uint16"  => [:uint16,  "S", 2],
+        "int32"   => [:int32,   "l", 4],
+        "uint32"  => [:uint32,  "L", 4],
+        "int64"   => [:int64,   "q", 8],
+        "uint64"  => [:uint64,  "Q", 8],
+        "float32" => [:float32, "f", 4],
+        "float64" => [:float64, "d", 8],
+        "float16" => [:float16, "S", 2],
+        "bfloat16" => [:bfloat16, "S", 2],
+        "complex64" => [:complex64, "f2", 8],
+        "complex128" => [:complex128, "d2", 16],
+        "bool" => [:bool, "C", 1],
+      }
+    end
+    def test_format(data)
+      dtype, format, item_size = data
+      ary = MemoryViewTestHelper::NDArray.new([2, 3], dtype)
+      mv = Fiddle::MemoryView.new(ary)
+      begin
+        assert_equal({ format: format,    item_size: item_size,    ndim: 2,       shape: [2, 3],   strides: ary.strides, byte_size: 6*item_size },
+                     { format: mv.format, item_size: mv.item_size, ndim: mv.ndim, shape: mv.shape, strides: mv.strides,  byte_size: mv.byte_size })
+      ensure
+        mv.release
+      end
+    end
+
+    test("items") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :float64, order: :column_major)
+      mv = Fiddle::MemoryView.new(ary)
+      begin
+        assert_equal([[1.0, 2.0, 3.0], [4.0, 5.0, 6.0]],
+                     0.upto(1).map {|i| 0.upto(2).map {|j| mv[i, j] } })
+      ensure
+        mv.release
+      end
+    end
+
+    data do
+      {
+        "int32"   => [:int32,   "l>", [1, -2].pack("l>*")],
+        "float32" => [:float32, "g",  [1.5, -2.0].pack("g*")],
+        "complex128" => [:complex128, "G2", [1.5, -2.0].pack("G*")],
+      }
+    end
+    def test_big_endian(data)
+      dtype, format, binary = data
+      ary = MemoryViewTestHelper::NDArray.from_binary(binary, [binary.bytesize / MemoryViewTestHelper::NDArray::SIZEOF_DTYPE[dtype]], dtype, byte_order: :big)
+      mv = Fiddle::MemoryView.new(ary)
+      begin
+        imported = MemoryViewTestHelper::NDArray.from_memory_view(ary)
+        assert_equal({ format: format,    byte_order: :big,                equality: true },
+                     { format: mv.format, byte_order: imported.byte_order, equality: imported == ary })
+      ensure
+        mv.release
+      end
+    end
+
+    test("readonly follows frozen state") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1, 2, 3], dtype: :int32)
+      mv1 = Fiddle::MemoryView.new(ary)
+      ary.freeze
+      mv2 = Fiddle::MemoryView.new(ary)
+      begin
+        assert_equal([false, true], [mv1.readonly?, mv2.readonly?])
+      ensure
+        mv1.release
+        mv2.release
+      end
+    end
+
+    test("export count") do
+      base = MemoryViewTestHelper::NDArray.try_convert([1, 2, 3, 4, 5, 6], dtype: :int32)
+      view = base.reshape([2, 3])
+      mv = Fiddle::MemoryView.new(view)
+      exported = [base.exported?, view.exported?]
+      mv.release
+      assert_equal({ while_exported: [true, true], released: [false, false] },
+                   { while_exported: exported,     released: [base.exported?, view.exported?] })
+    end
+  end
+
+  sub_test_case(".from_memory_view") do
+    test("aliasing an NDArray") do
+      src = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :int16, order: :column_major)
+      ary = MemoryViewTestHelper::NDArray.from_memory_view(src)
+      ary[1, 2] = 42
+      assert_equal({ dtype: :int16,     shape: [2, 3],    strides: src.strides, equality: true,       changed_value: 42,        exported: true },
+                   { dtype: ary.dtype,  shape: ary.shape, strides: ary.strides, equality: ary == src, changed_value: src[1, 2], exported: src.exported? })
+    end
+
+    test("copy: true") do
+      src = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :float64, order: :column_major)
+      ary = MemoryViewTestHelper::NDArray.from_memory_view(src, copy: true)
+      ary[1, 2] = 42
+      assert_equal({ strides: [24, 8],     unchanged_value: 6.0,       exported: false },
+                   { strides: ary.strides, unchanged_value: src[1, 2], exported: src.exported? })
+    end
+
+    test("readonly source") do
+      src = MemoryViewTestHelper::NDArray.try_convert([1, 2, 3], dtype: :int32).freeze
+      ary = MemoryViewTestHelper::NDArray.from_memory_view(src)
+      assert_equal([true, true], [ary.frozen?, ary == src])
+    end
+
+    test("byte array") do
+      ptr = Fiddle::Pointer.malloc(4, Fiddle::RUBY_FREE)
+      ptr[0, 4] = "\x01\x02\x03\xff"
+      ary = MemoryViewTestHelper::NDArray.from_memory_view(ptr)
+      assert_equal({ dtype: :uint8,    shape: [4],       items: [1, 2, 3, 255] },
+                   { dtype: ary.dtype, shape: ary.shape, items: 0.upto(3).map {|i| ary[i] } })
+    end
+
+    test("complex") do
+      src = MemoryViewTestHelper::NDArray.try_convert([Complex(1, 2), Complex(3, 4)], dtype: :complex64)
+      ary = MemoryViewTestHelper::NDArray.from_memory_view(src)
+      assert_equal({ dtype: :complex64, items: [Complex(1, 2), Complex(3, 4)] },
+                   { dtype: ary.dtype,  items: ary.to_a })
+    end
+
+    test("record") do
+      src = MemoryViewTestHelper::NDArray.new([2], :record, format: "sl")
+      src[0] = [1, 2]
+      src[1] = [3, 4]
+      ary = MemoryViewTestHelper::NDArray.from_memory_view(src)
+      assert_equal({ dtype: :record,   item_format: "sl",            item_size: 6,             items: [[1, 2], [3, 4]] },
+                   { dtype: ary.dtype, item_format: ary.item_format, item_size: ary.item_size, items: ary.to_a })
+    end
+
+    test("dtype: for reinterpretation") do
+      src = MemoryViewTestHelper::NDArray.try_convert([0.5, 2.0], dtype: :float16)
+      ary = MemoryViewTestHelper::NDArray.from_memory_view(src, dtype: :float16)
+      assert_equal([0.5, 2.0], ary.to_a)
+      assert_raise_message("item size mismatch (2 for 4)") do
+        MemoryViewTestHelper::NDArray.from_memory_view(src, dtype: :float32)
+      end
+    end
+
+    test("not exportable object") do
+      assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.from_memory_view(Object.new)
+      end
+    end
+  end
+end
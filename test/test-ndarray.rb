@@ -11,6 +11,43 @@ class NDArrayTest < Test::Unit::TestCase
       ary = MemoryViewTestHelper::NDArray.new(shape, :float32)
       assert_equal(shape, ary.shape)
     end
+
+    test("default alignment") do
+      ary = MemoryViewTestHelper::NDArray.new([3], :int8)
+      assert_operator(ary.alignment, :>=, 64)
+    end
+
+    test("with alignment") do
+      ary = MemoryViewTestHelper::NDArray.new([3, 5], :float64, alignment: 4096)
+      ary.fill(1.5)
+      assert_equal({ alignment: true,                   items: [[1.5]*5]*3 },
+                   { alignment: ary.alignment >= 4096, items: ary.to_a })
+    end
+
+    test("with invalid alignment") do
+      assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.new([3], :int8, alignment: 48)
+      end
+    end
+
+    test("with invalid shape") do
+      assert_raise_message("negative dimensions are not allowed") do
+        MemoryViewTestHelper::NDArray.new([-2, 3], :float64)
+      end
+      assert_raise_message("array is too big") do
+        MemoryViewTestHelper::NDArray.zeros([2**31, 2**32], :float64)
+      end
+    end
+
+    test("huge buffer") do
+      ary = MemoryViewTestHelper::NDArray.new([1024, 1024], :float64)
+      ary.fill(2.0)
+      # the buffer is mapped at the huge page boundary when it is supported
+      alignment = defined?(MemoryViewTestHelper::NDArray::HUGE_PAGE_SIZE) ?
+                    MemoryViewTestHelper::NDArray::HUGE_PAGE_SIZE : 64
+      assert_equal({ alignment: true,                       sum: 2.0 * 1024 * 1024 },
+                   { alignment: ary.alignment >= alignment, sum: ary.sum })
+    end
   end
 
   sub_test_case(".try_convert") do
@@ -39,6 +76,14 @@ class NDArrayTest < Test::Unit::TestCase
         assert_equal({ shape: [*[1]*99, 2], ndim: 100     , byte_size: 16           , value: [42.0, -8.0] },
                      { shape: ary.shape,    ndim: ary.ndim, byte_size: ary.byte_size, value: [ary[*preind, 0], ary[*preind, 1]] })
       end
+
+      test("large ndim with siblings") do
+        items = 38.times.inject([1, 2, 3]) {|a, b| [a]}
+        ary = MemoryViewTestHelper::NDArray.try_convert([items, items], dtype: :int32)
+        preind = [0]*38
+        assert_equal({ shape: [2, *[1]*38, 3], value: [3, 1] },
+                     { shape: ary.shape,       value: [ary[0, *preind, 2], ary[1, *preind, 0]] })
+      end
     end
 
     sub_test_case("called with 2-D array and dtype") do
@@ -109,6 +154,32 @@ class NDArrayTest < Test::Unit::TestCase
       end
     end
 
+    test("called with rational and complex items") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([[1r/2, Complex(3, 0)], [Complex(1.5, 0), 4]])
+      assert_equal({ dtype: :float64,  items: [[0.5, 3.0], [1.5, 4.0]] },
+                   { dtype: ary.dtype, items: 0.upto(1).map {|i| 0.upto(1).map {|j| ary[i, j] } } })
+    end
+
+    test("called with array-like items") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1..3, [4, 5, 6]], dtype: :int32)
+      assert_equal({ shape: [2, 3],    items: [[1, 2, 3], [4, 5, 6]] },
+                   { shape: ary.shape, items: 0.upto(1).map {|i| 0.upto(2).map {|j| ary[i, j] } } })
+    end
+
+    test("error for giving size mismatched array") do
+      error = assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.try_convert([[1, 2], [3, 4, 5]])
+      end
+      assert_equal("size mismatch at the 1st dimension (3 for 2)", error.message)
+    end
+
+    test("error for giving unsupported item") do
+      error = assert_raise(TypeError) do
+        MemoryViewTestHelper::NDArray.try_convert([1, :a])
+      end
+      assert_equal("Symbol is unsupported", error.message)
+    end
+
     test("error for giving inhomogeneous dimension array") do
       assert_raise(ArgumentError) do
         MemoryViewTestHelper::NDArray.try_convert([[[1], 2], [3, 4]])
@@ -122,6 +193,10 @@ class NDArrayTest < Test::Unit::TestCase
       assert_raise(ArgumentError) do
         MemoryViewTestHelper::NDArray.try_convert([[1, 2], [3, [4]]])
       end
+      error = assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.try_convert([[1, 2], [3, [4]]])
+      end
+      assert_equal("inhomogeneous array detected at the the 2nd dimension", error.message)
     end
   end
 
@@ -195,6 +270,35 @@ class NDArrayTest < Test::Unit::TestCase
             end
           end
         end
+
+        sub_test_case("items") do
+          data do
+            {
+              "NaN"                     => [MemoryViewTestHelper::NDArray.try_convert([1.0, Float::NAN]),
+                                            MemoryViewTestHelper::NDArray.try_convert([1.0, Float::NAN]), false],
+              "+0.0 == -0.0"            => [MemoryViewTestHelper::NDArray.try_convert([0.0, 1.0]),
+                                            MemoryViewTestHelper::NDArray.try_convert([-0.0, 1.0]), true],
+              "uint8 == int16"          => [MemoryViewTestHelper::NDArray.try_convert([0, 255], dtype: :uint8),
+                                            MemoryViewTestHelper::NDArray.try_convert([0, 255], dtype: :int16), true],
+              "uint64 != int64"         => [MemoryViewTestHelper::NDArray.try_convert([2**64 - 1], dtype: :uint64),
+                                            MemoryViewTestHelper::NDArray.try_convert([-1], dtype: :int64), false],
+              "int64 != float64"        => [MemoryViewTestHelper::NDArray.try_convert([2**53 + 1], dtype: :int64),
+                                            MemoryViewTestHelper::NDArray.try_convert([2**53 + 1], dtype: :float64), false],
+              "int16 != float64"        => [MemoryViewTestHelper::NDArray.try_convert([1, 2], dtype: :int16),
+                                            MemoryViewTestHelper::NDArray.try_convert([1, 2.5], dtype: :float64), false],
+              "row_major == column_major" => [MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :int32, order: :row_major),
+                                              MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :int32, order: :column_major), true],
+              "3D row_major == column_major" => [MemoryViewTestHelper::NDArray.try_convert([[[1, 2], [3, 4]], [[5, 6], [7, 8]]], dtype: :int16, order: :row_major),
+                                                 MemoryViewTestHelper::NDArray.try_convert([[[1, 2], [3, 4]], [[5, 6], [7, 8]]], dtype: :float32, order: :column_major), true],
+              "row_major != column_major" => [MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :float64, order: :row_major),
+                                              MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 7]], dtype: :float64, order: :column_major), false],
+            }
+          end
+          def test_eq(data)
+            ary1, ary2, eq = data
+            assert_equal(eq, ary1 == ary2)
+          end
+        end
       end
 
       sub_test_case("incompatible shape") do
@@ -267,6 +371,12 @@ class NDArrayTest < Test::Unit::TestCase
                      { shape: ary2.shape, changed_value: ary1[4], ary2_items: ary2_items })
       end
 
+      test("order: :column_major") do
+        ary1 = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :int32)
+        ary2 = ary1.reshape([3, 2], order: :column_major)
+        assert_equal([[1, 5], [4, 3], [2, 6]], ary2.to_a)
+      end
+
       test("large dimension and order: :row_major") do
         ary1 = MemoryViewTestHelper::NDArray.try_convert([1, 2, 3, 4, 5, 6, 7, 8, 9], dtype: :float64)
         new_shape = [*[1]*98, 3, 3]
@@ -278,4 +388,1049 @@ class NDArrayTest < Test::Unit::TestCase
       end
     end
   end
+
+  sub_test_case("#reshape view or copy") do
+    def setup
+      @base = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :int16)
+    end
+
+    test("column_major base and order: :auto") do
+      base = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :int16, order: :column_major)
+      ary = base.reshape([3, 2], order: :auto)
+      ary[0, 1] = 42
+      assert_equal({ items: [[1, 42], [4, 3], [2, 6]], strides: [2, 6],       base: [[1, 2, 3], [4, 42, 6]] },
+                   { items: ary.to_a,                  strides: ary.strides, base: base.to_a })
+    end
+
+    test("strided base is reshaped without copy") do
+      view = @base.reshape([6])[(0..) % 2]
+      ary = view.reshape([3, 1])
+      ary[2, 0] = 42
+      assert_equal({ items: [[1], [3], [42]], strides: [4, 4],     base: [[1, 2, 3], [4, 42, 6]] },
+                   { items: ary.to_a,         strides: ary.strides, base: @base.to_a })
+    end
+
+    test("strided base is copied when it cannot be a view") do
+      view = @base[0.., (0..) % 2]
+      ary = view.reshape([4])
+      ary[3] = 42
+      assert_equal({ items: [1, 3, 4, 42], base: [[1, 2, 3], [4, 5, 6]] },
+                   { items: ary.to_a,      base: @base.to_a })
+    end
+
+    test("transposed base is copied") do
+      ary = @base.transpose.reshape([6])
+      ary[0] = 42
+      assert_equal({ items: [42, 4, 2, 5, 3, 6], base: [[1, 2, 3], [4, 5, 6]] },
+                   { items: ary.to_a,            base: @base.to_a })
+    end
+
+    test("transposed base and order: :column_major") do
+      ary = @base.transpose.reshape([2, 3], order: :column_major)
+      ary[0, 0] = 42
+      assert_equal({ items: [[42, 3, 5], [2, 4, 6]], base: [[42, 2, 3], [4, 5, 6]] },
+                   { items: ary.to_a,                base: @base.to_a })
+    end
+  end
+
+  sub_test_case("#fill") do
+    test("row_major") do
+      ary = MemoryViewTestHelper::NDArray.new([2, 3], :float32)
+      assert_equal([[0.0, 0.0, 0.0], [0.0, 0.0, 0.0]], ary.fill(0).to_a)
+    end
+
+    test("view") do
+      ary = MemoryViewTestHelper::NDArray.new([6], :int16).fill(-1)
+      ary.reshape([2, 3]).fill(7)
+      assert_equal([7, 7, 7, 7, 7, 7], ary.to_a)
+    end
+
+    test("frozen") do
+      ary = MemoryViewTestHelper::NDArray.new([2], :int8).freeze
+      assert_raise(FrozenError) do
+        ary.fill(1)
+      end
+    end
+  end
+
+  sub_test_case("#to_a") do
+    data do
+      items = [[[1, 2, 3], [4, 5, 6]], [[7, 8, 9], [10, 11, 12]]]
+      {
+        "1D int8"                => [[1, -2, 3], :int8, :row_major],
+        "1D uint64"              => [[2**64 - 1, 0], :uint64, :row_major],
+        "3D float64 row_major"   => [items.map {|a| a.map {|b| b.map(&:to_f) } }, :float64, :row_major],
+        "3D int32 column_major"  => [items, :int32, :column_major],
+      }
+    end
+    def test_to_a(data)
+      items, dtype, order = data
+      ary = MemoryViewTestHelper::NDArray.try_convert(items, dtype: dtype, order: order)
+      assert_equal(items, ary.to_a)
+    end
+
+    test("0-D") do
+      ary = MemoryViewTestHelper::NDArray.new([], :float64)
+      ary[] = 1.5
+      assert_equal(1.5, ary.to_a)
+    end
+  end
+
+  sub_test_case("binary") do
+    test("#to_binary") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :int16, order: :column_major)
+      assert_equal({ row_major: [1, 2, 3, 4, 5, 6].pack("s*"),    column_major: [1, 4, 2, 5, 3, 6].pack("s*"),       auto: [1, 4, 2, 5, 3, 6].pack("s*") },
+                   { row_major: ary.to_binary(order: :row_major), column_major: ary.to_binary(order: :column_major), auto: ary.to_binary(order: :auto) })
+    end
+
+    test(".from_binary") do
+      ary = MemoryViewTestHelper::NDArray.from_binary([1.5, 2.5, 3.5, 4.5].pack("d*"), [2, 2], :float64, order: :column_major)
+      assert_equal({ items: [[1.5, 3.5], [2.5, 4.5]], strides: [8, 16] },
+                   { items: ary.to_a,                 strides: ary.strides })
+    end
+
+    test(".from_binary with wrong size") do
+      assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.from_binary("\0" * 7, [2], :int32)
+      end
+    end
+  end
+
+  sub_test_case("slicing") do
+    def setup
+      @ary = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3, 4], [5, 6, 7, 8], [9, 10, 11, 12]], dtype: :int32)
+    end
+
+    data do
+      {
+        "ranges"               => [[1..2, 1...3],               [[6, 7], [10, 11]]],
+        "endless range"        => [[1.., 0],                    [5, 9]],
+        "negative range"       => [[-2..-1, -1],                [8, 12]],
+        "step"                 => [[(0..) % 2, (1..) % 2],      [[2, 4], [10, 12]]],
+        "negative step"        => [[2.step(0, -1), 3.step(0, -2)], [[12, 10], [8, 6], [4, 2]]],
+        "clipped"              => [[0..10, 3..10],              [[4], [8], [12]]],
+        "empty"                => [[1...1, 0..],                []],
+      }
+    end
+    def test_items(data)
+      indices, items = data
+      assert_equal(items, @ary[*indices].to_a)
+    end
+
+    test("view shares the buffer") do
+      view = @ary[(0..) % 2, 1..]
+      view[1, 2] = 42
+      view[0..0, 0..].fill(0)
+      assert_equal({ shape: [2, 3],     strides: [32, 4],      ary: [[1, 0, 0, 0], [5, 6, 7, 8], [9, 10, 11, 42]] },
+                   { shape: view.shape, strides: view.strides, ary: @ary.to_a })
+    end
+
+    test("1-D view") do
+      view = @ary[1, (0..) % 2]
+      view[1] = 42
+      assert_equal([[5, 42], [5, 6, 42, 8]], [view.to_a, @ary[1, 0..].to_a])
+    end
+
+    test("index out of bounds") do
+      assert_raise(IndexError) do
+        @ary[3, 0..]
+      end
+    end
+  end
+
+  sub_test_case("item access") do
+    def setup
+      @ary = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3, 4], [5, 6, 7, 8], [9, 10, 11, 12]], dtype: :int32)
+    end
+
+    test("negative indices") do
+      @ary[-1, -4] = 42
+      assert_equal({ aref: [4, 12, 42],                            row: [42, 10, 11, 12] },
+                   { aref: [@ary[0, -1], @ary[-1, 3], @ary[2, 0]], row: @ary[2, 0..].to_a })
+    end
+
+    test("strided 1-D view") do
+      column = @ary[0.., 1]
+      column[-1] = 0
+      column[0] = -2
+      assert_equal({ column: [-2, 6, 0],  ary: [[1, -2, 3, 4], [5, 6, 7, 8], [9, 0, 11, 12]] },
+                   { column: column.to_a, ary: @ary.to_a })
+    end
+
+    test("column-major") do
+      ary = @ary.astype(:int32, order: :column_major)
+      ary[1, -1] = 0
+      assert_equal({ aref: [7, 9],                 items: [[1, 2, 3, 4], [5, 6, 7, 0], [9, 10, 11, 12]] },
+                   { aref: [ary[1, 2], ary[-1, 0]], items: ary.to_a })
+    end
+
+    test("higher dimensions") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([[[[[1, 2]]], [[[3, 4]]]]], dtype: :int16)
+      ary[0, -1, 0, 0, -1] = 40
+      assert_equal([1, 3, 40], [ary[0, 0, 0, 0, 0], ary[-1, 1, -1, 0, 0], ary[0, 1, 0, -1, 1]])
+    end
+
+    test("items of each dtype") do
+      items = {
+        int8: [-1, 127], uint8: [255, 1], int16: [-1, 32767], uint16: [65535, 1],
+        int32: [-1, 2**31 - 1], uint32: [2**32 - 1, 1], int64: [-1, 2**63 - 1], uint64: [2**64 - 1, 1],
+        float32: [-1.0, 0.5], float64: [-1.0, 0.1], float16: [-1.0, 0.5], bfloat16: [-1.0, 0.5],
+        complex64: [Complex(-1.0, 1.0), Complex(0.5, 0.0)], complex128: [Complex(-1.0, 1.0), Complex(0.1, 0.2)],
+        bool: [true, false],
+      }
+      actual = items.to_h do |dtype, (fill, item)|
+        ary = MemoryViewTestHelper::NDArray.try_convert([fill, fill, fill], dtype: dtype)
+        ary[1] = item
+        [dtype, ary.to_a]
+      end
+      assert_equal(items.transform_values {|fill, item| [fill, item, fill] }, actual)
+    end
+
+    test("index out of bounds") do
+      assert_raise_message("index 4 is out of bounds for axis 1 with size 4") do
+        @ary[0, 4]
+      end
+      assert_raise_message("index -4 is out of bounds for axis 0 with size 3") do
+        @ary[-4, 0] = 1
+      end
+      assert_raise_message("index dimension mismatched (1 for 2)") do
+        @ary[0]
+      end
+    end
+  end
+
+  sub_test_case("#transpose") do
+    test("without axes") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :float64)
+      t = ary.transpose
+      assert_equal({ shape: [3, 2],  strides: [8, 24],   items: [[1.0, 4.0], [2.0, 5.0], [3.0, 6.0]] },
+                   { shape: t.shape, strides: t.strides, items: t.to_a })
+    end
+
+    test("with axes") do
+      ary = MemoryViewTestHelper::NDArray.new([2, 3, 4], :int8)
+      t = ary.transpose(1, -1, 0)
+      assert_equal({ shape: [3, 4, 2], strides: [4, 1, 12] },
+                   { shape: t.shape,   strides: t.strides })
+    end
+
+    test("repeated axis") do
+      assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.new([2, 3], :int8).transpose(0, 0)
+      end
+    end
+  end
+
+  test("#swapaxes") do
+    ary = MemoryViewTestHelper::NDArray.try_convert([[[1, 2], [3, 4]], [[5, 6], [7, 8]]], dtype: :uint8)
+    assert_equal([[[1, 5], [3, 7]], [[2, 6], [4, 8]]], ary.swapaxes(0, -1).to_a)
+  end
+
+  sub_test_case("contiguous copies") do
+    def setup
+      @ary = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :int32)
+    end
+
+    test("#contiguous?") do
+      transposed = @ary.transpose
+      strided = @ary[0.., (0..) % 2]
+      assert_equal({ row_major: [true, false],                             column_major: [false, true],                                                   auto: [true, true, false] },
+                   { row_major: [@ary.contiguous?, transposed.contiguous?], column_major: [@ary.contiguous?(:column_major), transposed.contiguous?(:column_major)], auto: [@ary.contiguous?(:auto), transposed.contiguous?(:auto), strided.contiguous?(:auto)] })
+    end
+
+    test("#to_row_major and #to_column_major") do
+      column_major = @ary.to_column_major
+      row_major = column_major.to_row_major
+      assert_equal({ same: [true, true],                                                                         strides: [[4, 8], [12, 4]],                      items: [@ary.to_a, @ary.to_a] },
+                   { same: [@ary.to_row_major.equal?(@ary), column_major.to_column_major.equal?(column_major)], strides: [column_major.strides, row_major.strides], items: [column_major.to_a, row_major.to_a] })
+    end
+
+    test("#dup and #clone") do
+      column_major = @ary.dup(order: :column_major)
+      copy = column_major.dup
+      copy[0, 0] = 0
+      assert_equal({ strides: [[4, 8], [4, 8], [4, 8]],                                          items: @ary.to_a,          frozen: true },
+                   { strides: [column_major.strides, copy.strides, column_major.clone.strides], items: column_major.to_a, frozen: @ary.clone(freeze: true).frozen? })
+    end
+
+    test("tiled transposing copy") do
+      items = Array.new(70) {|i| Array.new(130) {|j| i * 130 + j } }
+      ary = MemoryViewTestHelper::NDArray.try_convert(items, dtype: :int16)
+      transposed = ary.transpose.to_row_major
+      assert_equal({ items: items.transpose,  binary: items.transpose.flatten.pack("s*") },
+                   { items: transposed.to_a, binary: ary.to_column_major.to_binary(order: :column_major) })
+    end
+  end
+
+  sub_test_case(".mmap") do
+    def setup
+      @file = Tempfile.new(["ndarray", ".bin"])
+      @file.binmode
+      @file.write("\xFF" * 8)
+      @file.write([1, 2, 3, 4, 5, 6].pack("l*"))
+      @file.close
+    end
+
+    def teardown
+      @file.close!
+    end
+
+    test("read-only") do
+      ary = MemoryViewTestHelper::NDArray.mmap(@file.path, [2, 3], :int32, offset: 8)
+      assert_equal({ items: [[1, 2, 3], [4, 5, 6]], frozen: true },
+                   { items: ary.to_a,               frozen: ary.frozen? })
+    end
+
+    test("column_major") do
+      ary = MemoryViewTestHelper::NDArray.mmap(@file.path, [2, 3], :int32, order: :column_major, offset: 8)
+      assert_equal([[1, 3, 5], [2, 4, 6]], ary.to_a)
+    end
+
+    test("read-write") do
+      ary = MemoryViewTestHelper::NDArray.mmap(@file.path, [6], :int32, offset: 8, mode: :rw)
+      ary[1] = 20
+      assert_equal([1, 20, 3, 4, 5, 6], File.binread(@file.path, 24, 8).unpack("l*"))
+    end
+
+    test("too small file") do
+      assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.mmap(@file.path, [7], :int32, offset: 8)
+      end
+    end
+
+    test("misaligned offset") do
+      assert_raise_message("offset (5) is not a multiple of the item size (4)") do
+        MemoryViewTestHelper::NDArray.mmap(@file.path, [6], :int32, offset: 5)
+      end
+    end
+  end
+
+  sub_test_case("NPY files") do
+    def setup
+      @file = Tempfile.new(["ndarray", ".npy"])
+      @file.close
+      @ary = MemoryViewTestHelper::NDArray.arange(6, dtype: :int32).reshape([2, 3])
+    end
+
+    def teardown
+      @file.close!
+    end
+
+    def round_trip(ary)
+      io = StringIO.new("".b)
+      ary.save_npy(io)
+      io.rewind
+      MemoryViewTestHelper::NDArray.load_npy(io)
+    end
+
+    test("the format of numpy") do
+      @ary.save_npy(@file.path)
+      header = "{'descr': '<i4', 'fortran_order': False, 'shape': (2, 3), }".ljust(117) + "\n"
+      assert_equal("\x93NUMPY\x01\x00\x76\x00".b + header + [0, 1, 2, 3, 4, 5].pack("l<*"),
+                   File.binread(@file.path))
+    end
+
+    test("layouts and byte orders") do
+      big = MemoryViewTestHelper::NDArray.from_binary([1.5, 2.5].pack("G*"), [2], :float64, byte_order: :big)
+      scalar = MemoryViewTestHelper::NDArray.full([], 7, :int16)
+      fortran = round_trip(@ary.transpose)
+      assert_equal({ fortran: [[0, 3], [1, 4], [2, 5]], fortran_order: true,
+                     big: [1.5, 2.5], big_order: :big, strided: [[0, 2], [3, 5]], scalar: [7].pack("s") },
+                   { fortran: fortran.to_a, fortran_order: fortran.contiguous?(:column_major),
+                     big: round_trip(big).to_a, big_order: round_trip(big).byte_order,
+                     strided: round_trip(@ary[0.., (0..) % 2]).to_a, scalar: round_trip(scalar).to_binary })
+    end
+
+    test("mmap") do
+      @ary.save_npy(@file.path)
+      ary = MemoryViewTestHelper::NDArray.load_npy(@file.path, mmap: true)
+      assert_equal({ items: [[0, 1, 2], [3, 4, 5]], frozen: true },
+                   { items: ary.to_a,               frozen: ary.frozen? })
+    end
+
+    test("NPZ") do
+      big = MemoryViewTestHelper::NDArray.linspace(0.0, 1.0, 3).newbyteorder(:big)
+      MemoryViewTestHelper::NDArray.save_npz(@file.path, "x" => @ary, "y" => big)
+      arrays = MemoryViewTestHelper::NDArray.load_npz(@file.path)
+      assert_equal({ "x" => [[0, 1, 2], [3, 4, 5]], "y" => big.to_a },
+                   arrays.transform_values(&:to_a))
+    end
+
+    test("deflated NPZ member") do
+      io = StringIO.new("".b)
+      @ary.save_npy(io)
+      npy = io.string
+      data = Zlib::Deflate.new(Zlib::DEFAULT_COMPRESSION, -Zlib::MAX_WBITS).deflate(npy, Zlib::FINISH)
+      crc = Zlib.crc32(npy)
+      zip = [0x04034b50, 20, 0, 8, 0, 0, crc, data.bytesize, npy.bytesize, 5, 0].pack("VvvvvvVVVvv") + "x.npy" + data
+      cd_offset = zip.bytesize
+      zip << [0x02014b50, 20, 20, 0, 8, 0, 0, crc, data.bytesize, npy.bytesize, 5, 0, 0, 0, 0, 0, 0].pack("VvvvvvvVVVvvvvvVV") + "x.npy"
+      zip << [0x06054b50, 0, 0, 1, 1, zip.bytesize - cd_offset, cd_offset, 0].pack("VvvvvVVv")
+      arrays = MemoryViewTestHelper::NDArray.load_npz(StringIO.new(zip))
+      assert_equal({ "x" => [[0, 1, 2], [3, 4, 5]] }, arrays.transform_values(&:to_a))
+    end
+
+    test("errors") do
+      assert_raise_message("not an NPY file") do
+        MemoryViewTestHelper::NDArray.load_npy(StringIO.new("\x93NUMPX\x01\x00\x00\x00".b))
+      end
+      assert_raise(TypeError) do
+        header = "{'descr': [('a', '<i4')], 'fortran_order': False, 'shape': (1,), }\n"
+        MemoryViewTestHelper::NDArray.load_npy(StringIO.new("\x93NUMPY\x01\x00".b + [header.bytesize].pack("v") + header))
+      end
+      assert_raise(EOFError) do
+        io = StringIO.new("".b)
+        @ary.save_npy(io)
+        MemoryViewTestHelper::NDArray.load_npy(StringIO.new(io.string[0, 140]))
+      end
+      assert_raise(TypeError) do
+        MemoryViewTestHelper::NDArray.new([2], :bfloat16).save_npy(StringIO.new)
+      end
+    end
+  end
+
+  sub_test_case("chunked IO") do
+    def setup
+      @ary = MemoryViewTestHelper::NDArray.arange(24, dtype: :int16).reshape([2, 3, 4])
+    end
+
+    data("one item", 2)
+    data("partial items", 7)
+    data("default", nil)
+    test("write_to") do |chunk_bytes|
+      view = @ary.transpose(2, 0, 1)
+      row_major = StringIO.new("".b)
+      column_major = StringIO.new("".b)
+      view.write_to(row_major, chunk_bytes: chunk_bytes)
+      view.write_to(column_major, chunk_bytes: chunk_bytes, order: :column_major)
+      assert_equal({ row_major: view.to_binary, column_major: view.to_binary(order: :column_major) },
+                   { row_major: row_major.string, column_major: column_major.string })
+    end
+
+    data("one item", 2)
+    data("partial items", 7)
+    data("default", nil)
+    test("read_from") do |chunk_bytes|
+      ary = MemoryViewTestHelper::NDArray.zeros([4, 6], :int16)
+      view = ary[0.., (1..) % 2]
+      view.read_from(StringIO.new(@ary.to_binary[0, 24]), chunk_bytes: chunk_bytes, order: :column_major)
+      assert_equal([[0, 0, 0, 4, 0, 8], [0, 1, 0, 5, 0, 9], [0, 2, 0, 6, 0, 10], [0, 3, 0, 7, 0, 11]],
+                   ary.to_a)
+    end
+
+    test("IO keeping chunks") do
+      chunks = []
+      collector = Object.new
+      collector.define_singleton_method(:write) {|str| chunks << str; str.bytesize }
+      @ary[0, 0, 0..].write_to(collector, chunk_bytes: 4)
+      assert_equal([[0, 1], [2, 3]], chunks.map {|str| str.unpack("s*") })
+    end
+
+    test("pipe") do
+      r, w = IO.pipe
+      writer = Thread.new do
+        @ary.write_to(w, chunk_bytes: 6)
+        w.close
+      end
+      ary = MemoryViewTestHelper::NDArray.new([2, 3, 4], :int16).read_from(r, chunk_bytes: 10)
+      writer.join
+      r.close
+      assert_equal(@ary.to_a, ary.to_a)
+    end
+
+    test("errors") do
+      assert_raise(EOFError) do
+        @ary.dup.read_from(StringIO.new("\0" * 47))
+      end
+      assert_raise(ArgumentError) do
+        @ary.write_to(StringIO.new, chunk_bytes: 0)
+      end
+      assert_raise(FrozenError) do
+        @ary.freeze.read_from(StringIO.new(@ary.to_binary))
+      end
+    end
+  end
+
+  sub_test_case("parallel kernels") do
+    def setup
+      @num_threads = MemoryViewTestHelper::NDArray.num_threads
+      @parallel_threshold = MemoryViewTestHelper::NDArray.parallel_threshold
+      MemoryViewTestHelper::NDArray.num_threads = 3
+      MemoryViewTestHelper::NDArray.parallel_threshold = 1
+    end
+
+    def teardown
+      MemoryViewTestHelper::NDArray.num_threads = @num_threads
+      MemoryViewTestHelper::NDArray.parallel_threshold = @parallel_threshold
+    end
+
+    test("#fill and #== on strided views") do
+      ary = MemoryViewTestHelper::NDArray.new([7, 5], :int32)
+      ary.fill(0)
+      ary[1.., (0..) % 2].fill(3)
+      expected = [[0]*5] + [[3, 0, 3, 0, 3]]*6
+      other = MemoryViewTestHelper::NDArray.try_convert(expected, dtype: :int32)
+      different = other.dup
+      different[6, 3] = 1
+      assert_equal({ items: expected, eq: true,         ne: false },
+                   { items: ary.to_a, eq: ary == other, ne: ary == different })
+    end
+
+    test("copy") do
+      items = Array.new(4) {|i| Array.new(9) {|j| i * 9 + j } }
+      ary = MemoryViewTestHelper::NDArray.try_convert(items, dtype: :int16)
+      assert_equal({ reshape: items.transpose.flatten.each_slice(2).to_a, binary: items.transpose.flatten.pack("s*") },
+                   { reshape: ary.transpose.reshape([18, 2]).to_a,        binary: ary.to_binary(order: :column_major) })
+    end
+
+    test("#dot") do
+      a = Array.new(5) {|i| Array.new(7) {|j| i - j } }
+      b = Array.new(7) {|i| Array.new(3) {|j| i * j - 4 } }
+      expected = a.map {|row| b.transpose.map {|col| row.zip(col).sum {|x, y| x * y } } }
+      x = MemoryViewTestHelper::NDArray.try_convert(a, dtype: :float64)
+      y = MemoryViewTestHelper::NDArray.try_convert(b, dtype: :float64)
+      assert_equal(expected, x.dot(y).to_a)
+    end
+
+    test("invalid num_threads") do
+      assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.num_threads = 0
+      end
+    end
+  end
+
+  sub_test_case("#astype") do
+    test("integer to float") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([[1, -2, 3], [4, 5, -6]], dtype: :int16)
+      res = ary.astype(:float32)
+      assert_equal({ dtype: :float32,  items: [[1.0, -2.0, 3.0], [4.0, 5.0, -6.0]] },
+                   { dtype: res.dtype, items: res.to_a })
+    end
+
+    test("float to integer") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1.9, -1.9, 300.0, -300.0, Float::NAN], dtype: :float64)
+      assert_equal({ int8: [1, -1, 127, -128, 0], uint8: [1, 0, 255, 0, 0] },
+                   { int8: ary.astype(:int8).to_a, uint8: ary.astype(:uint8).to_a })
+    end
+
+    test("integer truncation") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([255, 256, -1], dtype: :int32)
+      assert_equal([-1, 0, -1], ary.astype(:int8).to_a)
+    end
+
+    test("checked") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1, 2, 300], dtype: :int32)
+      assert_equal({ ok: [1, 2, 300] },
+                   { ok: ary.astype(:int16, checked: true).to_a })
+      assert_raise_message("300 is out of the range of uint8") do
+        ary.astype(:uint8, checked: true)
+      end
+    end
+
+    test("checked float") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1.5, Float::NAN], dtype: :float64)
+      assert_raise(RangeError) do
+        ary.astype(:int64, checked: true)
+      end
+      assert_raise(RangeError) do
+        MemoryViewTestHelper::NDArray.try_convert([1e300]).astype(:float32, checked: true)
+      end
+    end
+
+    test("order and strided source") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :uint8)
+      res = ary.transpose.astype(:int64, order: :column_major)
+      assert_equal({ items: [[1, 4], [2, 5], [3, 6]], binary: [1, 2, 3, 4, 5, 6].pack("q*") },
+                   { items: res.to_a,                 binary: res.to_binary(order: :auto) })
+    end
+
+    test("copy") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1, 2, 3], dtype: :int8)
+      assert_equal({ copy_true: false, copy_false: true, column_major: true },
+                   { copy_true: ary.astype(:int8).equal?(ary),
+                     copy_false: ary.astype(:int8, copy: false).equal?(ary),
+                     column_major: ary.astype(:int8, order: :column_major, copy: false).equal?(ary) })
+    end
+  end
+
+  sub_test_case("reductions") do
+    def setup
+      @ary = MemoryViewTestHelper::NDArray.try_convert([[3, -1, 4], [1, -5, 9]], dtype: :int8)
+    end
+
+    test("whole array") do
+      assert_equal({ sum: 11,       mean: 11/6.0,     min: -5,       max: 9,        argmin: 4,         argmax: 5 },
+                   { sum: @ary.sum, mean: @ary.mean, min: @ary.min, max: @ary.max, argmin: @ary.argmin, argmax: @ary.argmax })
+    end
+
+    test("axis") do
+      sum = @ary.sum(axis: 0)
+      assert_equal({ sum: [4, -6, 13], dtype: :int64,   max: [4, 9],               argmin: [1, 1],                     mean: [2.0, -3.0, 6.5] },
+                   { sum: sum.to_a,    dtype: sum.dtype, max: @ary.max(axis: -1).to_a, argmin: @ary.argmin(axis: 1).to_a, mean: @ary.mean(axis: 0).to_a })
+    end
+
+    test("strided view") do
+      view = @ary.transpose[1.., 0..]
+      assert_equal({ sum: 7,        min: [-1, -5],             argmax: 3 },
+                   { sum: view.sum, min: view.min(axis: 0).to_a, argmax: view.argmax })
+    end
+
+    test("float sum") do
+      ary = MemoryViewTestHelper::NDArray.new([10000], :float32)
+      ary.fill(0.1)
+      assert_in_delta(1000.0, ary.sum, 1e-3)
+    end
+
+    test("NaN") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1.0, Float::NAN, -1.0, Float::NAN])
+      assert_equal({ min: true,           argmin: 1,          argmax: 1 },
+                   { min: ary.min.nan?, argmin: ary.argmin, argmax: ary.argmax })
+    end
+
+    test("empty") do
+      ary = MemoryViewTestHelper::NDArray.new([0, 3], :uint16)
+      assert_equal({ sum: 0,       axis_sum: [0, 0, 0] },
+                   { sum: ary.sum, axis_sum: ary.sum(axis: 0).to_a })
+      assert_raise(ArgumentError) do
+        ary.max
+      end
+    end
+
+    test("parallel") do
+      num_threads = MemoryViewTestHelper::NDArray.num_threads
+      parallel_threshold = MemoryViewTestHelper::NDArray.parallel_threshold
+      begin
+        MemoryViewTestHelper::NDArray.num_threads = 4
+        MemoryViewTestHelper::NDArray.parallel_threshold = 1
+        ary = MemoryViewTestHelper::NDArray.try_convert((1..10).map {|i| [i % 3, -i] }, dtype: :int32)
+        assert_equal({ sum: -45,      argmin: 19,         argmax: 2,          max: [2, -1] },
+                     { sum: ary.sum, argmin: ary.argmin, argmax: ary.argmax, max: ary.max(axis: 0).to_a })
+      ensure
+        MemoryViewTestHelper::NDArray.num_threads = num_threads
+        MemoryViewTestHelper::NDArray.parallel_threshold = parallel_threshold
+      end
+    end
+  end
+
+  sub_test_case("approximate comparison") do
+    def setup
+      @a = MemoryViewTestHelper::NDArray.try_convert([[1.0, 2.0], [3.0, Float::NAN]])
+      @b = MemoryViewTestHelper::NDArray.try_convert([[1.0, 2.0 + 1e-9], [3.1, Float::NAN]], dtype: :float32)
+    end
+
+    test("#allclose?") do
+      assert_equal({ default: false, atol: false, equal_nan: true, ints: true },
+                   { default: @a.allclose?(@b, equal_nan: true),
+                     atol: @a.allclose?(@b, atol: 0.2),
+                     equal_nan: @a.allclose?(@b, atol: 0.2, equal_nan: true),
+                     ints: @a[0, 0..].allclose?([1, 2]) })
+    end
+
+    test("#mismatch") do
+      assert_equal({ exact: [[[1, 0], 3.0, 3.0999999046325684], [[1, 1], Float::NAN, Float::NAN]].inspect,
+                     close: [[[1, 0], 3.0, 3.0999999046325684]] },
+                   { exact: @a.mismatch(@b).inspect,
+                     close: @a.mismatch(@b, atol: 1e-6, equal_nan: true) })
+    end
+
+    test("#mismatch in row-major order") do
+      c = MemoryViewTestHelper::NDArray.try_convert([[1, 2], [3, 4]], dtype: :int16)
+      d = MemoryViewTestHelper::NDArray.try_convert([[1, 0], [0, 4]], dtype: :int32)
+      assert_equal({ all: [[[0, 1], 3, 0], [[1, 0], 2, 0]], limit: [[[0, 1], 2, 0]], same: [] },
+                   { all: c.transpose.mismatch(d.transpose), limit: c.mismatch(d, limit: 1), same: c.mismatch(c) })
+    end
+  end
+
+  sub_test_case("arithmetic") do
+    def setup
+      @a = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :int32)
+      @b = MemoryViewTestHelper::NDArray.try_convert([10, 20, 30], dtype: :int16)
+    end
+
+    test("broadcasting") do
+      col = MemoryViewTestHelper::NDArray.try_convert([[100], [200]], dtype: :int16)
+      sum = @a + @b
+      assert_equal({ sum: [[11, 22, 33], [14, 25, 36]], dtype: :int32,   col: [[101, 102, 103], [204, 205, 206]] },
+                   { sum: sum.to_a,                     dtype: sum.dtype, col: (@a + col).to_a })
+    end
+
+    test("scalars") do
+      assert_equal({ int: [[2, 4, 6], [8, 10, 12]], int_dtype: :int32,
+                     float: [[0.5, 1.0, 1.5], [2.0, 2.5, 3.0]], float_dtype: :float64 },
+                   { int: (@a * 2).to_a, int_dtype: (@a * 2).dtype,
+                     float: (@a * 0.5).to_a, float_dtype: (@a * 0.5).dtype })
+    end
+
+    test("integer scalars out of the range") do
+      x = MemoryViewTestHelper::NDArray.try_convert([200, 100], dtype: :uint8)
+      add = x + 300
+      assert_equal({ add: [500, 400], add_dtype: :int64,   sub: [201, 101], big: [2**40 + 1, 2**40 + 2], big_dtype: :int64 },
+                   { add: add.to_a,   add_dtype: add.dtype, sub: (x - -1).to_a,
+                     big: (@a[0, 0..1] + 2**40).to_a, big_dtype: (@a + 2**40).dtype })
+    end
+
+    test("comparison with scalars out of the range") do
+      x = MemoryViewTestHelper::NDArray.try_convert([200, 100], dtype: :uint8)
+      f = MemoryViewTestHelper::NDArray.try_convert([1.0, Float::NAN], dtype: :float32)
+      assert_equal({ lt: [true, true], ge: [true, true], gt: [false, false], float: [true, false] },
+                   { lt: (x < 300).to_a, ge: (x >= -1).to_a, gt: (@a[0, 0..1] > 2**70).to_a, float: (f < 10**40).to_a })
+    end
+
+    test("expression") do
+      x = MemoryViewTestHelper::NDArray.try_convert([1.5, -2.0], dtype: :float32)
+      y = MemoryViewTestHelper::NDArray.try_convert([[1, 2], [3, 4]], dtype: :int8)
+      res = x * 2 + y
+      assert_equal({ items: [[4.0, -2.0], [6.0, 0.0]], dtype: :float32 },
+                   { items: res.to_a,                  dtype: res.dtype })
+    end
+
+    test("integer division") do
+      x = MemoryViewTestHelper::NDArray.try_convert([7, -7, 7, -7, -128], dtype: :int8)
+      y = MemoryViewTestHelper::NDArray.try_convert([2, 2, -2, -2, -1], dtype: :int8)
+      assert_equal([3, -4, -4, 3, -128], (x / y).to_a)
+      assert_raise(ZeroDivisionError) do
+        x / 0
+      end
+    end
+
+    test("wrap around") do
+      x = MemoryViewTestHelper::NDArray.try_convert([200, 100], dtype: :uint8)
+      assert_equal({ add: [144, 200], sub: [0, 156], mul: [64, 16] },
+                   { add: (x + x).to_a, sub: (x - 200).to_a, mul: (x * x).to_a })
+    end
+
+    test("comparison") do
+      res = @a > @b.transpose / 5
+      assert_equal({ items: [[false, false, false], [true, true, false]], dtype: :bool, le: [[true, true, true], [false, false, false]] },
+                   { items: res.to_a,                 dtype: res.dtype, le: (@a <= 3).to_a })
+    end
+
+    test("in place") do
+      res = @a.add!(@b)
+      assert_equal({ same: true,          items: [[11, 22, 33], [14, 25, 36]] },
+                   { same: res.equal?(@a), items: @a.to_a })
+    end
+
+    test("in place with overlap") do
+      x = MemoryViewTestHelper::NDArray.try_convert([[1, 2], [3, 4]], dtype: :int64)
+      x.add!(x.transpose)
+      y = MemoryViewTestHelper::NDArray.try_convert([1, 2, 3, 4], dtype: :int64)
+      y[1..].sub!(y[..2])
+      assert_equal({ x: [[2, 5], [5, 8]], y: [1, 1, 1, 1] },
+                   { x: x.to_a,           y: y.to_a })
+    end
+
+    test("in place errors") do
+      assert_raise(TypeError) do
+        @a.mul!(0.5)
+      end
+      assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.try_convert([1, 2, 3], dtype: :int32).add!(@a)
+      end
+      assert_raise(FrozenError) do
+        @a.freeze.add!(1)
+      end
+    end
+
+    test("incompatible shapes") do
+      assert_raise_message("operands could not be broadcast together with shapes [2, 3] [2]") do
+        @a + [1, 2]
+      end
+    end
+  end
+
+  sub_test_case("matrix product") do
+    def product(a, b)
+      a.map {|row| b.transpose.map {|col| row.zip(col).sum {|x, y| x * y } } }
+    end
+
+    test("matrices and vectors") do
+      a = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :float64)
+      b = MemoryViewTestHelper::NDArray.try_convert([[7, 8], [9, 10], [11, 12]], dtype: :float64)
+      v = MemoryViewTestHelper::NDArray.try_convert([1, 0, -1], dtype: :float64)
+      assert_equal({ mm: [[58.0, 64.0], [139.0, 154.0]], mv: [-2.0, -2.0], vm: [-4.0, -4.0], vv: 2.0,
+                     matmul: [[58.0, 64.0], [139.0, 154.0]] },
+                   { mm: a.dot(b).to_a, mv: a.dot(v).to_a, vm: v.dot(b).to_a, vv: v.dot(v),
+                     matmul: a.matmul(b).to_a })
+    end
+
+    data("crossing MC", [67, 3, 5])
+    data("crossing KC", [5, 260, 9])
+    data("crossing NC", [3, 4, 1030])
+    test("blocks and layouts") do |(m, k, n)|
+      a = Array.new(m) {|i| Array.new(k) {|j| (i * 7 + j * 3) % 11 - 5 } }
+      b = Array.new(k) {|i| Array.new(n) {|j| (i * 5 + j) % 13 - 6 } }
+      expected = product(a, b)
+      results = [:float32, :float64, :int32].product([:row_major, :column_major]).map do |dtype, order|
+        x = MemoryViewTestHelper::NDArray.try_convert(a, dtype: dtype, order: order)
+        y = MemoryViewTestHelper::NDArray.try_convert(b, dtype: dtype, order: order)
+        x.dot(y).to_a
+      end
+      transposed = MemoryViewTestHelper::NDArray.try_convert(b.transpose, dtype: :float64).transpose
+      assert_equal([expected] * 7,
+                   [*results, MemoryViewTestHelper::NDArray.try_convert(a, dtype: :float64).dot(transposed).to_a])
+    end
+
+    test("dtypes") do
+      x = MemoryViewTestHelper::NDArray.try_convert([[100, 100], [-1, 2]], dtype: :int8)
+      y = MemoryViewTestHelper::NDArray.try_convert([[2], [1]], dtype: :int8)
+      h = MemoryViewTestHelper::NDArray.try_convert([[0.5, 1.5]], dtype: :float16)
+      assert_equal({ wrap: [[44], [0]], wrap_dtype: :int8, promoted: [[300], [0]], promoted_dtype: :int16,
+                     half: [[2.5]], half_dtype: :float16 },
+                   { wrap: x.dot(y).to_a, wrap_dtype: x.dot(y).dtype,
+                     promoted: x.dot(y.astype(:int16)).to_a, promoted_dtype: x.dot(y.astype(:int16)).dtype,
+                     half: h.dot(h.transpose).to_a, half_dtype: h.dot(h.transpose).dtype })
+    end
+
+    test("empty") do
+      x = MemoryViewTestHelper::NDArray.new([2, 0], :float64)
+      y = MemoryViewTestHelper::NDArray.new([0, 3], :float64)
+      assert_equal({ zeros: [[0.0] * 3] * 2, empty: [] },
+                   { zeros: x.dot(y).to_a,   empty: y.dot(y.transpose).to_a })
+    end
+
+    test("errors") do
+      a = MemoryViewTestHelper::NDArray.try_convert([[1, 2, 3], [4, 5, 6]], dtype: :float64)
+      assert_raise_message("shapes [2, 3] and [2, 3] not aligned: 3 (dim 1) != 2 (dim 0)") do
+        a.dot(a)
+      end
+      assert_raise(ArgumentError) do
+        a.dot(MemoryViewTestHelper::NDArray.new([3, 1, 1], :float64))
+      end
+      assert_raise(TypeError) do
+        a.astype(:complex128).dot(a.transpose)
+      end
+    end
+  end
+
+  sub_test_case("dtypes") do
+    test("float16") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1.0/3, 65504.0, -0.0, Float::INFINITY], dtype: :float16)
+      assert_equal({ items: [0.333251953125, 65504.0, -0.0, Float::INFINITY], item_size: 2,             binary: "\x55\x35\xff\x7b\x00\x80\x00\x7c".b },
+                   { items: ary.to_a,                                       item_size: ary.item_size, binary: ary.to_binary })
+      assert_raise_message("float 65520.000000 too big to convert to `float16'") do
+        ary[0] = 65520.0
+      end
+      # rounded once, not to float first
+      v = 1.0 + 2**-11 + 2**-30
+      assert_equal({ try_convert: [1.0009765625], astype: [1.0009765625] },
+                   { try_convert: MemoryViewTestHelper::NDArray.try_convert([v], dtype: :float16).to_a,
+                     astype: MemoryViewTestHelper::NDArray.try_convert([v]).astype(:float16).to_a })
+    end
+
+    test("bfloat16") do
+      v = 1.0 + 2**-8 + 2**-30
+      ary = MemoryViewTestHelper::NDArray.try_convert([1.0/3, 3.0e38, v], dtype: :bfloat16)
+      assert_equal({ items: [0.333984375, 3.00405527047391e+38, 1.0078125], astype: [1.0078125] },
+                   { items: ary.to_a,
+                     astype: MemoryViewTestHelper::NDArray.try_convert([v]).astype(:bfloat16).to_a })
+    end
+
+    test("half-precision arithmetic and reductions") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([0.5, 1.5, 2.5], dtype: :float16)
+      res = ary * 2
+      assert_equal({ dtype: :float16,   items: [1.0, 3.0, 5.0], sum: 4.5,     max: 2.5,     astype: [0, 1, 2] },
+                   { dtype: res.dtype,  items: res.to_a,        sum: ary.sum, max: ary.max, astype: ary.astype(:int32).to_a })
+      assert_raise(RangeError) do
+        MemoryViewTestHelper::NDArray.try_convert([1.0e5]).astype(:float16, checked: true)
+      end
+    end
+
+    test("complex") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1, Complex(2, 1)])
+      res = ary * Complex(0, 1)
+      assert_equal({ dtype: :complex128, items: [Complex(1, 0), Complex(2, 1)], product: [Complex(0, 1), Complex(-1, 2)], sum: Complex(3, 1) },
+                   { dtype: ary.dtype,   items: ary.to_a,                       product: res.to_a,                         sum: ary.sum })
+      assert_raise_message("min is not supported for complex arrays") do
+        ary.min
+      end
+    end
+
+    test("complex64 with float32") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1, 2], dtype: :float32) + Complex(0, 0.5)
+      assert_equal({ dtype: :complex64, items: [Complex(1, 0.5), Complex(2, 0.5)], checked: [1.0, 2.0] },
+                   { dtype: ary.dtype,  items: ary.to_a,                           checked: (ary - Complex(0, 0.5)).astype(:float64, checked: true).to_a })
+    end
+
+    test("bool") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([true, false, true])
+      assert_equal({ dtype: :bool,    items: [true, false, true], equality: true,                                                          sum: 2,       min: false,   item_format: "C" },
+                   { dtype: ary.dtype, items: ary.to_a,           equality: ary == MemoryViewTestHelper::NDArray.try_convert([true, false, true]), sum: ary.sum, min: ary.min, item_format: ary.item_format })
+      assert_raise_message("no implicit conversion of Integer into bool") do
+        ary[0] = 1
+      end
+      assert_raise_message("+ is not supported for bool arrays") do
+        ary + ary
+      end
+    end
+
+    test("record") do
+      ary = MemoryViewTestHelper::NDArray.new([2], :record, format: "l d")
+      ary[0] = [1, 0.5]
+      ary[1] = [-2, 1.5]
+      assert_equal({ items: [[1, 0.5], [-2, 1.5]], item_size: 12,            item_format: "ld",            binary: [1, 0.5, -2, 1.5].pack("l<El<E") },
+                   { items: ary.to_a,              item_size: ary.item_size, item_format: ary.item_format, binary: ary.to_binary })
+      assert_raise_message("sum is not supported for record arrays") do
+        ary.sum
+      end
+      assert_raise(TypeError) do
+        ary.astype(:int32)
+      end
+    end
+
+    test("record from binary") do
+      ary = MemoryViewTestHelper::NDArray.from_binary([1, 2, 3, 4].pack("s*"), [2], :record, format: "s2")
+      assert_equal({ items: [[[1, 2]], [[3, 4]]], copy: ary.to_a },
+                   { items: ary.to_a,             copy: ary.astype(:record).to_a })
+    end
+
+    test("errors") do
+      assert_raise_message("the record dtype needs the item format") do
+        MemoryViewTestHelper::NDArray.new([2], :record)
+      end
+      assert_raise(ArgumentError) do
+        MemoryViewTestHelper::NDArray.new([2], :int32, format: "l")
+      end
+      assert_raise_message("auto promotion between bool and numeric is not supported") do
+        MemoryViewTestHelper::NDArray.try_convert([true, 1])
+      end
+    end
+  end
+
+  sub_test_case("byte order") do
+    test("from_binary") do
+      ary = MemoryViewTestHelper::NDArray.from_binary([1, -2, 3].pack("l>*"), [3], :int32, byte_order: :big)
+      assert_equal({ byte_order: :big,           items: [1, -2, 3], sum: 2,       native: [1, -2, 3],                   binary: [1, -2, 3].pack("l>*") },
+                   { byte_order: ary.byte_order, items: ary.to_a,   sum: ary.sum, native: ary.astype(:int32).to_binary.unpack("l*"), binary: ary.to_binary })
+    end
+
+    test("setting items") do
+      ary = MemoryViewTestHelper::NDArray.new([2], :float64, byte_order: :big)
+      ary[0] = 1.5
+      ary[1] = -0.25
+      assert_equal([1.5, -0.25].pack("G*"), ary.to_binary)
+    end
+
+    test("#byteswap!") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1, 256], dtype: :int16)
+      assert_equal({ same: true,                   items: [256, 1] },
+                   { same: ary.byteswap!.equal?(ary), items: ary.to_a })
+    end
+
+    test("#newbyteorder") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([1, 2], dtype: :int32)
+      view = ary.newbyteorder
+      view[1] = 3
+      swapped = ->(v) { [v].pack("l").reverse.unpack1("l") }
+      assert_equal({ byte_order: ary.byte_order == :little ? :big : :little, items: [swapped[1], 3], shared: swapped[3], restored: [1, swapped[3]] },
+                   { byte_order: view.byte_order,                             items: view.to_a,        shared: ary[1],     restored: view.newbyteorder(:swap).to_a })
+    end
+
+    test("complex") do
+      ary = MemoryViewTestHelper::NDArray.try_convert([Complex(1, 2)], dtype: :complex64)
+      assert_equal({ items: [Complex(1, 2)], binary: [1, 2].map {|v| [v].pack("f").reverse }.join },
+                   { items: ary.byteswap!.newbyteorder.to_a, binary: ary.to_binary })
+    end
+
+    test("kernels") do
+      x = MemoryViewTestHelper::NDArray.from_binary([1, 2, 3].pack("s>*"), [3], :int16, byte_order: :big)
+      y = MemoryViewTestHelper::NDArray.try_convert([1, 2, 3], dtype: :int16)
+      x.add!(1)
+      assert_equal({ eq: true,   close: true,          sum: [3, 5, 7],      binary: [2, 3, 4].pack("s>*") },
+                   { eq: x - 1 == y, close: x.allclose?(y + 1), sum: (x + y).to_a, binary: x.to_binary })
+    end
+
+    test("errors") do
+      assert_raise_message("invalid byte order (:middle)") do
+        MemoryViewTestHelper::NDArray.new([2], :int32, byte_order: :middle)
+      end
+      assert_raise_message("byteswap! is not supported for record arrays") do
+        MemoryViewTestHelper::NDArray.new([2], :record, format: "sl").byteswap!
+      end
+    end
+  end
+
+  sub_test_case("generators") do
+    test(".random") do
+      ary = MemoryViewTestHelper::NDArray.random([1000], :float64, seed: 42)
+      same = MemoryViewTestHelper::NDArray.random([1000], :float64, seed: 42)
+      other = MemoryViewTestHelper::NDArray.random([1000], :float64, seed: 43)
+      assert_equal({ same: true,        other: false,        in_range: true },
+                   { same: ary == same, other: ary == other, in_range: ary.min >= 0.0 && ary.max < 1.0 })
+      # the stream of PCG32 (XSH RR 64/32), and the Box-Muller transform of it
+      assert_equal({ uint32: [3270867926, 1924641435, 4121910957, 3418829100],
+                     normal: [-0.699215707340, 0.081757594507] },
+                   { uint32: MemoryViewTestHelper::NDArray.random([4], :uint32, seed: 42).to_a,
+                     normal: MemoryViewTestHelper::NDArray.random([2], :float64, seed: 42, distribution: :normal).to_a.map {|v| v.round(12) } })
+    end
+
+    test(".random in parallel") do
+      num_threads = MemoryViewTestHelper::NDArray.num_threads
+      parallel_threshold = MemoryViewTestHelper::NDArray.parallel_threshold
+      expected = MemoryViewTestHelper::NDArray.random([7, 11], :complex128, seed: 1, distribution: :normal)
+      begin
+        MemoryViewTestHelper::NDArray.num_threads = 3
+        MemoryViewTestHelper::NDArray.parallel_threshold = 1
+        assert_equal(expected, MemoryViewTestHelper::NDArray.random([7, 11], :complex128, seed: 1, distribution: :normal))
+      ensure
+        MemoryViewTestHelper::NDArray.num_threads = num_threads
+        MemoryViewTestHelper::NDArray.parallel_threshold = parallel_threshold
+      end
+    end
+
+    test(".random with range") do
+      ints = MemoryViewTestHelper::NDArray.random([1000], :int8, seed: 1, range: -3...3)
+      floats = MemoryViewTestHelper::NDArray.random([1000], :float32, seed: 1, range: 2.0..4.0)
+      bools = MemoryViewTestHelper::NDArray.random([1000], :bool, seed: 1).astype(:int32)
+      assert_equal({ ints: [-3, 2],             floats: true,                                  bools: true },
+                   { ints: [ints.min, ints.max], floats: floats.min >= 2.0 && floats.max <= 4.0, bools: (400..600).cover?(bools.sum) })
+    end
+
+    test(".random normal") do
+      ary = MemoryViewTestHelper::NDArray.random([10000], :float64, seed: 1, distribution: :normal)
+      assert_equal({ mean: true,                   variance: true },
+                   { mean: ary.mean.abs < 0.05, variance: ((ary * ary).mean - 1.0).abs < 0.05 })
+    end
+
+    test(".arange and .linspace") do
+      assert_equal({ arange: [0, 1, 2, 3], step: [5, 2, -1], float: [0.0, 0.5, 1.0, 1.5], dtype: :int16,                                                   linspace: [1.0, 1.25, 1.5, 1.75, 2.0], open: [0, 2, 4] },
+                   { arange: MemoryViewTestHelper::NDArray.arange(4).to_a,
+                     step: MemoryViewTestHelper::NDArray.arange(5, -2, -3).to_a,
+                     float: MemoryViewTestHelper::NDArray.arange(0, 2, 0.5).to_a,
+                     dtype: MemoryViewTestHelper::NDArray.arange(3, dtype: :int16).dtype,
+                     linspace: MemoryViewTestHelper::NDArray.linspace(1, 2, 5).to_a,
+                     open: MemoryViewTestHelper::NDArray.linspace(0, 6, 3, dtype: :int32, endpoint: false).to_a })
+    end
+
+    test(".zeros, .ones, and .full") do
+      zeros = MemoryViewTestHelper::NDArray.zeros([1, 2], :float16)
+      ones = MemoryViewTestHelper::NDArray.ones([2], :bool)
+      full = MemoryViewTestHelper::NDArray.full([3, 2], 7, :int32, order: :column_major)
+      assert_equal({ zeros: [[0.0, 0.0]], ones: [true, true], full: [[7, 7], [7, 7], [7, 7]], strides: [4, 12] },
+                   { zeros: zeros.to_a,   ones: ones.to_a,    full: full.to_a,               strides: full.strides })
+    end
+
+    test(".eye") do
+      assert_equal({ identity: [[1, 0], [0, 1]],                                     offset: [[0, 0, 0], [1, 0, 0]] },
+                   { identity: MemoryViewTestHelper::NDArray.eye(2, :uint8).to_a, offset: MemoryViewTestHelper::NDArray.eye(2, :int32, m: 3, k: -1).to_a })
+    end
+
+    test("errors") do
+      assert_raise_message("200 is out of the range of int8") do
+        MemoryViewTestHelper::NDArray.random([2], :int8, range: 0..200)
+      end
+      assert_raise_message("empty range (3...3)") do
+        MemoryViewTestHelper::NDArray.random([2], :int8, range: 3...3)
+      end
+      assert_raise_message("the normal distribution is not available for int32") do
+        MemoryViewTestHelper::NDArray.random([2], :int32, distribution: :normal)
+      end
+      assert_raise_message("300 is out of the range of uint8") do
+        MemoryViewTestHelper::NDArray.arange(100, 301, 100, dtype: :uint8)
+      end
+      assert_raise_message("step must not be zero") do
+        MemoryViewTestHelper::NDArray.arange(0, 1, 0)
+      end
+    end
+  end
 end